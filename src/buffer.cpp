@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "buffer.h"
+#include "macro.h"
+
+namespace fleet {
+
+struct Buffer::Block {
+  std::atomic<uint32_t> refs;
+  // 已经写入或者被申请的长度。追加数据的Buffer用CAS从自己最后一段的末尾申请，共享内存块的Buffer不会写到同一处
+  std::atomic<uint32_t> used;
+
+  char *data() { return reinterpret_cast<char *>(this + 1); }
+};
+
+const uint32_t Buffer::s_block_capacity = Buffer::BLOCK_SIZE - sizeof(Buffer::Block);
+
+// 每个线程最多缓存的空闲内存块数
+static const size_t s_max_cached_blocks = 256;
+
+static std::atomic<size_t> s_live_blocks = {0};
+
+// 线程本地缓存是否已经析构，trivial类型，线程退出时也能安全访问
+static thread_local bool t_block_cache_destroyed = false;
+
+struct BlockCache {
+  std::vector<void *> blocks;
+
+  ~BlockCache() {
+    t_block_cache_destroyed = true;
+    for (auto block : blocks) {
+      free(block);
+    }
+  }
+};
+
+static BlockCache *get_block_cache() {
+  if (t_block_cache_destroyed) {
+    return nullptr;
+  }
+  static thread_local BlockCache t_cache;
+  return &t_cache;
+}
+
+Buffer::Block *Buffer::alloc_block() {
+  void *mem = nullptr;
+  auto cache = get_block_cache();
+  if (cache && !cache->blocks.empty()) {
+    mem = cache->blocks.back();
+    cache->blocks.pop_back();
+  } else {
+    mem = malloc(BLOCK_SIZE);
+    if (UNLIKELY(!mem)) {
+      throw std::bad_alloc();
+    }
+  }
+  ++s_live_blocks;
+  auto block = static_cast<Block *>(mem);
+  block->refs.store(1, std::memory_order_relaxed);
+  block->used.store(0, std::memory_order_relaxed);
+  return block;
+}
+
+void Buffer::release_block(Block *block) {
+  if (block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  --s_live_blocks;
+  // 放回当前线程的缓存，不管是哪个线程分配的
+  auto cache = get_block_cache();
+  if (cache && cache->blocks.size() < s_max_cached_blocks) {
+    cache->blocks.push_back(block);
+    return;
+  }
+  free(block);
+}
+
+Buffer::Buffer(const Buffer &other) : _segments(other._segments), _size(other._size) {
+  for (auto &seg : _segments) {
+    seg.block->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+Buffer::Buffer(Buffer &&other) { *this = std::move(other); }
+
+Buffer &Buffer::operator=(const Buffer &other) {
+  if (this != &other) {
+    Buffer copy(other);
+    *this = std::move(copy);
+  }
+  return *this;
+}
+
+Buffer &Buffer::operator=(Buffer &&other) {
+  if (this != &other) {
+    clear();
+    _segments.swap(other._segments);
+    _size = other._size;
+    other._size = 0;
+  }
+  return *this;
+}
+
+Buffer::~Buffer() {
+  clear();
+  for (auto block : _reserved) {
+    release_block(block);
+  }
+}
+
+size_t Buffer::claim_tail(size_t length) {
+  if (_segments.empty()) {
+    return 0;
+  }
+  Segment &tail = _segments.back();
+  uint32_t expected = tail.end;
+  if (expected >= s_block_capacity) {
+    return 0;
+  }
+  size_t n = std::min(length, static_cast<size_t>(s_block_capacity - expected));
+  // 只有最后一段的末尾就是内存块中已经使用的位置时才能接着写，否则后面的空间已经属于其他Buffer
+  if (!tail.block->used.compare_exchange_strong(expected, expected + n, std::memory_order_relaxed)) {
+    return 0;
+  }
+  return n;
+}
+
+void Buffer::append(const void *data, size_t length) {
+  auto src = static_cast<const char *>(data);
+  while (length > 0) {
+    size_t n = claim_tail(length);
+    if (n == 0) {
+      _segments.push_back({alloc_block(), 0, 0});
+      continue;
+    }
+    Segment &tail = _segments.back();
+    memcpy(tail.block->data() + tail.end, src, n);
+    tail.end += n;
+    _size += n;
+    src += n;
+    length -= n;
+  }
+}
+
+void Buffer::append(const Buffer &other) {
+  if (&other == this) {
+    Buffer copy(other);
+    append(copy);
+    return;
+  }
+  for (auto &seg : other._segments) {
+    if (seg.begin == seg.end) {
+      continue;
+    }
+    seg.block->refs.fetch_add(1, std::memory_order_relaxed);
+    _segments.push_back(seg);
+  }
+  _size += other._size;
+}
+
+Buffer Buffer::slice(size_t offset, size_t length) const {
+  Buffer result;
+  if (offset >= _size) {
+    return result;
+  }
+  length = std::min(length, _size - offset);
+  for (auto &seg : _segments) {
+    size_t seg_len = seg.end - seg.begin;
+    if (offset >= seg_len) {
+      offset -= seg_len;
+      continue;
+    }
+    uint32_t n = std::min(length, seg_len - offset);
+    uint32_t begin = seg.begin + offset;
+    seg.block->refs.fetch_add(1, std::memory_order_relaxed);
+    result._segments.push_back({seg.block, begin, begin + n});
+    result._size += n;
+    length -= n;
+    offset = 0;
+    if (length == 0) {
+      break;
+    }
+  }
+  return result;
+}
+
+void Buffer::consume(size_t length) {
+  length = std::min(length, _size);
+  while (length > 0) {
+    Segment &front = _segments.front();
+    size_t seg_len = front.end - front.begin;
+    if (length < seg_len) {
+      front.begin += length;
+      _size -= length;
+      return;
+    }
+    length -= seg_len;
+    _size -= seg_len;
+    if (_segments.size() == 1 && front.block->refs.load(std::memory_order_acquire) == 1) {
+      // 最后一个内存块只有自己在用，从头开始复用，读完再收的循环中不用换内存块
+      front.begin = front.end = 0;
+      front.block->used.store(0, std::memory_order_relaxed);
+      return;
+    }
+    release_block(front.block);
+    _segments.pop_front();
+  }
+}
+
+void Buffer::clear() {
+  for (auto &seg : _segments) {
+    release_block(seg.block);
+  }
+  _segments.clear();
+  _size = 0;
+}
+
+size_t Buffer::copy_to(void *dest, size_t length, size_t offset) const {
+  auto dst = static_cast<char *>(dest);
+  size_t copied = 0;
+  for (auto &seg : _segments) {
+    if (copied == length) {
+      break;
+    }
+    size_t seg_len = seg.end - seg.begin;
+    if (offset >= seg_len) {
+      offset -= seg_len;
+      continue;
+    }
+    size_t n = std::min(length - copied, seg_len - offset);
+    memcpy(dst + copied, seg.block->data() + seg.begin + offset, n);
+    copied += n;
+    offset = 0;
+  }
+  return copied;
+}
+
+std::string Buffer::to_string() const {
+  std::string str;
+  str.reserve(_size);
+  for (auto &seg : _segments) {
+    str.append(seg.block->data() + seg.begin, seg.end - seg.begin);
+  }
+  return str;
+}
+
+size_t Buffer::find(const char *pattern, size_t length, size_t from) const {
+  if (from > _size || length > _size - from) {
+    return npos;
+  }
+  if (length == 0) {
+    return from;
+  }
+  // pos是当前段在Buffer中的起始位置
+  size_t pos = 0;
+  for (size_t i = 0; i < _segments.size(); i++) {
+    const Segment &seg = _segments[i];
+    const char *data = seg.block->data() + seg.begin;
+    size_t seg_len = seg.end - seg.begin;
+    size_t k = from > pos ? from - pos : 0;
+    while (k < seg_len) {
+      if (pos + k + length > _size) {
+        return npos;
+      }
+      // 先找第一个字符，再比较剩下的部分，可能跨段
+      auto first = static_cast<const char *>(memchr(data + k, pattern[0], seg_len - k));
+      if (!first) {
+        break;
+      }
+      k = first - data;
+      size_t matched = 0;
+      size_t j = i;
+      size_t offset = k;
+      while (matched < length && j < _segments.size()) {
+        const Segment &cur = _segments[j];
+        size_t n = std::min(length - matched, static_cast<size_t>(cur.end - cur.begin) - offset);
+        if (memcmp(cur.block->data() + cur.begin + offset, pattern + matched, n) != 0) {
+          break;
+        }
+        matched += n;
+        offset = 0;
+        j++;
+      }
+      if (matched == length) {
+        return pos + k;
+      }
+      k++;
+    }
+    pos += seg_len;
+  }
+  return npos;
+}
+
+size_t Buffer::get_read_iovecs(iovec *iovs, size_t max_count) const {
+  size_t count = 0;
+  for (auto &seg : _segments) {
+    if (count == max_count) {
+      break;
+    }
+    if (seg.begin == seg.end) {
+      continue;
+    }
+    iovs[count].iov_base = seg.block->data() + seg.begin;
+    iovs[count].iov_len = seg.end - seg.begin;
+    count++;
+  }
+  return count;
+}
+
+size_t Buffer::prepare(size_t length, iovec *iovs, size_t max_count) {
+  size_t count = 0;
+  size_t total = 0;
+  _tail_claimed = 0;
+  if (max_count == 0 || length == 0) {
+    return 0;
+  }
+  // 先用最后一个内存块的剩余空间
+  size_t n = claim_tail(length);
+  if (n) {
+    Segment &tail = _segments.back();
+    iovs[count].iov_base = tail.block->data() + tail.end;
+    iovs[count].iov_len = n;
+    count++;
+    total += n;
+    _tail_claimed = n;
+  }
+  for (size_t i = 0; total < length && count < max_count; i++) {
+    if (i == _reserved.size()) {
+      _reserved.push_back(alloc_block());
+    }
+    n = std::min(length - total, static_cast<size_t>(s_block_capacity));
+    iovs[count].iov_base = _reserved[i]->data();
+    iovs[count].iov_len = n;
+    count++;
+    total += n;
+  }
+  return count;
+}
+
+void Buffer::commit(size_t length) {
+  if (_tail_claimed) {
+    Segment &tail = _segments.back();
+    size_t n = std::min(length, static_cast<size_t>(_tail_claimed));
+    tail.end += n;
+    _size += n;
+    length -= n;
+    // 归还申请了但没有用到的空间
+    tail.block->used.store(tail.end, std::memory_order_relaxed);
+    _tail_claimed = 0;
+  }
+  size_t used_blocks = 0;
+  while (length > 0) {
+    ASSERT(used_blocks < _reserved.size());
+    Block *block = _reserved[used_blocks++];
+    uint32_t n = std::min(length, static_cast<size_t>(s_block_capacity));
+    block->used.store(n, std::memory_order_relaxed);
+    _segments.push_back({block, 0, n});
+    _size += n;
+    length -= n;
+  }
+  _reserved.erase(_reserved.begin(), _reserved.begin() + used_blocks);
+}
+
+size_t Buffer::s_get_live_blocks() { return s_live_blocks; }
+}  // namespace fleet
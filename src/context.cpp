@@ -0,0 +1,135 @@
+#include <cstdint>
+
+#include "context.h"
+#include "macro.h"
+
+/**
+ * 栈上保存的布局(从低地址到高地址)
+ * x86-64:  mxcsr/x87控制字, r15, r14, r13, r12, rbx, rbp, 返回地址
+ * aarch64: d8-d15, x19-x28, x29(fp), x30(lr)
+ */
+#if defined(__x86_64__)
+asm(R"(
+.text
+.globl fleet_swap_context
+.type fleet_swap_context,@function
+.align 16
+fleet_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+.size fleet_swap_context,.-fleet_swap_context
+)");
+#elif defined(__aarch64__)
+asm(R"(
+.text
+.globl fleet_swap_context
+.type fleet_swap_context,%function
+.align 4
+fleet_swap_context:
+    sub sp, sp, #0xa0
+    stp d8, d9, [sp, #0x00]
+    stp d10, d11, [sp, #0x10]
+    stp d12, d13, [sp, #0x20]
+    stp d14, d15, [sp, #0x30]
+    stp x19, x20, [sp, #0x40]
+    stp x21, x22, [sp, #0x50]
+    stp x23, x24, [sp, #0x60]
+    stp x25, x26, [sp, #0x70]
+    stp x27, x28, [sp, #0x80]
+    stp x29, x30, [sp, #0x90]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0x00]
+    ldp d10, d11, [sp, #0x10]
+    ldp d12, d13, [sp, #0x20]
+    ldp d14, d15, [sp, #0x30]
+    ldp x19, x20, [sp, #0x40]
+    ldp x21, x22, [sp, #0x50]
+    ldp x23, x24, [sp, #0x60]
+    ldp x25, x26, [sp, #0x70]
+    ldp x27, x28, [sp, #0x80]
+    ldp x29, x30, [sp, #0x90]
+    add sp, sp, #0xa0
+    ret
+.size fleet_swap_context,.-fleet_swap_context
+)");
+#endif
+
+namespace fleet {
+
+#ifdef FLEET_USE_UCONTEXT
+
+void Context::make(void *stack, size_t size, void (*entry)()) {
+  if (getcontext(&_ctx) == -1) {
+    ASSERT2(false, getcontext);
+  }
+  _ctx.uc_link = nullptr;  // 本contex terminate之后不再自动执行其他context
+  _ctx.uc_stack.ss_sp = stack;
+  _ctx.uc_stack.ss_size = size;
+  // 将entry绑定到_ctx上，但不会立即执行
+  makecontext(&_ctx, entry, 0);
+}
+
+void Context::swap_to(Context &to) {
+  if (swapcontext(&_ctx, &to._ctx) == -1) {
+    ASSERT2(false, swapcontext);
+  }
+}
+
+const char *Context::backend_name() { return "ucontext"; }
+
+#else
+
+void Context::make(void *stack, size_t size, void (*entry)()) {
+  // 栈顶按16字节对齐
+  auto top = reinterpret_cast<uintptr_t>(static_cast<char *>(stack) + size) & ~static_cast<uintptr_t>(15);
+  auto slots = reinterpret_cast<uint64_t *>(top);
+#if defined(__x86_64__)
+  // 第一次切入时ret到entry，进入entry时rsp % 16 == 8，与call指令的效果一致
+  slots[-1] = 0;                                  // entry的返回地址，entry不会返回
+  slots[-2] = reinterpret_cast<uint64_t>(entry);  // ret的目标
+  for (int i = 3; i <= 8; i++) {
+    slots[-i] = 0;  // rbp rbx r12-r15
+  }
+  slots[-9] = 0x037F00001F80;  // 低4字节mxcsr，高2字节x87控制字，均为默认值
+  _sp = &slots[-9];
+#else
+  // 20个寄存器共0xa0字节，x30(lr)是ret的目标
+  for (int i = 1; i <= 20; i++) {
+    slots[-i] = 0;
+  }
+  slots[-1] = reinterpret_cast<uint64_t>(entry);
+  _sp = &slots[-20];
+#endif
+}
+
+const char *Context::backend_name() {
+#if defined(__x86_64__)
+  return "asm-x86_64";
+#else
+  return "asm-aarch64";
+#endif
+}
+
+#endif
+}  // namespace fleet
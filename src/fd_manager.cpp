@@ -45,6 +45,9 @@ FdCtx::FdCtx(int fd) : _fd(fd) {
   }
 }
 
+FdCtx::FdCtx(int fd, bool user_nonblock)
+    : _is_init(true), _is_socket(true), _user_nonblock(user_nonblock), _sys_nonblock(true), _fd(fd) {}
+
 void FdCtx::set_timeout(int type, uint64_t v) {
   if (type == SO_RCVTIMEO) {
     _recv_timeout = v;
@@ -93,6 +96,17 @@ FdCtx::Ptr FdManager::create_FdCtx(int fd) {
   return _fdctxs[fd];
 }
 
+FdCtx::Ptr FdManager::create_socket_FdCtx(int fd, bool user_nonblock) {
+  if (fd == -1) {
+    return nullptr;
+  }
+  auto new_ctx = std::make_shared<FdCtx>(fd, user_nonblock);
+  RWMutexType::WriteLock lock(_fdctxs_mutex);
+  // fd是刚创建的，之前同号的fd已经close并删除了FdCtx
+  _fdctxs[fd] = new_ctx;
+  return new_ctx;
+}
+
 void FdManager::del_FdCtx(int fd) {
   RWMutexType::WriteLock lock(_fdctxs_mutex);
   _fdctxs.erase(fd);  // erase方法可以传入不存在的key
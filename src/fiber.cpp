@@ -1,4 +1,3 @@
-#include <ucontext.h>
 #include <atomic>
 #include <cstddef>
 #include <cstdlib>
@@ -10,6 +9,7 @@
 #include "fiber.h"
 #include "log.h"
 #include "macro.h"
+#include "stack_allocator.h"
 #include "utils.h"
 
 namespace fleet {
@@ -26,49 +26,29 @@ static thread_local Fiber *t_running_fiber = nullptr;
 // 保存原始线程的上下文
 static thread_local Fiber::Ptr t_origin_fiber = nullptr;
 
-/**
- * @brief malloc栈内存分配器
- */
-class MallocStackAllocatorr {
- public:
-  static void *Alloc(size_t size) { return malloc(size); }
-  static void Dealloc(void *vp, size_t size) { free(vp); }
-};
-
-using StackAllocator = MallocStackAllocatorr;
-
 Fiber::Fiber() {
   _state = RUNNING;
   t_running_fiber = this;
   _id = ++s_fiber_id;  // 协程id非零
-
-  if (getcontext(&_ctx) == -1) {
-    ASSERT2(false, getcontext);
-  }
+  // 主协程的上下文在第一次切出时保存，无需初始化
 
   ++s_fiber_count;
   // DebugL << "Fiber::Fiber main";
 }
 
 // 这里cb只能传右值，不能传左值
-Fiber::Fiber(std::function<void()> &&cb, size_t stack_size, bool run_in_schduler)
+Fiber::Fiber(Callback &&cb, size_t stack_size, bool run_in_schduler)
     : _cb(std::move(cb)), _run_in_scheduler(run_in_schduler) {
   s_get_this();        // 如果没有主协程，创建之
   _id = ++s_fiber_id;  // 要在主协程创建之后取id
   s_fiber_count++;
-  _stack_size = _stack_size ? _stack_size : FIBER_STACK_SIZE;
-  _stack = StackAllocator ::Alloc(_stack_size);
-
-  if (getcontext(&_ctx) == -1) {
-    ASSERT2(false, getcontext);
-  }
-
-  _ctx.uc_link = nullptr;  // 本contex terminate之后不再自动执行其他context
-  _ctx.uc_stack.ss_sp = _stack;
-  _ctx.uc_stack.ss_size = _stack_size;
+  _stack_size = stack_size ? stack_size : FIBER_STACK_SIZE;
+  _allocator = StackAllocator::s_get_default();
+  _stack = _allocator->alloc(_stack_size);
+  ASSERT2(_stack, "alloc fiber stack");
 
   // 将man_func绑定到_ctx上，但不会立即执行
-  makecontext(&_ctx, &Fiber::main_func, 0);
+  _ctx.make(_stack, _stack_size, &Fiber::main_func);
 }
 
 Fiber::~Fiber() {
@@ -79,7 +59,7 @@ Fiber::~Fiber() {
       ErrorL << _state << " " << get_id();
     }
     // ASSERT(_state == TERMINATED || _state == EXCEPT || _state == INIT);
-    StackAllocator::Dealloc(_stack, _stack_size);
+    _allocator->dealloc(_stack, _stack_size);
   } else {         // 主协程
     ASSERT(!_cb);  // 主协程没有callback
 
@@ -91,22 +71,14 @@ Fiber::~Fiber() {
   DebugL << "Fiber " << get_id();
 }
 
-void Fiber::reuse(std::function<void()> &&cb) {
+void Fiber::reuse(Callback &&cb) {
   // 满足这些条件才能reuse
   ASSERT(_stack);
   ASSERT(_state == TERMINATED || _state == EXCEPT || _state == INIT);
 
   _cb = std::move(cb);
 
-  if (getcontext(&_ctx) == -1) {
-    ASSERT2(false, getcontext);
-  }
-
-  _ctx.uc_link = nullptr;  // 本contex terminate之后不再自动执行其他context
-  _ctx.uc_stack.ss_sp = _stack;
-  _ctx.uc_stack.ss_size = _stack_size;
-
-  makecontext(&_ctx, &Fiber::main_func, 0);
+  _ctx.make(_stack, _stack_size, &Fiber::main_func);
   _state = INIT;
 }
 
@@ -114,9 +86,9 @@ void Fiber::enter() {
   t_running_fiber = this;
   ASSERT(_state != RUNNING);
   _state = RUNNING;
-  if (swapcontext(&(t_origin_fiber->_ctx), &_ctx) == -1) {
-    ASSERT2(false, swapcontext);
-  }
+  t_origin_fiber->_ctx.swap_to(_ctx);
+  // 已经切回，协程的上下文保存完毕
+  _state.store(_yield_state, std::memory_order_release);
 }
 
 void Fiber::yield() {
@@ -124,9 +96,7 @@ void Fiber::yield() {
 
   t_running_fiber = t_origin_fiber.get();
 
-  if (swapcontext(&_ctx, &(t_origin_fiber->_ctx)) == -1) {
-    ASSERT2(false, swapcontext);
-  }
+  _ctx.swap_to(t_origin_fiber->_ctx);
 }
 /************************静态方法**********************/
 
@@ -145,14 +115,14 @@ void Fiber::yield_to_hold() {
   Fiber::Ptr cur = s_get_this();
 
   ASSERT(cur->_state == RUNNING);
-  cur->_state = HOLD;
+  cur->_yield_state = HOLD;
   cur->yield();
 }
 
 void Fiber::yield_to_ready() {
   Fiber::Ptr cur = s_get_this();
   ASSERT(cur->_state == RUNNING);
-  cur->_state = READY;
+  cur->_yield_state = READY;
   cur->yield();
 }
 
@@ -163,20 +133,22 @@ uint64_t Fiber::get_fiber_id() {
   return 0;  // 代表线程中没有任何协程运行
 }
 
+uint64_t Fiber::get_default_stack_size() { return FIBER_STACK_SIZE; }
+
 void Fiber::main_func() {
   // 调用swap_in才会执行此函数，所以running_fiber一定不为空
   auto cur = s_get_this().get();
   ASSERT(cur);
   try {
     cur->_cb();
-    cur->_state = TERMINATED;
+    cur->_yield_state = TERMINATED;
 
   } catch (std::exception &ex) {
-    cur->_state = EXCEPT;
+    cur->_yield_state = EXCEPT;
     ErrorL << "Fiber Exception: " << ex.what() << " fiber id = " << cur->get_id();
     ErrorL << backtrace_to_string();
   } /* catch (...) {
-     cur->_state = EXCEPT;
+     cur->_yield_state = EXCEPT;
      ErrorL << "Fiber Exception: " << " fiber id = " << cur->get_id();
      ErrorL << backtrace_to_string();
    }*/
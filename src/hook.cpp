@@ -1,6 +1,8 @@
 #include <asm-generic/socket.h>
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <cstdarg>
@@ -33,6 +35,7 @@ static thread_local bool t_hook_enable = false;
   XX(socket)         \
   XX(connect)        \
   XX(accept)         \
+  XX(accept4)        \
   XX(read)           \
   XX(readv)          \
   XX(recv)           \
@@ -43,6 +46,8 @@ static thread_local bool t_hook_enable = false;
   XX(send)           \
   XX(sendto)         \
   XX(sendmsg)        \
+  XX(sendfile)       \
+  XX(splice)         \
   XX(close)          \
   XX(fcntl)          \
   XX(ioctl)          \
@@ -72,9 +77,32 @@ void set_hook_enable(bool flag) { t_hook_enable = flag; }
 
 }  // namespace fleet
 
-template <typename OriginFun, typename... Args>  // 可变模板参数
+// 填写io_uring的SQE
+static void prep_sqe(io_uring_sqe *sqe, int op, int fd, const void *addr, unsigned len, uint64_t off) {
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(addr);
+  sqe->len = len;
+  sqe->off = off;
+}
+
+// 没有对应io_uring操作的函数传入NoUringOp，io_uring模式下也使用就绪通知
+struct NoUringOp {};
+
+template <typename Prep>
+static bool prep_uring(Prep &prep, io_uring_sqe *sqe) {
+  prep(sqe);
+  return true;
+}
+
+static bool prep_uring(NoUringOp &, io_uring_sqe *) { return false; }
+
+/**
+ * @param prep io_uring模式下填写该操作的SQE，void(io_uring_sqe *)，或者NoUringOp
+ */
+template <typename OriginFun, typename Prep, typename... Args>  // 可变模板参数
 static ssize_t do_io(int fd, OriginFun func, const char *hook_fun_name, fleet::IOManager::Event event, int timeout_so,
-                     Args &&...args) {  // 万能引用
+                     Prep &&prep, Args &&...args) {  // 万能引用
   if (!fleet::t_hook_enable) {
     return func(fd, std::forward<Args>(args)...);  // 完美转发
   }
@@ -91,6 +119,34 @@ static ssize_t do_io(int fd, OriginFun func, const char *hook_fun_name, fleet::I
   }
 
   uint64_t to = ctx->get_timeout(timeout_so);
+  auto iom = fleet::IOManager::s_get_this();
+  if (UNLIKELY(!iom)) {
+    // 不在IOManager的线程中，无法挂起等待
+    return func(fd, std::forward<Args>(args)...);
+  }
+
+  if (iom->get_io_backend() == fleet::IOBackend::IO_URING) {
+    // 完成通知：直接提交操作，完成后返回结果
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    bool has_op = prep_uring(prep, &sqe);
+    while (has_op) {
+      int ret = iom->submit_io(fd, event, sqe, to, &ctx->get_close_flag());
+      if (ret == -ECANCELED) {
+        // 被del_event取消，和epoll模式一样重试，fd已经关闭则在下一轮返回-EBADF
+        continue;
+      }
+      if (ret == -EAGAIN) {
+        // 旧内核对非阻塞的fd不等待，退回就绪通知
+        break;
+      }
+      if (ret < 0) {
+        errno = -ret;
+        return -1;
+      }
+      return ret;
+    }
+  }
 
   bool retry;
   ssize_t n = 0;
@@ -98,12 +154,13 @@ static ssize_t do_io(int fd, OriginFun func, const char *hook_fun_name, fleet::I
     retry = false;
 
     n = func(fd, std::forward<Args>(args)...);
+    iom->add_syscall_count();
     while (n == -1 && errno == EINTR) {
       n = func(fd, std::forward<Args>(args)...);
+      iom->add_syscall_count();
     }
 
     if (n == -1 && errno == EAGAIN) {
-      auto iom = fleet::IOManager::s_get_this();
       fleet::Timer::Ptr timer;
 
       bool is_timeout = false;
@@ -115,6 +172,10 @@ static ssize_t do_io(int fd, OriginFun func, const char *hook_fun_name, fleet::I
       }
       int ret = iom->add_event(fd, event);
       if (ret == 0) {
+        if (UNLIKELY(ctx->is_close())) {
+          // 注册前fd已经被close，close中的del_and_trigger_all可能没看到这次注册，自己触发
+          iom->del_event(fd, event, true);
+        }
         fleet::Fiber::s_get_this()->yield_to_hold();
 
         if (timer) {
@@ -124,12 +185,16 @@ static ssize_t do_io(int fd, OriginFun func, const char *hook_fun_name, fleet::I
           errno = ETIMEDOUT;
           return -1;
         }
+        if (ctx->is_close()) {
+          errno = EBADF;
+          return -1;
+        }
         retry = true;
       } else {
         if (timer) {
           timer->cancel();
         }
-        ErrorL << hook_fun_name << "cannont add_event(" << socket << ", " << event << ") error";
+        ErrorL << hook_fun_name << "cannont add_event(" << fd << ", " << event << ") error";
         return -1;
       }
     }
@@ -138,6 +203,19 @@ static ssize_t do_io(int fd, OriginFun func, const char *hook_fun_name, fleet::I
   return n;
 }
 
+// 新接受的连接：创建FdCtx并分配reactor，flags是用户传给accept4的flags
+static void on_accepted(int fd, int flags) {
+  fleet::FdManager::Instance().create_socket_FdCtx(fd, flags & SOCK_NONBLOCK);
+  auto iom = fleet::IOManager::s_get_this();
+  if (iom) {
+    // 接受的连接分给fd最少的reactor
+    iom->assign_reactor(fd);
+    if (iom->is_persistent_mode()) {
+      iom->register_persistent(fd);
+    }
+  }
+}
+
 extern "C" {
 // 定义头文件中声明的函数指针
 #define XX(name) name##_type name##_p = nullptr;
@@ -152,16 +230,17 @@ unsigned int sleep(unsigned int seconds) {
 
   auto fiber_this = fleet::Fiber::s_get_this();
   fleet::IOManager *iom = fleet::IOManager::s_get_this();
-  iom->add_timer(seconds * 1000, [iom, fiber_this]() {
-    // 定时器结束时重新执行fiber_this
-    iom->schedule(fiber_this, fleet::get_thread_id());
+  // 定时器回调可能在其他线程执行，所以要在这里取线程号
+  int thread_id = fleet::get_thread_id();
+  iom->add_timer(seconds * 1000, [iom, fiber_this, thread_id]() {
+    // 定时器结束时重新在本线程执行fiber_this
+    iom->schedule(fiber_this, thread_id);
   });
 
   fiber_this->yield_to_hold();  // fiber_this只能由本线程执行，所以定时器的cb只会在yield之后执行
   return 0;
 }
 
-// 由于定时器是毫秒级的，所以usleep只能达到毫秒精度
 int usleep(useconds_t usec) {
   // 如果没有开启hook那么直接调用库函数
   if (!fleet::t_hook_enable) {
@@ -170,23 +249,25 @@ int usleep(useconds_t usec) {
 
   auto fiber_this = fleet::Fiber::s_get_this();
   fleet::IOManager *iom = fleet::IOManager::s_get_this();
-  iom->add_timer(usec / 1000, [iom, fiber_this]() { iom->schedule(fiber_this, fleet::get_thread_id()); });
+  int thread_id = fleet::get_thread_id();
+  iom->add_timer_us(usec, [iom, fiber_this, thread_id]() { iom->schedule(fiber_this, thread_id); });
 
   fiber_this->yield_to_hold();
 
   return 0;
 }
-// 由于定时器是毫秒级的，所以nanosleep只能达到毫秒精度
+// 定时器是微秒级的，不足1微秒的部分向上取整
 int nanosleep(const struct timespec *req, struct timespec *rem) {
   // 如果没有开启hook那么直接调用库函数
   if (!fleet::t_hook_enable) {
     return nanosleep_p(req, rem);
   }
-  int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000000;
+  uint64_t timeout_us = req->tv_sec * 1000000 + (req->tv_nsec + 999) / 1000;
 
   auto fiber_this = fleet::Fiber::s_get_this();
   fleet::IOManager *iom = fleet::IOManager::s_get_this();
-  iom->add_timer(timeout_ms, [iom, fiber_this]() { iom->schedule(fiber_this, fleet::get_thread_id()); });
+  int thread_id = fleet::get_thread_id();
+  iom->add_timer_us(timeout_us, [iom, fiber_this, thread_id]() { iom->schedule(fiber_this, thread_id); });
 
   fiber_this->yield_to_hold();
 
@@ -202,6 +283,14 @@ int socket(int domain, int type, int protocol) {
   }
   // 创建关于fd的FdCtx
   fleet::FdManager::Instance().create_FdCtx(fd);
+  auto iom = fleet::IOManager::s_get_this();
+  if (iom) {
+    // 主动发起的连接由创建它的线程处理
+    iom->assign_reactor(fd, fleet::Scheduler::get_worker_index());
+    if (iom->is_persistent_mode()) {
+      iom->register_persistent(fd);
+    }
+  }
   return fd;
 }
 
@@ -220,8 +309,25 @@ int connect_with_timeout(int socket, const struct sockaddr *address, socklen_t a
     return connect_p(socket, address, address_len);
   }
 
+  fleet::IOManager *iom = fleet::IOManager::s_get_this();
+  if (UNLIKELY(!iom)) {
+    return connect_p(socket, address, address_len);
+  }
+  if (iom->get_io_backend() == fleet::IOBackend::IO_URING) {
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    prep_sqe(&sqe, IORING_OP_CONNECT, socket, address, 0, address_len);
+    int ret = iom->submit_io(socket, fleet::IOManager::WRITE, sqe, timeout_ms, &ctx->get_close_flag());
+    if (ret < 0) {
+      errno = -ret;
+      return -1;
+    }
+    return 0;
+  }
+
   // ret只有0和-1两种情况
   int ret = connect_p(socket, address, address_len);
+  iom->add_syscall_count();
   if (ret == 0) {
     return 0;
   } else if (errno != EINPROGRESS) {
@@ -230,7 +336,6 @@ To check the status later, the socket will become ready for writability */
     return -1;
   }
 
-  fleet::IOManager *iom = fleet::IOManager::s_get_this();
   fleet::Timer::Ptr timer;
 
   bool is_timeout = false;
@@ -244,39 +349,56 @@ To check the status later, the socket will become ready for writability */
   }
 
   /**
-   * 连接完成时会触发WRITE事件
+   * 连接完成时会触发WRITE事件。常驻模式下WRITE可能是创建socket时遗留的就绪状态，
+   * 所以醒来后要确认连接已经建立，还在进行中就继续等待
    */
-  ret = iom->add_event(socket, fleet::IOManager::WRITE);
-
-  if (ret == 0) {
-    // 成功监听WRITE事件(对应的事件是当前协程)
-    fleet::Fiber::s_get_this()->yield_to_hold();
-    // 可能是监听到了读事件，也可能是timer超时触发了del_event;
-    if (timer) {
-      // 不管怎么样，先把timer取消
-      timer->cancel();
-    }
+  while (true) {
+    // 超时后timer触发了del_event
     if (is_timeout) {
       errno = ETIMEDOUT;
       return -1;
     }
-  } else {
-    if (timer) {
-      timer->cancel();
+    ret = iom->add_event(socket, fleet::IOManager::WRITE);
+    if (ret) {
+      if (timer) {
+        timer->cancel();
+      }
+      ErrorL << "cannont addEvent(" << socket << ", WRITE) error";
+      return -1;
     }
-    ErrorL << "cannont addEvent(" << socket << ", WRITE) error";
-    return -1;
-  }
+    // 成功监听WRITE事件(对应的事件是当前协程)
+    if (UNLIKELY(ctx->is_close())) {
+      iom->del_event(socket, fleet::IOManager::WRITE, true);
+    }
+    fleet::Fiber::s_get_this()->yield_to_hold();
 
-  int error = 0;
-  socklen_t len = sizeof(int);
-  if (-1 == getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &len)) {
-    return -1;
+    if (ctx->is_close()) {
+      errno = EBADF;
+      break;
+    }
+    int error = 0;
+    socklen_t len = sizeof(int);
+    if (-1 == getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &len)) {
+      break;
+    }
+    if (error) {
+      errno = error;
+      break;
+    }
+    sockaddr_storage peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getpeername(socket, reinterpret_cast<sockaddr *>(&peer), &peer_len) == 0) {
+      // 连接已建立
+      if (timer) {
+        timer->cancel();
+      }
+      return 0;
+    }
   }
-  if (error) {
-    return -1;
+  if (timer) {
+    timer->cancel();
   }
-  return 0;
+  return -1;
 }
 
 int connect(int socket, const struct sockaddr *address, socklen_t address_len) {
@@ -284,66 +406,184 @@ int connect(int socket, const struct sockaddr *address, socklen_t address_len) {
 }
 
 int accept(int socket, struct sockaddr *address, socklen_t *address_len) {
-  // socket是服务端，fd是客户端
-  int fd = do_io(socket, accept_p, "accept", fleet::IOManager::READ, SO_RCVTIMEO, address, address_len);
+  return accept4(socket, address, address_len, 0);
+}
+
+int accept4(int socket, struct sockaddr *address, socklen_t *address_len, int flags) {
+  if (!fleet::t_hook_enable) {
+    return accept4_p(socket, address, address_len, flags);
+  }
+  // socket是服务端，fd是客户端。fd总是以非阻塞方式创建，省去FdCtx中的fcntl
+  int sys_flags = flags | SOCK_NONBLOCK;
+  int fd = do_io(
+      socket, accept4_p, "accept4", fleet::IOManager::READ, SO_RCVTIMEO,
+      [&](io_uring_sqe *sqe) {
+        prep_sqe(sqe, IORING_OP_ACCEPT, socket, address, 0, reinterpret_cast<uintptr_t>(address_len));
+        sqe->accept_flags = sys_flags;
+      },
+      address, address_len, sys_flags);
+  if (fd >= 0) {
+    on_accepted(fd, flags);
+  }
+  return fd;
+}
+
+int accept4_nowait(int socket, struct sockaddr *address, socklen_t *address_len, int flags) {
+  if (!fleet::t_hook_enable) {
+    return accept4_p(socket, address, address_len, flags);
+  }
+  // 监听socket在系统层面是非阻塞的，没有连接时立即返回EAGAIN
+  int fd = accept4_p(socket, address, address_len, flags | SOCK_NONBLOCK);
+  auto iom = fleet::IOManager::s_get_this();
+  if (iom) {
+    iom->add_syscall_count();
+  }
   if (fd >= 0) {
-    fleet::FdManager::Instance().create_FdCtx(fd);
+    on_accepted(fd, flags);
   }
   return fd;
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-  return do_io(fd, read_p, "read", fleet::IOManager::READ, SO_RCVTIMEO, buf, count);
+  return do_io(
+      fd, read_p, "read", fleet::IOManager::READ, SO_RCVTIMEO,
+      [&](io_uring_sqe *sqe) { prep_sqe(sqe, IORING_OP_READ, fd, buf, count, -1); }, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-  return do_io(fd, readv_p, "readv", fleet::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+  return do_io(
+      fd, readv_p, "readv", fleet::IOManager::READ, SO_RCVTIMEO,
+      [&](io_uring_sqe *sqe) { prep_sqe(sqe, IORING_OP_READV, fd, iov, iovcnt, -1); }, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-  return do_io(sockfd, recv_p, "recv", fleet::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+  return do_io(
+      sockfd, recv_p, "recv", fleet::IOManager::READ, SO_RCVTIMEO,
+      [&](io_uring_sqe *sqe) {
+        prep_sqe(sqe, IORING_OP_RECV, sockfd, buf, len, 0);
+        sqe->msg_flags = flags;
+      },
+      buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
-  return do_io(sockfd, recvfrom_p, "recvfrom", fleet::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+  // io_uring没有recvfrom，用recvmsg实现，msg要一直有效到操作完成
+  iovec iov = {buf, len};
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  bool use_msg = false;
+  ssize_t n = do_io(
+      sockfd, recvfrom_p, "recvfrom", fleet::IOManager::READ, SO_RCVTIMEO,
+      [&](io_uring_sqe *sqe) {
+        msg.msg_name = src_addr;
+        msg.msg_namelen = addrlen ? *addrlen : 0;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        use_msg = true;
+        prep_sqe(sqe, IORING_OP_RECVMSG, sockfd, &msg, 1, 0);
+        sqe->msg_flags = flags;
+      },
+      buf, len, flags, src_addr, addrlen);
+  if (n >= 0 && use_msg && addrlen) {
+    *addrlen = msg.msg_namelen;
+  }
+  return n;
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-  return do_io(sockfd, recvmsg_p, "recvmsg", fleet::IOManager::READ, SO_RCVTIMEO, msg, flags);
+  if (flags & MSG_ERRQUEUE) {
+    // 错误队列非空时epoll报告EPOLLERR，会唤醒READ事件
+    return do_io(sockfd, recvmsg_p, "recvmsg", fleet::IOManager::READ, SO_RCVTIMEO, NoUringOp(), msg, flags);
+  }
+  return do_io(
+      sockfd, recvmsg_p, "recvmsg", fleet::IOManager::READ, SO_RCVTIMEO,
+      [&](io_uring_sqe *sqe) {
+        prep_sqe(sqe, IORING_OP_RECVMSG, sockfd, msg, 1, 0);
+        sqe->msg_flags = flags;
+      },
+      msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-  return do_io(fd, write_p, "write", fleet::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+  return do_io(
+      fd, write_p, "write", fleet::IOManager::WRITE, SO_SNDTIMEO,
+      [&](io_uring_sqe *sqe) { prep_sqe(sqe, IORING_OP_WRITE, fd, buf, count, -1); }, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-  return do_io(fd, writev_p, "writev", fleet::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+  return do_io(
+      fd, writev_p, "writev", fleet::IOManager::WRITE, SO_SNDTIMEO,
+      [&](io_uring_sqe *sqe) { prep_sqe(sqe, IORING_OP_WRITEV, fd, iov, iovcnt, -1); }, iov, iovcnt);
 }
 
 ssize_t send(int socket, const void *msg, size_t len, int flags) {
-  return do_io(socket, send_p, "send", fleet::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+  return do_io(
+      socket, send_p, "send", fleet::IOManager::WRITE, SO_SNDTIMEO,
+      [&](io_uring_sqe *sqe) {
+        prep_sqe(sqe, IORING_OP_SEND, socket, msg, len, 0);
+        sqe->msg_flags = flags;
+      },
+      msg, len, flags);
 }
 
 ssize_t sendto(int socket, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
-  return do_io(socket, sendto_p, "sendto", fleet::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+  // 同recvfrom，用sendmsg实现
+  iovec iov = {const_cast<void *>(msg), len};
+  msghdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  return do_io(
+      socket, sendto_p, "sendto", fleet::IOManager::WRITE, SO_SNDTIMEO,
+      [&](io_uring_sqe *sqe) {
+        hdr.msg_name = const_cast<sockaddr *>(to);
+        hdr.msg_namelen = tolen;
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        prep_sqe(sqe, IORING_OP_SENDMSG, socket, &hdr, 1, 0);
+        sqe->msg_flags = flags;
+      },
+      msg, len, flags, to, tolen);
 }
 
 ssize_t sendmsg(int socket, const struct msghdr *msg, int flags) {
-  return do_io(socket, sendmsg_p, "sendmsg", fleet::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+  return do_io(
+      socket, sendmsg_p, "sendmsg", fleet::IOManager::WRITE, SO_SNDTIMEO,
+      [&](io_uring_sqe *sqe) {
+        prep_sqe(sqe, IORING_OP_SENDMSG, socket, msg, 1, 0);
+        sqe->msg_flags = flags;
+      },
+      msg, flags);
 }
 
-int close(int fd) {
-  if (!fleet::t_hook_enable) {
-    return close_p(fd);
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+  // 失败或者部分发送时内核更新*offset，重试时从新的位置继续
+  return do_io(out_fd, sendfile_p, "sendfile", fleet::IOManager::WRITE, SO_SNDTIMEO, NoUringOp(), in_fd, offset,
+               count);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+  // 管道一侧总是不阻塞，socket一侧按socket的方向等待：从socket读时等READ，否则等fd_out的WRITE
+  auto func = [=](int) { return splice_p(fd_in, off_in, fd_out, off_out, len, flags | SPLICE_F_NONBLOCK); };
+  auto ctx = fleet::FdManager::Instance().get_FdCtx(fd_in);
+  if (ctx && ctx->is_socket()) {
+    return do_io(fd_in, func, "splice", fleet::IOManager::READ, SO_RCVTIMEO, NoUringOp());
   }
+  return do_io(fd_out, func, "splice", fleet::IOManager::WRITE, SO_SNDTIMEO, NoUringOp());
+}
 
+int close(int fd) {
+  // 不管是否hook都要清理，fd号被复用时不能看到旧的上下文
   auto ctx = fleet::FdManager::Instance().get_FdCtx(fd);
   if (ctx) {
+    // 先标记再唤醒，之后才注册的协程会看到标记
+    ctx->set_close();
     auto iom = fleet::IOManager::s_get_this();
-    if (iom) {
+    if (iom && fleet::t_hook_enable) {
       iom->del_and_trigger_all(fd);
-      fleet::FdManager::Instance().del_FdCtx(fd);
+    } else {
+      // 不在IOManager中，比如主线程或者停止时析构的Socket，找到注册了fd的IOManager
+      fleet::IOManager::s_del_and_trigger_all(fd);
     }
+    fleet::FdManager::Instance().del_FdCtx(fd);
   }
   return close_p(fd);
 }
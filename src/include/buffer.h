@@ -0,0 +1,119 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace fleet {
+
+/**
+ * @brief 链式缓冲区
+ * @details
+ * 数据存放在一串固定大小的内存块中，内存块带引用计数，由线程本地的空闲链表分配和回收。
+ * 复制、切片和追加另一个Buffer只增加引用计数，不拷贝数据；收发时导出iovec，直接读写内存块。
+ * Buffer对象本身不是线程安全的，但不同线程中的Buffer可以共享内存块
+ */
+class Buffer {
+ public:
+  static const size_t npos = static_cast<size_t>(-1);
+  // 每个内存块的大小，包括块头
+  static const size_t BLOCK_SIZE = 16 * 1024;
+
+  Buffer() {}
+
+  // 共享other的内存块
+  Buffer(const Buffer &other);
+
+  Buffer(Buffer &&other);
+
+  Buffer &operator=(const Buffer &other);
+
+  Buffer &operator=(Buffer &&other);
+
+  ~Buffer();
+
+  size_t size() const { return _size; }
+
+  bool empty() const { return _size == 0; }
+
+  // 数据分布在多少段中
+  size_t segment_count() const { return _segments.size(); }
+
+  // 拷贝数据追加到末尾，优先写入最后一个内存块的剩余空间
+  void append(const void *data, size_t length);
+
+  void append(const std::string &str) { append(str.data(), str.size()); }
+
+  // 追加other的数据，共享内存块，不拷贝
+  void append(const Buffer &other);
+
+  // 返回[offset, offset + length)的切片，共享内存块，不拷贝
+  Buffer slice(size_t offset, size_t length = npos) const;
+
+  // 丢弃开头的length字节
+  void consume(size_t length);
+
+  void clear();
+
+  // 从offset开始拷贝最多length字节到dest，返回拷贝的字节数
+  size_t copy_to(void *dest, size_t length, size_t offset = 0) const;
+
+  std::string to_string() const;
+
+  // 从from开始查找pattern，可以跨段匹配，返回位置，找不到返回npos
+  size_t find(const char *pattern, size_t length, size_t from = 0) const;
+
+  size_t find(const std::string &pattern, size_t from = 0) const { return find(pattern.data(), pattern.size(), from); }
+
+  /**
+   * @brief 导出数据的iovec，用于writev/sendmsg
+   * @return 写入iovs的个数，最多max_count个
+   */
+  size_t get_read_iovecs(iovec *iovs, size_t max_count) const;
+
+  /**
+   * @brief 在末尾准备至少length字节的可写空间并导出iovec，用于readv/recvmsg
+   * @details 之后必须调用commit，两次调用之间不能再修改Buffer
+   * @return 写入iovs的个数，最多max_count个，空间可能因此少于length
+   */
+  size_t prepare(size_t length, iovec *iovs, size_t max_count);
+
+  // 把prepare导出的空间中前length字节计入数据
+  void commit(size_t length);
+
+  // 所有线程中正在使用的内存块数，包括还在Buffer中和prepare预留的
+  static size_t s_get_live_blocks();
+
+ private:
+  struct Block;
+
+  // 一段数据，对应内存块中的[begin, end)
+  struct Segment {
+    Block *block;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  // 在最后一段之后申请最多length字节的空间，成功返回申请到的字节数
+  size_t claim_tail(size_t length);
+
+  static Block *alloc_block();
+
+  // 减少引用计数，归零时放回线程本地的空闲链表
+  static void release_block(Block *block);
+
+  // 每个内存块可以存放的数据量
+  static const uint32_t s_block_capacity;
+
+ private:
+  std::deque<Segment> _segments;
+  // prepare预留的新内存块，commit时按顺序加入_segments
+  std::vector<Block *> _reserved;
+  // prepare时在最后一个内存块中申请到的空间
+  uint32_t _tail_claimed = 0;
+  size_t _size = 0;
+};
+}  // namespace fleet
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace fleet {
+
+/**
+ * @brief 只能移动的void()可调用对象
+ * @details
+ * 与std::function相比不要求可拷贝，也就不需要拷贝捕获的状态；不超过INLINE_SIZE且移动不抛异常的
+ * 可调用对象直接存放在对象内部，不分配堆内存，其他的放在堆上
+ */
+class Callback {
+ public:
+  // 内联存储的大小，可以放下一个std::function或捕获几个指针的lambda
+  static constexpr size_t INLINE_SIZE = 48;
+
+  Callback() = default;
+
+  Callback(std::nullptr_t) {}
+
+  template <class F, class Fn = typename std::decay<F>::type,
+            class = typename std::enable_if<!std::is_same<Fn, Callback>::value>::type,
+            class = decltype(std::declval<Fn &>()())>
+  Callback(F &&f) {
+    if (is_null(static_cast<const Fn &>(f))) {
+      return;
+    }
+    if (sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<Fn>::value) {
+      new (&_storage) Fn(std::forward<F>(f));
+      _ops = &InlineOps<Fn>::ops;
+    } else {
+      *reinterpret_cast<Fn **>(&_storage) = new Fn(std::forward<F>(f));
+      _ops = &HeapOps<Fn>::ops;
+    }
+  }
+
+  Callback(Callback &&other) noexcept { move_from(other); }
+
+  Callback &operator=(Callback &&other) noexcept {
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  Callback &operator=(std::nullptr_t) {
+    reset();
+    return *this;
+  }
+
+  Callback(const Callback &) = delete;
+
+  Callback &operator=(const Callback &) = delete;
+
+  ~Callback() { reset(); }
+
+  void operator()() { _ops->invoke(&_storage); }
+
+  explicit operator bool() const { return _ops != nullptr; }
+
+  void reset() {
+    if (_ops) {
+      _ops->destroy(&_storage);
+      _ops = nullptr;
+    }
+  }
+
+ private:
+  struct Ops {
+    void (*invoke)(void *storage);
+    // 把src中的对象移动到未初始化的dst，并析构src中的对象
+    void (*move)(void *dst, void *src);
+    void (*destroy)(void *storage);
+  };
+
+  template <class Fn>
+  struct InlineOps {
+    static void invoke(void *storage) { (*static_cast<Fn *>(storage))(); }
+    static void move(void *dst, void *src) {
+      new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+      static_cast<Fn *>(src)->~Fn();
+    }
+    static void destroy(void *storage) { static_cast<Fn *>(storage)->~Fn(); }
+    static const Ops ops;
+  };
+
+  template <class Fn>
+  struct HeapOps {
+    static void invoke(void *storage) { (**static_cast<Fn **>(storage))(); }
+    static void move(void *dst, void *src) { *static_cast<Fn **>(dst) = *static_cast<Fn **>(src); }
+    static void destroy(void *storage) { delete *static_cast<Fn **>(storage); }
+    static const Ops ops;
+  };
+
+  template <class F>
+  static bool is_null(const F &) {
+    return false;
+  }
+
+  template <class F>
+  static bool is_null(F *const &f) {
+    return f == nullptr;
+  }
+
+  static bool is_null(const std::function<void()> &f) { return !f; }
+
+  void move_from(Callback &other) {
+    if (other._ops) {
+      other._ops->move(&_storage, &other._storage);
+      _ops = other._ops;
+      other._ops = nullptr;
+    }
+  }
+
+ private:
+  typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type _storage;
+  const Ops *_ops = nullptr;
+};
+
+template <class Fn>
+const Callback::Ops Callback::InlineOps<Fn>::ops = {&InlineOps<Fn>::invoke, &InlineOps<Fn>::move,
+                                                    &InlineOps<Fn>::destroy};
+
+template <class Fn>
+const Callback::Ops Callback::HeapOps<Fn>::ops = {&HeapOps<Fn>::invoke, &HeapOps<Fn>::move, &HeapOps<Fn>::destroy};
+}  // namespace fleet
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+
+// 不支持的平台自动退回ucontext
+#if !defined(FLEET_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define FLEET_USE_UCONTEXT
+#endif
+
+#ifdef FLEET_USE_UCONTEXT
+#include <ucontext.h>
+#endif
+
+#if defined(__x86_64__) || defined(__aarch64__)
+extern "C" {
+/**
+ * @brief 汇编实现的上下文切换，只保存callee-saved寄存器，不涉及信号掩码(没有系统调用)
+ * @param from_sp 保存当前上下文的栈顶指针
+ * @param to_sp 要切换到的上下文的栈顶指针
+ */
+void fleet_swap_context(void **from_sp, void *to_sp);
+}
+#endif
+
+namespace fleet {
+
+/**
+ * @brief 协程上下文，编译期选择汇编实现或ucontext实现
+ * @details 定义FLEET_USE_UCONTEXT宏(cmake -DFLEET_USE_UCONTEXT=ON)使用ucontext
+ */
+class Context {
+ public:
+  /**
+   * @brief 在stack上构造一个从entry开始执行的上下文
+   * @details entry不能返回
+   */
+  void make(void *stack, size_t size, void (*entry)());
+
+  // 保存当前上下文到this，然后切换到to
+  void swap_to(Context &to);
+
+  // 后端名称
+  static const char *backend_name();
+
+ private:
+#ifdef FLEET_USE_UCONTEXT
+  ucontext_t _ctx;
+#else
+  // 切出时的栈顶，寄存器都保存在栈上
+  void *_sp = nullptr;
+#endif
+};
+
+#ifndef FLEET_USE_UCONTEXT
+inline void Context::swap_to(Context &to) { fleet_swap_context(&_sp, to._sp); }
+#endif
+}  // namespace fleet
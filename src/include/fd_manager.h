@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <type_traits>
@@ -14,6 +15,12 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
 
   FdCtx(int fd);
 
+  /**
+   * @brief 已知是非阻塞socket时使用，不调用fstat和fcntl
+   * @param user_nonblock 用户是否要求非阻塞，如accept4时传了SOCK_NONBLOCK
+   */
+  FdCtx(int fd, bool user_nonblock);
+
   ~FdCtx() {}
 
   bool is_init() const { return _is_init; }
@@ -22,6 +29,11 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
 
   bool is_close() const { return _is_close; }
 
+  // close时标记，阻塞在该fd上的协程醒来后据此返回EBADF
+  void set_close() { _is_close = true; }
+
+  const std::atomic<bool> &get_close_flag() const { return _is_close; }
+
   bool get_user_nonblock() const { return _user_nonblock; }
 
   void set_user_nonblock(bool v) { _user_nonblock = v; }
@@ -35,7 +47,7 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
  private:
   bool _is_init = false;
   bool _is_socket = false;
-  bool _is_close = false;
+  std::atomic<bool> _is_close = {false};
 
   bool _user_nonblock = false;
   bool _sys_nonblock = false;
@@ -63,6 +75,9 @@ class FdManager {
   FdCtx::Ptr get_FdCtx(int fd);
   FdCtx::Ptr create_FdCtx(int fd);
 
+  // 为以SOCK_NONBLOCK创建的socket创建FdCtx，省去fstat和fcntl
+  FdCtx::Ptr create_socket_FdCtx(int fd, bool user_nonblock);
+
   void del_FdCtx(int fd);
 
  private:
@@ -1,14 +1,18 @@
 #pragma once
 
-#include <ucontext.h>
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
 
+#include "callback.h"
+#include "context.h"
+
 namespace fleet {
 
 class Scheduler;
 class IOManager;
+class StackAllocator;
 class Fiber : public std::enable_shared_from_this<Fiber> {
   friend IOManager;
 
@@ -33,17 +37,19 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
    * @param stack_size 栈大小
    * @param 是否为scheduler的root_fiber
    */
-  Fiber(std::function<void()> &&cb, size_t stack_size = 0, bool root_fiber = false);
+  Fiber(Callback &&cb, size_t stack_size = 0, bool root_fiber = false);
 
   ~Fiber();
 
-  void reuse(std::function<void()> &&cb);
+  void reuse(Callback &&cb);
 
   void enter();
 
   uint64_t get_id() const { return _id; }
 
-  State get_state() const { return _state; }
+  State get_state() const { return _state.load(std::memory_order_acquire); }
+
+  uint64_t get_stack_size() const { return _stack_size; }
 
  public:
   static void yield_to_hold();
@@ -53,6 +59,9 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   // 将get_id()封装成静态方法
   static uint64_t get_fiber_id();
 
+  // 不指定栈大小时使用的栈大小
+  static uint64_t get_default_stack_size();
+
   // 返回当前所在的协程，必要时会创建线程原始协程
   static Fiber::Ptr s_get_this();
 
@@ -74,13 +83,20 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   // 协程栈大小
   uint64_t _stack_size = 0;
   // 协程状态
-  State _state = READY;
+  std::atomic<State> _state = {READY};
+  /**
+   * 切出后的状态。切出时上下文还没有保存完，如果这时就把_state改成HOLD，
+   * 其他线程可能提前切入，所以由enter()在切换完成后再写入_state
+   */
+  State _yield_state = HOLD;
   // 协程上下文
-  ucontext_t _ctx;
+  Context _ctx;
   // 协程栈地址
   void *_stack = nullptr;
+  // 分配协程栈的分配器，析构时要还给它
+  StackAllocator *_allocator = nullptr;
   // 协程入口函数
-  std::function<void()> _cb;
+  Callback _cb;
   // 是否参与调度器调调度
   bool _run_in_scheduler;
 };
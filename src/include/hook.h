@@ -38,6 +38,9 @@ extern connect_type connect_p;
 typedef int (*accept_type)(int socket, struct sockaddr *address, socklen_t *address_len);
 extern accept_type accept_p;
 
+typedef int (*accept4_type)(int socket, struct sockaddr *address, socklen_t *address_len, int flags);
+extern accept4_type accept4_p;
+
 /****read****/
 typedef ssize_t (*read_type)(int fd, void *buf, size_t count);
 extern read_type read_p;
@@ -72,6 +75,13 @@ extern sendto_type sendto_p;
 typedef ssize_t (*sendmsg_type)(int socket, const struct msghdr *msg, int flags);
 extern sendmsg_type sendmsg_p;
 
+typedef ssize_t (*sendfile_type)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_type sendfile_p;
+
+typedef ssize_t (*splice_type)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len,
+                               unsigned int flags);
+extern splice_type splice_p;
+
 typedef int (*close_type)(int fd);
 extern close_type close_p;
 
@@ -95,4 +105,7 @@ extern pipe_type pipe_p;
 // 编译期（链接前）需要知道此connnect_with_timeout的声明
 // 而其他函数如write、read的声明在各自原头文件中，只要include未hook前的头文件即可，故本文件无需再对write、read做声明
 int connect_with_timeout(int socket, const struct sockaddr *address, socklen_t address_len, uint64_t timeout_ms);
+
+// 与accept4相同，但没有等待中的连接时不挂起协程，直接返回-1且errno为EAGAIN。用于一次唤醒后取完所有连接
+int accept4_nowait(int socket, struct sockaddr *address, socklen_t *address_len, int flags);
 }
\ No newline at end of file
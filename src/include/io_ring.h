@@ -0,0 +1,101 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "uncopyable.h"
+
+namespace fleet {
+
+/**
+ * @brief io_uring的最小封装，直接使用系统调用，不依赖liburing
+ * @details
+ * 不加锁：get_sqe/publish由调用者加锁互斥，reap由调用者保证同一时刻只有一个线程，
+ * enter可以在任意线程并发调用。创建失败时is_valid()返回false
+ */
+class IORing : private Uncopyable {
+ public:
+  /**
+   * @param entries SQ的大小
+   * @param cq_entries CQ的大小，同时在途的操作多时要足够大
+   */
+  IORing(unsigned entries, unsigned cq_entries);
+
+  ~IORing();
+
+  bool is_valid() const { return _ring_fd >= 0; }
+
+  int get_fd() const { return _ring_fd; }
+
+  // 内核是否支持该操作
+  bool is_op_supported(int op) const;
+
+  // SQ中还能取出的SQE个数
+  unsigned space_left() const {
+    unsigned head = reinterpret_cast<std::atomic<unsigned> *>(_sq_head)->load(std::memory_order_acquire);
+    return _params.sq_entries - (_sqe_tail - head);
+  }
+
+  // 取一个空闲的SQE并清零，SQ满返回nullptr
+  io_uring_sqe *get_sqe();
+
+  // 把get_sqe取出的SQE发布给内核，返回发布的个数，之后调用enter提交
+  unsigned publish();
+
+  /**
+   * @brief 调用io_uring_enter
+   * @param to_submit 提交的SQE个数
+   * @param flags IORING_ENTER_GETEVENTS等
+   * @return 提交的个数，失败返回-errno
+   */
+  int enter(unsigned to_submit, unsigned flags = 0);
+
+  /**
+   * @brief 取出所有已完成的CQE
+   * @details 对每个CQE调用cb(const io_uring_cqe &)，返回个数
+   */
+  template <class F>
+  unsigned reap(F &&cb) {
+    unsigned head = *_cq_head;
+    unsigned tail = reinterpret_cast<std::atomic<unsigned> *>(_cq_tail)->load(std::memory_order_acquire);
+    unsigned count = tail - head;
+    for (; head != tail; head++) {
+      cb(_cqes[head & _cq_mask]);
+    }
+    reinterpret_cast<std::atomic<unsigned> *>(_cq_head)->store(head, std::memory_order_release);
+    return count;
+  }
+
+  // CQ满时内核把CQE暂存在溢出链表中，需要调用enter(0, IORING_ENTER_GETEVENTS)取回
+  bool is_cq_overflow() const;
+
+ private:
+  int _ring_fd = -1;
+  io_uring_params _params;
+
+  void *_sq_ring = nullptr;
+  size_t _sq_ring_size = 0;
+  void *_cq_ring = nullptr;
+  size_t _cq_ring_size = 0;
+  io_uring_sqe *_sqes = nullptr;
+  size_t _sqes_size = 0;
+
+  unsigned *_sq_head = nullptr;
+  unsigned *_sq_tail = nullptr;
+  unsigned *_sq_flags = nullptr;
+  unsigned *_sq_array = nullptr;
+  unsigned _sq_mask = 0;
+  // 已经取出但还没有发布的SQE的尾部
+  unsigned _sqe_tail = 0;
+
+  unsigned *_cq_head = nullptr;
+  unsigned *_cq_tail = nullptr;
+  io_uring_cqe *_cqes = nullptr;
+  unsigned _cq_mask = 0;
+
+  // 内核支持的操作，下标是IORING_OP_*
+  bool _ops_supported[IORING_OP_LAST] = {false};
+};
+}  // namespace fleet
@@ -6,26 +6,61 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
-#include <unordered_map>
+#include <vector>
 
 #include "scheduler.h"
 #include "timer.h"
 #include "mutex.h"
 
+struct io_uring_sqe;
+
 namespace fleet {
+class IORing;
+
+// IO的实现方式
+enum class IOBackend {
+  EPOLL,    // 就绪通知：EAGAIN后等待可读写再重试
+  IO_URING  // 完成通知：socket的读写、accept、connect提交到io_uring，内核不支持时退回EPOLL
+};
+
+// epoll实例的组织方式
+enum class ReactorMode {
+  SHARED,     // 所有工作线程共用一个epoll，空闲线程轮流阻塞在上面
+  /**
+   * 每个工作线程一个epoll和定时器分片，fd在accept/connect时分配给一个工作线程。
+   * 就绪的IO和到期的定时器只放入本线程的收件箱，不唤醒、也不被其他线程窃取。
+   * io_uring只有一个完成队列，由0号工作线程收割，再交给fd所属的工作线程恢复
+   */
+  PER_WORKER
+};
+
 class IOManager : public Scheduler, public TimerManager {
  public:
   using Ptr = std::shared_ptr<IOManager>;
   using RWMutexType = RWMutex;
   enum Event {
-    NONE = 0x0,  // 无事件
-    READ = 0x1,  // 读事件，对应EPOLLIN
-    WRITE = 0x4  // 写事件，对应EPOLLOUT
+    NONE = 0x0,   // 无事件
+    READ = 0x1,   // 读事件，对应EPOLLIN
+    WRITE = 0x4,  // 写事件，对应EPOLLOUT
+    ERROR = 0x8   // 错误事件，对应EPOLLERR，用于等待错误队列中的消息，如MSG_ZEROCOPY的完成通知
+  };
+
+  // 一个reactor的负载
+  struct ReactorLoad {
+    // 分配到该reactor的fd数
+    size_t fds = 0;
+    // 处理的fd就绪事件数
+    uint64_t events = 0;
+    // 到期的定时器数
+    uint64_t timers = 0;
   };
 
  private:
-  struct FdTask {
-    using Ptr = std::shared_ptr<FdTask>;
+  // 在途的io_uring操作，在发起操作的协程栈上
+  struct IOWaiter;
+
+  // 独占一个cache line，避免不同fd的锁伪共享
+  struct alignas(64) FdTask {
     using MutexType = Mutex;
     struct Task {
       // 事件回调协程
@@ -36,22 +71,59 @@ class IOManager : public Scheduler, public TimerManager {
 
     // 重置ctx
     void reset_task(Task &task);
-    // 处理相应的event
-    void trigger_event(Event event);
+    /**
+     * @brief 处理相应的event
+     * @details fibers和cbs不为空时把回调放入其中，由调用者批量调度，否则直接调度
+     * @param thread_id 直接调度时指定执行的线程，-1表示不指定
+     */
+    void trigger_event(Event event, std::vector<Fiber::Ptr> *fibers = nullptr,
+                       std::vector<std::function<void()>> *cbs = nullptr, int thread_id = -1);
     // 返回事件对应的任务
     Task &get_task(Event event);
 
+    // 返回事件方向上在途的io_uring操作
+    IOWaiter *&get_io_op(Event event) { return event == Event::READ ? read_op : write_op; }
+
+    // 注册到epoll的data，高16位是generation，低48位是本对象的地址
+    uint64_t epoll_data() const {
+      return reinterpret_cast<uintptr_t>(this) | (static_cast<uint64_t>(generation) << 48);
+    }
+
     // 读事件上下文
     Task readCB;
     // 写事件上下文
     Task writeCB;
+    // 错误事件上下文
+    Task errorCB;
     // 关注哪些事件
     Event events = Event::NONE;
+    // 在途的io_uring读写操作
+    IOWaiter *read_op = nullptr;
+    IOWaiter *write_op = nullptr;
+    // 常驻模式下已经就绪、但就绪时没有等待者的事件
+    Event ready = Event::NONE;
+    // 是否以常驻模式注册在epoll中
+    bool persistent = false;
+    // 对应的fd
+    int fd = -1;
+    // 所属的reactor，-1表示还没有分配
+    int reactor = -1;
+    /**
+     * 每次从epoll中删除时加一。fd关闭后可能马上被新打开的文件复用，
+     * 已经由epoll_wait返回、还没处理的旧事件的generation对不上，会被丢弃
+     */
+    uint16_t generation = 0;
     FdTask::MutexType mutex;
   };
 
  public:
-  IOManager(size_t threads = 1, const std::string &name = "");
+  /**
+   * @param timer_backend 定时器的存储方式，连接多、每个IO都带超时的场景用TimerBackend::WHEEL
+   * @param io_backend IO的实现方式
+   * @param reactor_mode epoll实例的组织方式
+   */
+  IOManager(size_t threads = 1, const std::string &name = "", TimerBackend timer_backend = TimerBackend::SET,
+            IOBackend io_backend = IOBackend::EPOLL, ReactorMode reactor_mode = ReactorMode::SHARED);
 
   ~IOManager();
 
@@ -69,28 +141,241 @@ class IOManager : public Scheduler, public TimerManager {
    */
   bool del_event(int fd, Event event, bool trigger_task);
 
+  /**
+   * @brief 删除fd的全部事件并触发回调，常驻模式的fd同时从epoll中删除
+   * @details 关闭fd之前调用，在途的io_uring操作会被取消，fd不再属于原来的reactor
+   */
   bool del_and_trigger_all(int fd);
 
+  /**
+   * @brief 把fd分配给一个reactor，之后fd的事件都由该reactor的工作线程处理
+   * @details
+   * 没有分配的fd在第一次注册事件时分配给当前工作线程。有协程等待事件的fd不能转移，返回false；
+   * 常驻注册的fd从原reactor的epoll中删除后注册到新的reactor
+   * @param index reactor的序号，即工作线程的序号，-1表示选择fd最少的reactor
+   */
+  bool assign_reactor(int fd, int index = -1);
+
+  ReactorMode get_reactor_mode() const { return _reactor_mode; }
+
+  // 每个reactor的负载，共享模式只有一个
+  std::vector<ReactorLoad> get_reactor_loads() const;
+
+  /**
+   * @brief 以常驻模式把fd注册到epoll
+   * @details
+   * 一次性注册EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET，就绪状态记录在上下文中，
+   * 之后add_event/del_event和事件触发都不再调用epoll_ctl，直到del_and_trigger_all
+   */
+  bool register_persistent(int fd);
+
+  /**
+   * @brief 开启后hook的socket和accept创建的fd以常驻模式注册
+   * @details 应在创建socket之前设置
+   */
+  void set_persistent_mode(bool flag) { _persistent_mode = flag; }
+
+  bool is_persistent_mode() const { return _persistent_mode; }
+
+  // 实际使用的IO实现，内核不支持io_uring时是EPOLL
+  IOBackend get_io_backend() const { return _io_backend; }
+
+  /**
+   * @brief 把fd上的一个IO操作提交到io_uring，挂起当前协程直到完成
+   * @details 提交先攒在SQ中，攒够一批或线程空闲时再一起io_uring_enter。只能在IO_URING模式的协程中调用
+   * @param event 操作的方向，同一fd同一方向同时只能有一个操作
+   * @param sqe 填好opcode、fd、地址等的SQE，user_data和flags由本函数设置
+   * @param timeout_ms 超时时间，UINT64_MAX表示不超时
+   * @param closed 在fd的锁内检查，已置位则不提交并返回-EBADF，配合先置位再del_and_trigger_all的close使用
+   * @return 操作的结果，失败为-errno，超时为-ETIMEDOUT，被del_event取消为-ECANCELED
+   */
+  int submit_io(int fd, Event event, const io_uring_sqe &sqe, uint64_t timeout_ms = UINT64_MAX,
+                const std::atomic<bool> *closed = nullptr);
+
+  // IO路径上的系统调用次数：epoll、io_uring_enter、唤醒，以及hook中实际发起的读写
+  uint64_t get_syscall_count() const;
+
+  // 累加当前线程的系统调用计数
+  void add_syscall_count(uint64_t n = 1) {
+    int index = get_worker_index();
+    if (index < 0 || static_cast<size_t>(index) >= _thread_count) {
+      index = _thread_count;
+    }
+    _syscall_counts[index].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
   static IOManager *s_get_this();
 
+  /**
+   * @brief 在所有IOManager中对fd调用del_and_trigger_all
+   * @details 用于在不属于IOManager的线程中关闭fd，比如主线程或者停止时析构的Socket，
+   * 否则常驻模式的注册和就绪状态会留在上下文中，fd号被复用后add_event不再调用epoll_ctl
+   */
+  static bool s_del_and_trigger_all(int fd);
+
+  // 实际写eventfd唤醒线程的次数
+  uint64_t get_wakeups_issued() const { return _wakeups_issued; }
+
+  // 因为没有线程在睡眠或已有线程正在被唤醒而省掉的唤醒次数
+  uint64_t get_wakeups_suppressed() const { return _wakeups_suppressed; }
+
+  // 为fd的事件调用epoll_ctl的次数
+  uint64_t get_epoll_ctl_count() const { return _epoll_ctl_count; }
+
  protected:
-  // 唤醒idle
+  // 唤醒一个空闲线程
   void notify() override;
 
-  bool stopping() override;
+  // 唤醒指定的工作线程
+  void notify_worker(size_t index) override;
 
-  bool stopping(uint64_t &timeout);
+  bool stopping() override;
 
   void idle() override;
 
-  void on_timer_inserted_front() override;
+  void on_timer_inserted_front(size_t shard) override;
+
+  // 多reactor模式下工作线程添加的定时器放在自己的分片
+  size_t select_timer_shard() override;
+
+ private:
+  // 写eventfd唤醒指定的工作线程
+  void wake_worker(size_t index);
+
+  // 唤醒一个在自己的eventfd上睡眠的工作线程，没有则返回false
+  bool wake_follower();
+
+  // 不是poller的空闲线程在自己的eventfd上等待
+  void wait_as_follower(int index);
+
+  struct Reactor;
+
+  /**
+   * @brief 等待reactor的epoll上的事件，超时精确到微秒
+   * @details 优先使用epoll_pwait2，内核不支持时用timerfd
+   */
+  int wait_events(Reactor &reactor, epoll_event *events, int max_events, uint64_t timeout_us);
+
+  // 对fd_ctx所属reactor的epoll调用epoll_ctl并计数，需持有fd_ctx->mutex
+  int ctl_event(FdTask *fd_ctx, int op, epoll_event *epev);
+
+  // 返回fd_ctx所属的reactor，还没有分配时分配给当前工作线程，需持有fd_ctx->mutex
+  Reactor &get_reactor(FdTask *fd_ctx);
+
+  // 取消fd_ctx的reactor分配，需持有fd_ctx->mutex
+  void release_reactor(FdTask *fd_ctx);
+
+  // 直接触发fd_ctx的事件时执行回调的线程，多reactor模式下是所属reactor的工作线程
+  int get_owner_thread(const FdTask *fd_ctx) const;
+
+  // 把攒下的SQE提交给内核
+  void submit_ring();
+
+  // 取出已完成的io_uring操作，把等待的协程放入fibers
+  void reap_ring(std::vector<Fiber::Ptr> &fibers);
+
+  // 取消fd_ctx上event方向在途的io_uring操作，需持有fd_ctx->mutex
+  bool cancel_io(FdTask *fd_ctx, Event event);
+
+  // 在SQ中放入count个SQE，fill负责填写，SQ满时先提交
+  void enqueue_sqes(unsigned count, const std::function<void(io_uring_sqe **)> &fill);
+
+  // 返回fd对应的上下文，不存在返回nullptr，无锁
+  FdTask *get_fd_task(int fd) const;
+
+  // 返回fd对应的上下文，不存在则创建
+  FdTask *get_or_create_fd_task(int fd);
+
+  // 从epoll中删除fd_ctx->fd后调用，使已经返回的旧事件失效
+  static void retire_epoll_data(FdTask *fd_ctx) { ++fd_ctx->generation; }
+
+  /**
+   * @brief 内部fd(eventfd、timerfd)注册到epoll的data
+   * @details FdTask的地址是64字节对齐的，最低位为1表示内部fd
+   */
+  static uint64_t internal_epoll_data(int fd) { return (static_cast<uint64_t>(fd) << 1) | 1; }
 
  private:
-  int _epfd = 0;
-  int _notify_fds[2];  // 0是read end, 1是write end
+  // 工作线程的状态
+  enum WorkerState {
+    WORKER_RUNNING,   // 在执行任务或准备等待
+    WORKER_FOLLOWER,  // 在自己的eventfd上睡眠
+    WORKER_POLLER     // 在共享的epoll上睡眠
+  };
+
+  // 一个epoll实例，独占cache line避免负载计数伪共享
+  struct alignas(64) Reactor {
+    int epfd = -1;
+    // 用于微秒级超时的timerfd，同一时刻只有一个线程阻塞在epfd上使用它
+    int timer_fd = -1;
+    std::atomic<size_t> fd_count = {0};
+    std::atomic<uint64_t> event_count = {0};
+    std::atomic<uint64_t> timer_count = {0};
+
+    // Reactor要求64字节对齐，C++14的new不保证
+    static void *operator new(size_t size);
+
+    static void operator delete(void *ptr);
+  };
+
+  ReactorMode _reactor_mode = ReactorMode::SHARED;
+  // 共享模式只有一个，多reactor模式下标与工作线程序号对应
+  std::vector<std::unique_ptr<Reactor>> _reactors;
+  /**
+   * 共享模式下空闲线程采用leader/follower模式：同一时刻最多一个空闲线程(poller)阻塞在epoll上，
+   * 其他空闲线程(follower)阻塞在自己的eventfd上，从而可以只唤醒指定的线程
+   */
+  std::atomic<int> _poller = {-1};
+  /**
+   * 每个工作线程一个eventfd，同时注册在epoll中，这样无论该线程是poller还是follower都能被唤醒。
+   * 多reactor模式下注册在自己的epoll中，睡眠的线程都是follower
+   */
+  std::vector<int> _worker_event_fds;
+  // 每个工作线程的WorkerState
+  std::unique_ptr<std::atomic<int>[]> _worker_states;
+  // 正在睡眠的线程数，为0时notify什么也不做
+  std::atomic<size_t> _sleeping_count = {0};
+  // 是否有线程已被唤醒但还没有开始取任务，用于合并连续的notify
+  std::atomic<bool> _waking = {false};
+  std::atomic<uint64_t> _wakeups_issued = {0};
+  std::atomic<uint64_t> _wakeups_suppressed = {0};
+  std::atomic<uint64_t> _epoll_ctl_count = {0};
+  bool _persistent_mode = false;
+
+  IOBackend _io_backend = IOBackend::EPOLL;
+  std::unique_ptr<IORing> _ring;
+  // 填写SQE时加锁
+  MutexType _ring_mutex;
+  // 已经发布、还没有io_uring_enter的SQE数
+  std::atomic<unsigned> _ring_unsubmitted = {0};
+  // 是否有线程正在收割CQ
+  std::atomic<bool> _ring_reaping = {false};
+
+  // 每个工作线程一个计数，最后一个给非工作线程，凑满一个cache line避免伪共享
+  struct SyscallCount {
+    std::atomic<uint64_t> value = {0};
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+  std::unique_ptr<SyscallCount[]> _syscall_counts;
   std::atomic<size_t> _pending_event_count = {0};
+  // 已经从定时器或事件中取出、还没有放入任务队列的批次数，不为0时不能停止
+  std::atomic<size_t> _dispatching_count = {0};
 
-  RWMutexType _event_mutex;
-  std::unordered_map<int, FdTask::Ptr> _fd_contexts;
+  // 以fd为下标的上下文表
+  struct FdTable {
+    explicit FdTable(size_t n);
+
+    size_t size;
+    std::unique_ptr<std::atomic<FdTask *>[]> tasks;
+  };
+
+  /**
+   * 上下文表只增长不缩小，上下文创建后直到析构都不释放，所以查找不用加锁。
+   * 扩容时复制到新表再替换_fd_table，旧表可能还有线程在读，放在_fd_tables里到析构时再释放
+   */
+  std::atomic<FdTable *> _fd_table = {nullptr};
+  std::vector<std::unique_ptr<FdTable>> _fd_tables;
+  // 创建上下文和扩容时加锁
+  MutexType _event_mutex;
 };
 }  // namespace fleet
\ No newline at end of file
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <sys/time.h>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <list>
@@ -11,20 +14,30 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
-#include "list.h"
 #include "mutex.h"
 #include "thread.h"
 
 namespace fleet {
 
 class LogEvent;
+struct LogRecord;
 class LogChannel;
 class AsyncWriter;
 class LogEventCapture;
 
 enum class LogLevel { Trace, Debug, Info, Warn, Error };
+
+// 异步日志的环形缓冲区满时的处理方式
+enum class LogFullPolicy {
+  Block,  // 唤醒写线程并等待空位
+  Drop,   // 丢弃并计数，见Logger::get_dropped_count()
+  Sync,   // 在当前线程直接写到channel，可能排在本线程之前的异步日志前面
+};
+
 class Logger {
   friend AsyncWriter;
   friend LogEventCapture;
@@ -48,20 +61,42 @@ class Logger {
 
   // 增加channel
   void add_channel(std::shared_ptr<LogChannel> ch);
-  // 设置为异步
-  void set_async();
+  /**
+   * @brief 设置为异步
+   * @details 每个写日志的线程有自己的单生产者单消费者环形缓冲区，写线程成批取出
+   * @param policy 环形缓冲区满时的处理方式
+   * @param ring_size 每个线程的环形缓冲区可以存放的日志条数，向上取整到2的幂
+   */
+  void set_async(LogFullPolicy policy = LogFullPolicy::Block, size_t ring_size = 1024);
+  // 异步模式下因为环形缓冲区满而丢弃的日志条数
+  uint64_t get_dropped_count() const;
+  /**
+   * @brief 设置为延迟格式化
+   * @details 写日志的线程只把<<的参数按类型拷贝成二进制，由写线程或channel格式化，
+   * 没有对应类型的参数仍然在当前线程用operator<<格式化成字符串
+   */
+  void set_deferred(bool deferred) { _deferred.store(deferred, std::memory_order_relaxed); }
   // 设置最低日志级别
   void set_level(LogLevel level);
+  // 日志宏在构造LogEvent之前先调用，低于最低级别的日志不分配也不格式化
+  bool should_log(LogLevel level) const { return level >= _level.load(std::memory_order_relaxed); }
 
  private:
   // 写event
   void write_event(std::shared_ptr<LogEvent> event);
-  // 写到_channels中
-  void write_to_channels(std::shared_ptr<LogEvent> event);
+  // 写延迟格式化的日志
+  void write_capture(LogEventCapture &capture);
+  // 写到_channels中并flush，加锁，同步写、写线程和Sync策略的回退可能同时写
+  void write_to_channels(const LogRecord &record);
+  // 写线程成批写，调用者持有_channel_mtx，一批写完后调用flush_channels
+  void write_record(const LogRecord &record);
+  void flush_channels();
 
  private:
-  LogLevel _level = LogLevel::Debug;
+  std::atomic<LogLevel> _level = {LogLevel::Debug};
+  std::atomic<bool> _deferred = {false};
   std::list<std::shared_ptr<LogChannel>> _channels;  // 输出目的地
+  Mutex _channel_mtx;
   std::shared_ptr<AsyncWriter> _writer;
   // 注意：_writer必须在_channels析构之前析构。
   // 可以让_writer后于_channels声明，也可以在析构函数中显式地调用reset方法
@@ -75,15 +110,112 @@ class LogEvent : public std::ostringstream {
 
  public:
   LogLevel _level;
-  std::string _file;
-  std::string _function;
+  // 都指向__FILE__、__FUNCTION__，静态存储，不用拷贝。输出时才去掉目录
+  const char *_file;
+  const char *_function;
   int _line;
   struct timeval _tv;
   pid_t _thread_id;
   uint64_t _fiber_id;
 };
 
+/**
+ * @brief 定长的日志记录，预先分配在每个线程的环形缓冲区中
+ * @details 消息不超过INLINE_SIZE时直接存放在记录里，更长的才分配在堆上
+ */
+struct LogRecord {
+  static const size_t INLINE_SIZE = 192;
+
+  // 拷贝event的字段和格式化好的消息
+  void assign(const LogEvent &event);
+
+  // 拷贝capture的字段和二进制参数，参数放在堆上时直接取走
+  void assign(LogEventCapture &capture);
+
+  // 消息，_binary时是LogEventCapture编码的参数
+  const char *data() const { return _overflow ? _overflow->data() : _inline; }
+
+  size_t size() const { return _length; }
+
+  // 输出消息，二进制参数在这里格式化
+  void write_message(std::ostream &os) const;
+
+  // 追加到out，不经过iostream
+  void write_message(std::string &out) const;
+
+  LogLevel _level;
+  const char *_file;
+  const char *_function;
+  int _line;
+  struct timeval _tv;
+  pid_t _thread_id;
+  uint64_t _fiber_id;
+  bool _binary;
+  uint32_t _length;
+  std::unique_ptr<std::string> _overflow;
+  char _inline[INLINE_SIZE];
+};
+
+/**
+ * @brief 单生产者单消费者的环形缓冲区，生产者是写日志的线程，消费者是AsyncWriter的写线程
+ */
+class LogRing {
+ public:
+  using Ptr = std::shared_ptr<LogRing>;
+
+  explicit LogRing(size_t capacity);
+
+  // 生产者：取下一个空位，满了返回nullptr
+  LogRecord *try_reserve() {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _cached_head >= _capacity) {
+      _cached_head = _head.load(std::memory_order_acquire);
+      if (tail - _cached_head >= _capacity) {
+        return nullptr;
+      }
+    }
+    return &_records[tail & _mask];
+  }
+
+  // 生产者：提交try_reserve取到的记录
+  void publish() { _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // 消费者：对已经提交的所有记录调用func，最后一次性归还空位，返回条数
+  template <class Func>
+  size_t drain(Func &&func) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    for (size_t i = head; i != tail; i++) {
+      func(_records[i & _mask]);
+    }
+    _head.store(tail, std::memory_order_release);
+    return tail - head;
+  }
+
+  // 生产者线程退出后关闭，写线程取完剩下的记录后释放
+  void close() { _closed.store(true, std::memory_order_release); }
+
+  bool is_closed() const { return _closed.load(std::memory_order_acquire); }
+
+ private:
+  std::unique_ptr<LogRecord[]> _records;
+  size_t _capacity;
+  size_t _mask;
+  // 消费者的读位置和生产者的写位置放在不同的cache line
+  alignas(64) std::atomic<size_t> _head = {0};
+  alignas(64) std::atomic<size_t> _tail = {0};
+  // 生产者缓存的_head，只在看起来满了时才重新读取
+  size_t _cached_head = 0;
+  std::atomic<bool> _closed = {false};
+};
+
+// 延迟格式化时参数的类型
+enum class LogArgType : uint8_t { Int, UInt, Double, Char, Bool, String, Pointer };
+
 class LogEventCapture {
+  friend Logger;
+  friend LogRecord;
+
  public:
   LogEventCapture(Logger &logger, LogLevel level, const char *file, const char *function, int line);
 
@@ -95,62 +227,308 @@ class LogEventCapture {
   // 模板不能放在cpp里
   template <class T>
   LogEventCapture &operator<<(T &&data) {
-    *_event << std::forward<T>(data);
+    if (_event) {
+      *_event << std::forward<T>(data);
+    } else {
+      encode(std::forward<T>(data));
+    }
     return *this;
   }
 
+ private:
+  /**
+   * @brief 延迟格式化时把参数编码成 类型(1字节) + 值，字符串是 类型 + 长度(4字节) + 内容
+   * @details 常见类型用非模板重载精确匹配，其余类型走模板，先格式化成字符串
+   */
+  void encode(bool data) { put(LogArgType::Bool, &data, sizeof(data)); }
+  void encode(char data) { put(LogArgType::Char, &data, sizeof(data)); }
+  void encode(signed char data) { encode(static_cast<char>(data)); }
+  void encode(unsigned char data) { encode(static_cast<char>(data)); }
+  void encode(short data) { encode_int(data); }
+  void encode(int data) { encode_int(data); }
+  void encode(long data) { encode_int(data); }
+  void encode(long long data) { encode_int(data); }
+  void encode(unsigned short data) { encode_uint(data); }
+  void encode(unsigned int data) { encode_uint(data); }
+  void encode(unsigned long data) { encode_uint(data); }
+  void encode(unsigned long long data) { encode_uint(data); }
+  void encode(float data) { encode(static_cast<double>(data)); }
+  void encode(double data) { put(LogArgType::Double, &data, sizeof(data)); }
+  void encode(long double data) { encode(static_cast<double>(data)); }
+  void encode(const char *data) { encode_string(data, strlen(data)); }
+  void encode(char *data) { encode(static_cast<const char *>(data)); }
+  void encode(const std::string &data) { encode_string(data.data(), data.size()); }
+  void encode(const void *data) { put(LogArgType::Pointer, &data, sizeof(data)); }
+
+  template <class T>
+  void encode(const T &data) {
+    std::ostringstream os;
+    os << data;
+    encode(os.str());
+  }
+
+  void encode_int(int64_t data) { put(LogArgType::Int, &data, sizeof(data)); }
+
+  void encode_uint(uint64_t data) { put(LogArgType::UInt, &data, sizeof(data)); }
+
+  void encode_string(const char *data, size_t length);
+
+  void put(LogArgType type, const void *data, size_t length) {
+    // macro.h包含本文件，不能用LIKELY
+    if (__builtin_expect(!_overflow && _length + 1 + length <= sizeof(_inline), 1)) {
+      _inline[_length] = static_cast<char>(type);
+      memcpy(_inline + _length + 1, data, length);
+      _length += 1 + length;
+      return;
+    }
+    put_overflow(type, data, length);
+  }
+
+  // 内联空间不够时把已有的参数挪到堆上，之后都追加在堆上
+  void put_overflow(LogArgType type, const void *data, size_t length);
+
  private:
   Logger &_logger;       // 目标logger
-  LogEvent::Ptr _event;  // 生成的event
+  LogEvent::Ptr _event;  // 生成的event，延迟格式化时为空
+  // 以下只在延迟格式化时使用
+  bool _active = false;  // 是否需要在析构时写出
+  LogLevel _level;
+  const char *_file;
+  const char *_function;
+  int _line;
+  struct timeval _tv;
+  pid_t _thread_id;
+  uint64_t _fiber_id;
+  uint32_t _length = 0;
+  std::unique_ptr<std::string> _overflow;
+  char _inline[LogRecord::INLINE_SIZE];
+};
+
+// 把日志语句变成void表达式，让LOG宏可以放在条件运算符中。&的优先级低于<<
+class LogVoidify {
+ public:
+  void operator&(const LogEventCapture &) {}
 };
 
 class AsyncWriter {
  public:
-  AsyncWriter();
+  AsyncWriter(Logger *logger, LogFullPolicy policy, size_t ring_size);
   ~AsyncWriter();
-  void push_event(LogEvent::Ptr event, Logger *logger);
+  // 放入当前线程的环形缓冲区，不加锁，只在写线程睡眠时才唤醒
+  void push_event(const LogEvent &event);
+
+  void push_event(LogEventCapture &capture);
+
+  uint64_t get_dropped() const { return _dropped; }
 
  private:
   void run();
-  void flush_all();
+  // 取出所有环形缓冲区中的记录写到channel，返回条数
+  size_t flush_all();
+  template <class Source>
+  void push(Source &source);
+  // 当前线程的环形缓冲区，第一次调用时创建并登记，线程退出后返回nullptr
+  LogRing *get_ring();
+  void wake_up();
 
  private:
-  Mutex _mtx;
+  Logger *_logger;
+  LogFullPolicy _policy;
+  size_t _ring_size;
+  // 区分线程本地缓存的环形缓冲区属于哪个AsyncWriter
+  uint64_t _id;
+  // 新登记的环形缓冲区，写线程在_has_new_rings时取走
+  Mutex _rings_mtx;
+  std::vector<LogRing::Ptr> _new_rings;
+  std::atomic<bool> _has_new_rings = {false};
+  // 只有写线程访问
+  std::vector<LogRing::Ptr> _rings;
   Semaphore _sem;
-  List<std::pair<LogEvent::Ptr, Logger *>> _pending;
-  bool _exit;
+  std::atomic<bool> _sleeping = {false};
+  std::atomic<bool> _exit = {false};
+  std::atomic<uint64_t> _dropped = {0};
   std::shared_ptr<Thread> _thread;
 };
 
 class LogChannel {
  public:
   virtual ~LogChannel() {}
-  virtual void write(LogEvent::Ptr event) = 0;
+  virtual void write(const LogRecord &record) = 0;
+  // 一批日志写完之后调用，缓冲输出的channel在这里写出
+  virtual void flush() {}
+
+ protected:
+  static void format(const LogRecord &record, std::ostream &stream, bool if_color);
+
+  /**
+   * @brief 格式化追加到out
+   * @details 时间的秒部分按线程缓存，同一秒内只改写毫秒，不再每条调用localtime和strftime
+   */
+  static void format(const LogRecord &record, std::string &out, bool if_color);
+};
+
+// FdChannel缓冲的日志什么时候写到fd
+enum class LogFlushPolicy {
+  Batch,  // 每批日志结束时write一次
+  Full,   // 缓冲区满时才write，吞吐最高，但日志停止后缓冲中的内容要等到析构才写出
+};
+
+// FdChannel写到fd之后什么时候fdatasync
+enum class LogSyncPolicy {
+  Never,     // 交给操作系统
+  Always,    // 每次write之后
+  Interval,  // 距离上次超过间隔时
+};
+
+/**
+ * @brief 把格式化好的日志攒在缓冲区中，一批日志只用一次write写到fd
+ */
+class FdChannel : public LogChannel {
+ public:
+  ~FdChannel();
+  void write(const LogRecord &record) override;
+  void flush() override;
+
+  /**
+   * @param buffer_size 缓冲区超过这个大小时不等一批结束，立即写出
+   */
+  void set_flush_policy(LogFlushPolicy policy, size_t buffer_size = 64 * 1024);
+
+  void set_sync_policy(LogSyncPolicy policy, uint64_t interval_ms = 1000);
+
+ protected:
+  FdChannel(int fd, bool if_color) : _fd(fd), _color(if_color) {}
+
+  // 把缓冲区写到fd，按同步策略fdatasync
+  void write_out();
+
+  // 当前文件的大小，包括还在缓冲区中的
+  uint64_t get_file_size() const { return _written + _buffer.size(); }
 
  protected:
-  void format(LogEvent::Ptr event, std::ostream &stream, bool if_color);
+  int _fd;
+  // 写到当前fd的字节数
+  uint64_t _written = 0;
+
+ private:
+  bool _color;
+  std::string _buffer;
+  LogFlushPolicy _flush_policy = LogFlushPolicy::Batch;
+  size_t _buffer_size = 64 * 1024;
+  LogSyncPolicy _sync_policy = LogSyncPolicy::Never;
+  uint64_t _sync_interval_ms = 1000;
+  uint64_t _last_sync_ms = 0;
 };
 
-class ConsoleChannel : public LogChannel {
+class ConsoleChannel : public FdChannel {
  public:
-  void write(LogEvent::Ptr event) override;
+  ConsoleChannel();
+};
+
+// FileChannel的轮转设置，max_size和interval_sec都为0时不轮转
+struct LogRotation {
+  uint64_t max_size = 0;      // 文件超过这个大小时轮转
+  uint64_t interval_sec = 0;  // 按本地时间对齐的轮转间隔，如3600在每个整点轮转
+  size_t max_files = 0;       // 保留的已轮转文件数，多出的从最旧的开始删除，0不限
+  bool compress = false;      // 在后台把已轮转的文件压缩成.gz，需要编译时找到zlib
 };
-class FileChannel : public LogChannel {
+
+class LogArchiver;
+
+class FileChannel : public FdChannel {
  public:
+  // 写到当前目录下以启动时间命名的文件
   FileChannel();
+  explicit FileChannel(const std::string &path);
+  /**
+   * @brief 轮转的日志文件
+   * @details path是文件名模板，logs/app.log依次写到logs/app.2024-01-01-00_00_00.log这样以打开时间命名的文件。
+   * 轮转时写日志的线程只关闭旧文件、打开新文件，压缩和删除旧文件都在低优先级的后台线程中进行。
+   * 构造时会扫描目录中之前轮转留下的文件，按轮转顺序一起计入max_files，重启后保留数仍然有效
+   */
+  FileChannel(const std::string &path, const LogRotation &rotation);
   ~FileChannel();
-  void write(LogEvent::Ptr event) override;
+  void write(const LogRecord &record) override;
+  // 重新打开文件，用于外部工具移走了文件。只设置标记，由写日志的线程在下一次写入前以追加方式打开
   void reopen();
 
+ private:
+  void open_file(int flags);
+  // 打开以now命名的新文件，计算下一次按时间轮转的时刻
+  void open_segment(time_t now);
+  void rotate(time_t now);
+
  private:
   std::string _path;
-  std::fstream _stream;
+  std::atomic<bool> _reopen = {false};
+  LogRotation _rotation;
+  bool _rotating = false;
+  // 文件名模板去掉扩展名的部分和扩展名
+  std::string _stem;
+  std::string _ext;
+  // 当前文件名中的时间，同一秒内多次轮转时加上序号
+  std::string _segment_time;
+  int _segment_seq = 0;
+  time_t _next_rotate_sec = 0;
+  std::unique_ptr<LogArchiver> _archiver;
+};
+
+/**
+ * @brief 二进制日志文件，不格式化，适合和延迟格式化一起使用
+ * @details 每个日志位置第一次出现时写一条位置定义，之后的日志只写位置编号和原始参数。
+ * 按本机字节序写，用tools/log_decoder或decode()离线解码成文本
+ */
+class BinaryFileChannel : public LogChannel {
+ public:
+  explicit BinaryFileChannel(const std::string &path);
+  ~BinaryFileChannel();
+  void write(const LogRecord &record) override;
+
+  void flush() override { _stream.flush(); }
+
+  /**
+   * @brief 把二进制日志文件解码成和FileChannel相同的文本
+   * @return 解码的日志条数，打不开或格式错误返回-1
+   */
+  static int64_t decode(const std::string &path, std::ostream &os);
+
+ private:
+  struct Site {
+    const char *file;
+    const char *function;
+    int line;
+
+    bool operator==(const Site &other) const {
+      return file == other.file && function == other.function && line == other.line;
+    }
+  };
+
+  struct SiteHash {
+    size_t operator()(const Site &site) const {
+      return std::hash<const void *>()(site.file) ^ std::hash<const void *>()(site.function) ^
+             std::hash<int>()(site.line);
+    }
+  };
+
+ private:
+  std::ofstream _stream;
+  // 日志位置到编号
+  std::unordered_map<Site, uint32_t, SiteHash> _sites;
 };
 }  // namespace fleet
 
 /*********************宏定义***********************/
+#ifndef FLEET_LOG_MIN_LEVEL
+#define FLEET_LOG_MIN_LEVEL 0
+#endif
+
+// 低于编译期最低级别的日志条件是常量false，整条语句被编译器去掉；
+// 否则先检查运行时的级别，通过了才构造LogEvent和计算<<后面的参数。
 // 无名对象的生命周期只有一个语句，不会等到scope结束
-#define LOG(level) fleet::LogEventCapture(fleet::Logger::Instance(), level, __FILE__, __FUNCTION__, __LINE__)
+#define LOG(level)                                                                                    \
+  !(static_cast<int>(level) >= FLEET_LOG_MIN_LEVEL && fleet::Logger::Instance().should_log(level)) \
+      ? (void)0                                                                                       \
+      : fleet::LogVoidify() & fleet::LogEventCapture(fleet::Logger::Instance(), level, __FILE__, __FUNCTION__, __LINE__)
 
 #define TraceL LOG(fleet::LogLevel::Trace)
 #define DebugL LOG(fleet::LogLevel::Debug)
@@ -159,4 +537,4 @@ class FileChannel : public LogChannel {
 #define ErrorL LOG(fleet::LogLevel::Error)
 
 // 默认初始化
-#define LOG_DEFAULT fleet::Logger::Instance().add_channel(std::make_shared<fleet::ConsoleChannel>());
\ No newline at end of file
+#define LOG_DEFAULT fleet::Logger::Instance().add_channel(std::make_shared<fleet::ConsoleChannel>());
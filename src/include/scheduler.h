@@ -2,17 +2,19 @@
 
 #include <atomic>
 #include <cstddef>
+#include <deque>
 #include <functional>
-#include <list>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "callback.h"
 #include "fiber.h"
 #include "mutex.h"
 #include "thread.h"
+#include "work_stealing_queue.h"
 
 namespace fleet {
 class Scheduler {
@@ -27,30 +29,120 @@ class Scheduler {
 
   const std::string &get_name() const { return _name; };
 
+  // 工作线程数
+  size_t get_thread_count() const { return _thread_count; }
+
   // 返回当前协程调度器
   static Scheduler *s_get_this();
 
+  // 当前工作线程在调度器中的序号，非工作线程返回-1
+  static int get_worker_index();
+
+  // 队列中等待执行的任务数，不含正在执行的
+  size_t get_task_count() const { return _task_count; }
+
+  // 序号为index的工作线程的线程号，start()之后有效，之前返回-1
+  thread_id_t get_worker_thread_id(size_t index) const;
+
   // 创建scheduler的线程
   virtual void start();
 
   void stop();
 
+  /**
+   * @brief 设置每个工作线程缓存的已结束协程数，用于复用callback任务的协程
+   * @details 应在start()之前调用，0表示不缓存
+   */
+  void set_fiber_cache_size(size_t size) { _fiber_cache_size = size; }
+
+  size_t get_fiber_cache_size() const { return _fiber_cache_size; }
+
+  // 复用缓存协程的次数
+  uint64_t get_fiber_cache_hits() const { return _fiber_cache_hits; }
+
+  // 缓存为空而新建协程的次数
+  uint64_t get_fiber_cache_misses() const { return _fiber_cache_misses; }
+
+  /**
+   * @brief 调度任务
+   * @details 工作线程中调用时放入本线程的队列，其他线程调用时放入全局队列
+   * @param thread_id 指定执行任务的工作线程，-1表示不指定。指定的任务放入该线程的信箱，只唤醒该线程
+   */
   template <class FiberOrCb>
-  void schedule(const FiberOrCb &fc, thread_id_t thread_id = -1) {
-    auto ft = std::make_shared<Task>(fc);
-    if (ft->fiber || ft->cb) {
-      MutexType::Lock lock(_task_mutex);
-      _tasks.push_back(ft);
+  void schedule(FiberOrCb &&fc, thread_id_t thread_id = -1) {
+    auto task = new Task(std::forward<FiberOrCb>(fc), thread_id);
+    if (!task->fiber && !task->cb) {
+      delete task;
+      return;
+    }
+    int worker = push_task(task);
+    if (worker >= 0) {
+      notify_worker(worker);
+    } else {
+      notify();
+    }
+  }
+
+  /**
+   * @brief 批量调度任务，全局队列只加一次锁，最多唤醒一个线程
+   * @details 元素类型与schedule()相同，不能指定线程。传入move_iterator可以避免拷贝
+   */
+  template <class InputIterator>
+  void schedule_batch(InputIterator begin, InputIterator end) {
+    if (push_batch(begin, end) > 0) {
+      notify();
     }
-    notify();
   }
 
  protected:
+  /**
+   * @brief 批量放入任务队列，不唤醒线程
+   * @details 用于把多批任务合并成一次唤醒，由调用者在之后notify()
+   * @param pinned 为true时放入当前工作线程的收件箱，只由本线程执行，不能被窃取，也不需要唤醒其他线程。
+   * 只能在工作线程中使用
+   * @return 放入的任务数
+   */
+  template <class InputIterator>
+  size_t push_batch(InputIterator begin, InputIterator end, bool pinned = false) {
+    Task *head = nullptr;
+    Task *tail = nullptr;
+    size_t count = 0;
+    for (; begin != end; ++begin) {
+      auto task = new Task(*begin);
+      if (!task->fiber && !task->cb) {
+        delete task;
+        continue;
+      }
+      if (tail) {
+        tail->next = task;
+      } else {
+        head = task;
+      }
+      tail = task;
+      ++count;
+    }
+    if (head && pinned) {
+      push_inbox(head, tail, count);
+    } else if (head) {
+      push_task_list(head, count);
+    }
+    return count;
+  }
+
   // 任务到来通知
   virtual void notify();
 
-  // 协程调度函数
-  void run();
+  // 通知指定的工作线程，默认与notify()相同
+  virtual void notify_worker(size_t index);
+
+  // 协程调度函数，index是工作线程的序号
+  void run(size_t index);
+
+  /**
+   * @brief 创建序号为index的工作线程并记录
+   * @param init 在新线程中先于run()执行
+   */
+  void create_worker_thread(size_t index, std::function<void()> init = nullptr);
 
   // 返回是否可以停止
   virtual bool stopping();
@@ -61,40 +153,122 @@ class Scheduler {
   // 是否有空闲线程
   bool has_idle_threads() { return _idle_thread_count > 0; }
 
+  // 当前工作线程是否有可以取到的任务，在睡眠前调用
+  bool has_pending_task() const;
+
  private:
+  /**
+   * @brief 任务节点
+   * @details 用next串成侵入式链表，只能移动。节点从内存池分配，稳定运行后调度不再分配内存
+   */
   struct Task {
-    using Ptr = std::shared_ptr<Task>;
-
     // 协程
     Fiber::Ptr fiber;
     // 函数
-    std::function<void()> cb;
+    Callback cb;
     // 指定线程号
     thread_id_t thread_id;
+    // 信箱中或批量放入时的下一个任务
+    Task *next = nullptr;
 
     Task(const Fiber::Ptr &fb, thread_id_t ti = -1) : fiber(fb), thread_id(ti) {}
 
-    Task(const std::function<void()> &f, thread_id_t ti = -1) : cb(f), thread_id(ti) {}
+    Task(Fiber::Ptr &&fb, thread_id_t ti = -1) : fiber(std::move(fb)), thread_id(ti) {}
 
-    Task() = default;
+    Task(Callback &&f, thread_id_t ti = -1) : cb(std::move(f)), thread_id(ti) {}
 
-    void reset() {
-      fiber = nullptr;
-      cb = nullptr;
-    }
+    static void *operator new(size_t size);
+
+    static void operator delete(void *ptr);
+  };
+
+  // 工作线程的本地状态
+  struct Worker {
+    // 本地队列，其他线程可以窃取
+    WorkStealingQueue<Task *> queue;
+    // 信箱，存放指定由本线程执行的任务，多个线程放入，只有本线程取出，后进先出的链表
+    std::atomic<Task *> mailbox = {nullptr};
+    // 从mailbox取出后按先进先出排列的任务，只有本线程访问
+    Task *inbox = nullptr;
+    // inbox的最后一个任务，inbox为空时无意义
+    Task *inbox_tail = nullptr;
+    // 工作线程的线程号
+    std::atomic<thread_id_t> thread_id = {-1};
+
+    // queue要求64字节对齐，C++14的new不保证
+    static void *operator new(size_t size);
+
+    static void operator delete(void *ptr);
   };
 
  private:
-  // 待执行的任务队列
-  std::list<Task::Ptr> _tasks;
+  /**
+   * @brief 放入任务队列
+   * @return 指定线程的任务返回目标工作线程的序号，否则返回-1
+   */
+  int push_task(Task *task);
+
+  /**
+   * @brief 放入一串用next连接的不指定线程的任务
+   * @details 工作线程中调用时放入本线程的队列，放不下的和其他线程调用时一次加锁放入全局队列
+   */
+  void push_task_list(Task *head, size_t count);
+
+  // 放到全局队列末尾，用于让出执行的协程，所有线程都能取到
+  void push_global_task(Task *task);
+
+  // 把一串任务追加到当前工作线程的inbox末尾，只能由工作线程调用
+  void push_inbox(Task *head, Task *tail, size_t count);
+
+  // 返回线程号对应的工作线程序号，不存在返回-1
+  int find_worker(thread_id_t thread_id) const;
+
+  // 从工作线程的信箱中取出一个任务，只能由该线程调用
+  static Task *pop_mailbox_task(Worker &worker);
+
+  /**
+   * @brief 取出一个任务
+   * @details 依次尝试本线程信箱、本线程队列、全局队列、窃取其他线程的队列
+   */
+  Task *pop_task();
+
+  // 从全局队列中取出一个任务
+  Task *pop_global_task();
+
+  // 从其他工作线程的队列中窃取一个任务
+  Task *steal_task();
+
+  // 获取一个执行cb的协程，优先从fiber_cache中取
+  Fiber::Ptr acquire_fiber(std::vector<Fiber::Ptr> &fiber_cache, Callback &&cb);
+
+  // acquire_fiber创建的协程结束且没有其他引用时放回fiber_cache
+  void release_fiber(std::vector<Fiber::Ptr> &fiber_cache, Fiber::Ptr &&fiber);
+
+ private:
+  // 全局任务队列，非工作线程调度的任务和本地队列放不下的任务放在这里
+  std::deque<Task *> _tasks;
+  // 每个工作线程一个，下标与工作线程序号对应
+  std::vector<std::unique_ptr<Worker>> _workers;
+  // 所有队列中的任务总数
+  std::atomic<size_t> _task_count = {0};
+  // 本地队列和全局队列中的任务数，即其他线程可以取到的任务数，为0时不用唤醒空闲线程
+  std::atomic<size_t> _stealable_task_count = {0};
+  // 全局队列中的任务数，为0时不用加锁
+  std::atomic<size_t> _global_task_count = {0};
   // 是否自动停止(暂时不知道是什么作用)
   bool _auto_stop = false;
   // 工作线程数
   std::atomic<size_t> _active_thread_count = {0};
   // 空闲线程数
   std::atomic<size_t> _idle_thread_count = {0};
-  // 任务锁
+  // 全局队列锁
   MutexType _task_mutex;
+  // 每个工作线程缓存的协程数上限
+  size_t _fiber_cache_size = 32;
+  // 协程缓存命中次数
+  std::atomic<uint64_t> _fiber_cache_hits = {0};
+  // 协程缓存未命中次数
+  std::atomic<uint64_t> _fiber_cache_misses = {0};
 
  protected:
   // 线程池
@@ -106,7 +280,7 @@ class Scheduler {
   // 线程数量
   size_t _thread_count = 0;
   // 是否正在停止，默认为true
-  bool _stopping = true;
+  std::atomic<bool> _stopping = {true};
   // 启动或关闭时使用
   MutexType _mutex;
 };
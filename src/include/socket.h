@@ -1,9 +1,12 @@
 #pragma once
 
 #include <sys/socket.h>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "address.h"
+#include "buffer.h"
 #include "uncopyable.h"
 
 namespace fleet {
@@ -67,8 +70,21 @@ class Socket : public std::enable_shared_from_this<Socket>, Uncopyable {
     return set_option(level, option, &value, sizeof(T));
   }
 
+  /**
+   * @brief 开启SO_REUSEPORT，在bind之前调用
+   * @details 开启了该选项的多个socket可以bind同一个地址，内核把新连接分给其中一个
+   */
+  bool set_reuse_port();
+
   virtual Socket::Ptr accept();
 
+  /**
+   * @brief 批量接受连接
+   * @details 没有等待中的连接时挂起协程，接受到第一个连接后不再等待，继续取出已经到达的连接，最多max个
+   * @return 放入clients的连接数，出错或监听socket被关闭时返回0
+   */
+  size_t accept_batch(std::vector<Socket::Ptr> &clients, size_t max);
+
   virtual bool bind(const Address::Ptr addr);
 
   virtual bool connect(const Address::Ptr addr, uint64_t timeout_ms = -1);
@@ -95,6 +111,63 @@ class Socket : public std::enable_shared_from_this<Socket>, Uncopyable {
 
   virtual int recv_from(iovec *buffers, size_t length, Address::Ptr from, int flags = 0);
 
+  /**
+   * @brief 用recvmsg直接收到buffer末尾的内存块中，不经过中间缓冲区
+   * @param length 本次最多接收的字节数
+   * @return 同recv
+   */
+  int recv_into(Buffer &buffer, size_t length = 64 * 1024, int flags = 0);
+
+  /**
+   * @brief 用sendmsg把buffer中的所有数据直接从内存块发出，发出的部分从buffer中丢弃
+   * @return 发送的字节数，出错返回-1，没有发出的数据留在buffer中
+   */
+  ssize_t send_buffer(Buffer &buffer, int flags = 0);
+
+  /**
+   * @brief 用sendfile把文件fd从offset开始的length字节发送出去，数据不经过用户态
+   * @details 发送缓冲区满时挂起协程，超时时间同send
+   * @return 发送的字节数，文件提前结束时小于length，出错返回-1
+   */
+  ssize_t send_file(int fd, off_t offset, size_t length);
+
+  /**
+   * @brief 通过管道用splice把本socket收到的数据转发给dst，数据不经过用户态，用于代理
+   * @details 转发到对端关闭或者满length字节为止
+   * @return 转发的字节数，出错返回-1
+   */
+  ssize_t splice_to(Socket &dst, size_t length = SIZE_MAX);
+
+  /**
+   * @brief 开启或关闭SO_ZEROCOPY，开启后send_zerocopy才使用MSG_ZEROCOPY
+   * @details 零拷贝只对大块数据有收益，回环等情况下内核仍然会拷贝，见get_zerocopy_copied()
+   */
+  bool set_zerocopy(bool flag);
+
+  bool is_zerocopy() const { return _zerocopy; }
+
+  /**
+   * @brief 以MSG_ZEROCOPY发送
+   * @details 内核直接引用buffer中的页，buffer要保持不变直到完成通知到达，见wait_zerocopy()。没有开启SO_ZEROCOPY时同send
+   */
+  int send_zerocopy(const void *buffer, size_t length, int flags = 0);
+
+  // 不等待地处理错误队列中的零拷贝完成通知，返回本次完成的发送次数
+  size_t reap_zerocopy();
+
+  /**
+   * @brief 挂起协程直到之前所有的send_zerocopy都完成，之后可以复用或释放buffer
+   * @details 完成通知放在socket的错误队列中，由IOManager的ERROR事件唤醒，超时时间同recv
+   */
+  bool wait_zerocopy();
+
+  // 还没有收到完成通知的send_zerocopy次数
+  uint32_t get_zerocopy_pending() const { return _zerocopy_sent - _zerocopy_completed; }
+
+  // 内核没能零拷贝而退回拷贝的发送次数
+  uint64_t get_zerocopy_copied() const { return _zerocopy_copied; }
+
+  // accept得到的Socket在第一次调用时才获取地址，之前dump不输出地址
   Address::Ptr get_remote_Address();
 
   Address::Ptr get_local_Address();
@@ -132,6 +205,9 @@ class Socket : public std::enable_shared_from_this<Socket>, Uncopyable {
 
   virtual bool init(int sock);
 
+  // 用accept得到的fd创建Socket，失败时关闭sock
+  Socket::Ptr create_accepted(int sock);
+
  protected:
   int _sock;
   int _family;
@@ -140,6 +216,13 @@ class Socket : public std::enable_shared_from_this<Socket>, Uncopyable {
   bool _is_connected;
   Address::Ptr _local_Address;
   Address::Ptr _remote_Address;
+  // 是否开启了SO_ZEROCOPY
+  bool _zerocopy = false;
+  // MSG_ZEROCOPY发送的次数，内核按同样的顺序给每次发送编号，从0开始，32位回绕
+  uint32_t _zerocopy_sent = 0;
+  // 已经完成的发送次数
+  uint32_t _zerocopy_completed = 0;
+  uint64_t _zerocopy_copied = 0;
 };
 
 // 对<<重载
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "uncopyable.h"
+
+namespace fleet {
+
+/**
+ * @brief 协程栈分配器接口
+ * @details Fiber通过StackAllocator::s_get_default()获取分配器，可以在创建协程之前替换成自定义实现
+ */
+class StackAllocator {
+ public:
+  virtual ~StackAllocator() {}
+
+  /**
+   * @brief 分配协程栈
+   * @param size 栈大小
+   * @return 栈的低地址，失败返回nullptr
+   */
+  virtual void *alloc(size_t size) = 0;
+
+  /**
+   * @brief 释放协程栈，size必须与alloc时相同
+   */
+  virtual void dealloc(void *sp, size_t size) = 0;
+
+  // 获取默认的栈分配器
+  static StackAllocator *s_get_default();
+
+  // 设置默认的栈分配器，只影响之后创建的协程
+  static void s_set_default(StackAllocator *allocator);
+};
+
+/**
+ * @brief malloc栈内存分配器
+ */
+class MallocStackAllocator : public StackAllocator {
+ public:
+  void *alloc(size_t size) override;
+  void dealloc(void *sp, size_t size) override;
+};
+
+/**
+ * @brief mmap栈内存分配器
+ * @details 在栈的低地址端放一个PROT_NONE的保护页，栈溢出时直接SIGSEGV，而不是悄悄写坏堆
+ */
+class MmapStackAllocator : public StackAllocator {
+ public:
+  void *alloc(size_t size) override;
+  void dealloc(void *sp, size_t size) override;
+
+  // 页大小
+  static size_t page_size();
+  // 将size向上取整到页大小
+  static size_t round_to_page(size_t size);
+};
+
+/**
+ * @brief 带线程本地缓存的mmap栈分配器
+ * @details
+ * 每个线程为每种栈大小维护一个空闲链表，dealloc时先放回当前线程的链表，超过上限(high water mark)才munmap。
+ * 超过最大大小档位的栈不缓存，直接mmap/munmap。
+ * set_size_classes与set_max_pooled应在创建任何协程之前调用。
+ */
+class PooledStackAllocator : public StackAllocator, private Uncopyable {
+ public:
+  struct Stats {
+    // 正在被协程使用的栈数
+    uint64_t live = 0;
+    // 缓存在空闲链表中的栈数
+    uint64_t pooled = 0;
+    // 累计分配次数
+    uint64_t allocated = 0;
+    // 累计归还次数
+    uint64_t returned = 0;
+    // 累计mmap次数(即缓存未命中次数)
+    uint64_t mapped = 0;
+  };
+
+  /**********单例**********/
+ public:
+  static PooledStackAllocator &Instance();
+
+ private:
+  PooledStackAllocator();
+  /***********************/
+
+ public:
+  void *alloc(size_t size) override;
+  void dealloc(void *sp, size_t size) override;
+
+  /**
+   * @brief 设置栈大小档位，申请的大小会向上取整到最近的档位
+   */
+  void set_size_classes(const std::vector<size_t> &size_classes);
+
+  /**
+   * @brief 设置每个线程每个档位最多缓存的栈数
+   */
+  void set_max_pooled(size_t max_pooled) { _max_pooled = max_pooled; }
+
+  size_t get_max_pooled() const { return _max_pooled; }
+
+  // 获取统计信息
+  Stats get_stats() const;
+
+ private:
+  struct ThreadCache;
+
+  // 返回size对应的档位下标，没有合适的档位返回-1
+  int size_class_index(size_t size) const;
+
+  // 获取当前线程的缓存，线程退出后返回nullptr
+  static ThreadCache *get_thread_cache();
+
+ private:
+  // 栈大小档位，升序
+  std::vector<size_t> _size_classes;
+  // 每个线程每个档位最多缓存的栈数
+  size_t _max_pooled = 64;
+
+  std::atomic<uint64_t> _live = {0};
+  std::atomic<uint64_t> _pooled = {0};
+  std::atomic<uint64_t> _allocated = {0};
+  std::atomic<uint64_t> _returned = {0};
+  std::atomic<uint64_t> _mapped = {0};
+};
+}  // namespace fleet
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <netinet/tcp.h>
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <vector>
@@ -36,6 +37,65 @@ class TCPServer : public std::enable_shared_from_this<TCPServer>, private Uncopy
 
   void set_name(const std::string &n) { _name = n; }
 
+  /**
+   * @brief 开启分片accept，在bind之前调用
+   * @details
+   * 每个地址为io_worker的每个工作线程创建一个SO_REUSEPORT的监听socket，各自在对应的线程上accept，
+   * 接受的连接也在该线程上处理，不经过accept_worker。io_worker是ReactorMode::PER_WORKER时连接的事件也由该线程处理
+   * @param random_balance 为true时挂载cBPF程序把新连接随机分给各监听socket，否则由内核按四元组哈希分配
+   */
+  void set_sharded_accept(bool flag, bool random_balance = false) {
+    _sharded_accept = flag;
+    _random_balance = random_balance;
+  }
+
+  bool is_sharded_accept() const { return _sharded_accept; }
+
+  /**
+   * @brief 设置accept循环每轮最多接受的连接数
+   * @details 每次唤醒后取出所有已经到达的连接，达到上限后让出线程，避免连接洪峰时饿死同一线程上的其他协程
+   */
+  void set_max_accepts_per_loop(size_t n) { _max_accepts_per_loop = n ? n : 1; }
+
+  size_t get_max_accepts_per_loop() const { return _max_accepts_per_loop; }
+
+  /**
+   * @brief 设置同时处理的连接数上限，0表示不限制
+   * @details 连接数是正在执行handle_client的连接数。达到上限时暂停accept，新连接留在内核的backlog中
+   */
+  void set_max_connections(size_t n) { _max_connections = n; }
+
+  size_t get_max_connections() const { return _max_connections; }
+
+  // 设置io_worker中等待执行的任务数上限，达到上限时暂停accept，0表示不限制
+  void set_max_pending_tasks(size_t n) { _max_pending_tasks = n; }
+
+  size_t get_max_pending_tasks() const { return _max_pending_tasks; }
+
+  /**
+   * @brief 设置恢复accept的水位
+   * @details 暂停后要降到上限的ratio倍以下才恢复，避免在上限附近反复暂停和恢复
+   */
+  void set_resume_ratio(double ratio) { _resume_ratio = ratio; }
+
+  double get_resume_ratio() const { return _resume_ratio; }
+
+  // 过载保护的统计
+  struct Stats {
+    // 正在处理的连接数
+    size_t connections = 0;
+    // 接受的连接数，不含拒绝的
+    uint64_t accepted = 0;
+    // 多个accept循环同时接受导致超过连接数上限，接受后立即关闭的连接数
+    uint64_t rejected = 0;
+    // accept循环暂停的次数
+    uint64_t pauses = 0;
+    // accept循环暂停的总时长，多个accept循环的累加
+    uint64_t paused_us = 0;
+  };
+
+  Stats get_stats() const;
+
   bool is_running() const { return _is_running; }
 
   std::string to_string(const std::string &prefix = "");
@@ -45,9 +105,30 @@ class TCPServer : public std::enable_shared_from_this<TCPServer>, private Uncopy
 
   virtual void start_accept(Socket::Ptr sock);
 
+ private:
+  // 为addr在每个工作线程上创建一个SO_REUSEPORT的监听socket
+  bool bind_sharded(Address::Ptr addr);
+
+  /**
+   * @brief 是否超过上限
+   * @param paused 已经暂停时和恢复水位比较，否则和上限比较
+   */
+  bool is_overloaded(bool paused) const;
+
+  // 超过上限时挂起accept循环，直到降到恢复水位或服务器停止
+  void wait_for_capacity();
+
+  // 唤醒所有暂停的accept循环
+  void resume_accept();
+
+  // 执行handle_client并维护连接数
+  void serve_client(Socket::Ptr client);
+
  protected:
   // 可能会同时监听多个Socket
   std::vector<Socket::Ptr> _socks;
+  // 与_socks一一对应，分片accept的监听socket所属的工作线程序号，否则为-1
+  std::vector<int> _sock_shards;
 
   IOManager *_io_worker;
 
@@ -60,5 +141,34 @@ class TCPServer : public std::enable_shared_from_this<TCPServer>, private Uncopy
   std::string _type = "tcp";
   // 是否在运行
   bool _is_running = false;
+  // 是否每个工作线程一个监听socket
+  bool _sharded_accept = false;
+  // 分片accept时是否随机分配新连接
+  bool _random_balance = false;
+  // accept循环每轮最多接受的连接数
+  size_t _max_accepts_per_loop = 64;
+
+  // 同时处理的连接数上限，0表示不限制
+  size_t _max_connections = 0;
+  // io_worker中等待执行的任务数上限，0表示不限制
+  size_t _max_pending_tasks = 0;
+  // 恢复accept的水位是上限的多少倍
+  double _resume_ratio = 0.9;
+  std::atomic<size_t> _connection_count = {0};
+  std::atomic<uint64_t> _accepted_count = {0};
+  std::atomic<uint64_t> _rejected_count = {0};
+  std::atomic<uint64_t> _pause_count = {0};
+  std::atomic<uint64_t> _paused_us = {0};
+
+  // 暂停的accept循环，恢复时在原来的调度器和线程上执行
+  struct PausedAccept {
+    IOManager *iom;
+    Fiber::Ptr fiber;
+    int thread_id;
+  };
+  Mutex _pause_mutex;
+  std::vector<PausedAccept> _paused_fibers;
+  // _paused_fibers的大小，连接结束时不加锁判断是否需要唤醒
+  std::atomic<size_t> _paused_fiber_count = {0};
 };
 }  // namespace fleet
\ No newline at end of file
@@ -1,9 +1,10 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <memory>
-#include <set>
 #include <vector>
 
 #include "mutex.h"
@@ -11,9 +12,20 @@
 namespace fleet {
 
 class TimerManager;
+class TimerQueue;
+class TimerSet;
+class TimingWheel;
+
+// 定时器的存储方式
+enum class TimerBackend {
+  SET,   // 红黑树，插入删除O(log n)，共享reactor时只有一个分片
+  WHEEL  // 分层时间轮，插入删除O(1)，按线程分片加锁
+};
 
 class Timer : public std::enable_shared_from_this<Timer> {
   friend TimerManager;
+  friend TimerSet;
+  friend TimingWheel;
 
  public:
   using Ptr = std::shared_ptr<Timer>;
@@ -25,29 +37,49 @@ class Timer : public std::enable_shared_from_this<Timer> {
 
   bool refresh();
 
+  // period单位为毫秒
   bool reset(uint64_t period, bool from_now);
 
+  // period单位为微秒
+  bool reset_us(uint64_t period_us, bool from_now);
+
  private:
-  Timer(uint64_t period, std::function<void()> cb, bool repeat, TimerManager *manager);
+  Timer(uint64_t period_us, std::function<void()> cb, bool repeat, TimerManager *manager);
 
   // 创建用于比较的Timer
   Timer(uint64_t next);
 
  private:
   struct Comparator {
-    bool operator()(Timer::Ptr const &lhs, Timer::Ptr const &rhs) { return lhs->_next < rhs->_next; }
+    bool operator()(Timer::Ptr const &lhs, Timer::Ptr const &rhs) {
+      // 到期时间相同的定时器按地址区分，否则std::set会把它们当成同一个元素而丢掉后插入的
+      if (lhs->_next != rhs->_next) {
+        return lhs->_next < rhs->_next;
+      }
+      return lhs.get() < rhs.get();
+    }
   };
 
  private:
   bool _repeat = false;
-  // 执行周期
+  // 执行周期，微秒
   uint64_t _period = 0;
-  // 绝对执行时间
+  // 绝对执行时间，微秒
   uint64_t _next = 0;
   // 回调函数
   std::function<void()> _cb;
   // 定时器管理器
   TimerManager *_manager = nullptr;
+  // 所在的分片
+  size_t _shard = 0;
+
+  /*下面是时间轮使用的侵入式双向链表*/
+  Timer *_wheel_prev = nullptr;
+  Timer *_wheel_next = nullptr;
+  // 所在槽的链表头，为空表示不在时间轮中
+  Timer **_wheel_slot = nullptr;
+  // 在时间轮中时持有自己的引用
+  Timer::Ptr _wheel_hold;
 };
 
 class TimerManager {
@@ -56,33 +88,75 @@ class TimerManager {
  public:
   using RWMutexType = RWMutex;
 
-  TimerManager();
+  /**
+   * @param backend 定时器的存储方式
+   * @param shards 分片数，每个分片一把锁，线程按select_timer_shard()选择分片
+   */
+  TimerManager(TimerBackend backend = TimerBackend::SET, size_t shards = 1);
   // 可能要继承
   virtual ~TimerManager();
 
+  // period单位为毫秒
   Timer::Ptr add_timer(uint64_t period, std::function<void()> cb, bool repeat = false);
 
+  // period单位为微秒
+  Timer::Ptr add_timer_us(uint64_t period_us, std::function<void()> cb, bool repeat = false);
+
   Timer::Ptr add_condition_timer(uint64_t period, std::function<void()> cb, std::weak_ptr<void> weak_cond,
                                  bool repeat = false);
 
+  // 距离最早的定时器到期的毫秒数(向上取整)，没有定时器返回UINT64_MAX
   uint64_t get_next_timer();
 
+  // 距离最早的定时器到期的微秒数，没有定时器返回UINT64_MAX
+  uint64_t get_next_timer_us();
+
   // 获取要执行的回调列表
   std::vector<std::function<void()>> list_expired_cb();
 
+  // 只看一个分片：距离该分片最早的定时器到期的微秒数，之后插入该分片更早的定时器时通知
+  uint64_t get_next_timer_us(size_t shard);
+
+  // 只取出一个分片中到期的回调
+  std::vector<std::function<void()>> list_expired_cb(size_t shard);
+
+  size_t get_timer_shard_count() const { return _shards.size(); }
+
   bool has_timer();
 
+  TimerBackend get_timer_backend() const { return _backend; }
+
  protected:
-  virtual void on_timer_inserted_front() = 0;
+  // shard分片中插入了比最近一次查询得到的到期时间更早的定时器
+  virtual void on_timer_inserted_front(size_t shard) = 0;
 
+  // 新定时器放入的分片，默认按线程号选择
+  virtual size_t select_timer_shard();
+
+  // 插入timer所在的分片，lock是该分片的写锁
   virtual void add_timer(Timer::Ptr timer, RWMutexType::WriteLock &lock);
 
  private:
-  RWMutexType _timer_list_mutex;
-  // 定时器集合
-  std::set<Timer::Ptr, Timer::Comparator> _timers;
+  struct Shard {
+    RWMutexType mutex;
+    std::unique_ptr<TimerQueue> queue;
+    // 最近一次查询得到的最早到期时间，更早的定时器插入时要通知
+    std::atomic<uint64_t> next_deadline = {UINT64_MAX};
+    // 查询之后是否已经通知过，避免重复通知
+    std::atomic<bool> tickled = {false};
+  };
 
-  // 当有Timer插到最前面时，置为true
-  bool _tickled = false;
+  // 查询前调用，之后插入的定时器都会通知
+  static void reset_deadline(Shard &shard) {
+    shard.tickled = false;
+    shard.next_deadline = UINT64_MAX;
+  }
+
+  // 把最早到期时间转换成距离现在的微秒数
+  static uint64_t time_until(uint64_t next);
+
+ private:
+  TimerBackend _backend;
+  std::vector<std::unique_ptr<Shard>> _shards;
 };
 }  // namespace fleet
\ No newline at end of file
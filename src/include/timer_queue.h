@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+#include "timer.h"
+
+namespace fleet {
+
+/**
+ * @brief 定时器容器
+ * @details 不加锁，由TimerManager的分片锁保护
+ */
+class TimerQueue {
+ public:
+  virtual ~TimerQueue() {}
+
+  // 插入定时器
+  virtual void insert(const Timer::Ptr &timer) = 0;
+
+  // 删除定时器，不存在返回false
+  virtual bool erase(const Timer::Ptr &timer) = 0;
+
+  // 最早到期时间(微秒)，允许比实际的早，没有定时器返回UINT64_MAX
+  virtual uint64_t next_expire() const = 0;
+
+  // 按到期顺序取出所有到期时间不晚于now的定时器，追加到expired
+  virtual void pop_expired(uint64_t now, std::vector<Timer::Ptr> &expired) = 0;
+
+  virtual bool empty() const = 0;
+};
+
+// 基于std::set的实现
+class TimerSet : public TimerQueue {
+ public:
+  void insert(const Timer::Ptr &timer) override;
+
+  bool erase(const Timer::Ptr &timer) override;
+
+  uint64_t next_expire() const override;
+
+  void pop_expired(uint64_t now, std::vector<Timer::Ptr> &expired) override;
+
+  bool empty() const override { return _timers.empty(); }
+
+ private:
+  std::set<Timer::Ptr, Timer::Comparator> _timers;
+};
+
+/**
+ * @brief 分层时间轮，一个tick是1us
+ * @details
+ * 第0层256个槽，每槽1个tick；第1~4层各64个槽，每槽分别是2^8、2^14、2^20、2^26个tick，
+ * 共覆盖2^32us(约71分钟)，更远的定时器先放在最高层，到时再重新计算。
+ * 高层的槽在低层转完一圈时把其中的定时器重新插入低层(cascade)，插入删除都是O(1)
+ */
+class TimingWheel : public TimerQueue {
+ public:
+  // @param now 当前时间，即第一个要处理的tick
+  explicit TimingWheel(uint64_t now);
+
+  ~TimingWheel();
+
+  void insert(const Timer::Ptr &timer) override;
+
+  bool erase(const Timer::Ptr &timer) override;
+
+  uint64_t next_expire() const override;
+
+  void pop_expired(uint64_t now, std::vector<Timer::Ptr> &expired) override;
+
+  bool empty() const override { return _count == 0; }
+
+ private:
+  static constexpr int LEVELS = 5;
+  static constexpr int ROOT_BITS = 8;
+  static constexpr int LEVEL_BITS = 6;
+  static constexpr size_t ROOT_SIZE = 1 << ROOT_BITS;
+  static constexpr size_t LEVEL_SIZE = 1 << LEVEL_BITS;
+
+  // 第level层每个槽的tick数的log2
+  static int level_shift(int level) { return level == 0 ? 0 : ROOT_BITS + (level - 1) * LEVEL_BITS; }
+
+  // 第level层的槽
+  Timer **slots(int level) { return level == 0 ? _root : _levels[level - 1]; }
+
+  static size_t slot_count(int level) { return level == 0 ? ROOT_SIZE : LEVEL_SIZE; }
+
+  // 根据相对_current的距离放入对应的槽
+  void link(Timer *timer);
+
+  void unlink(Timer *timer);
+
+  // 处理第tick个tick：必要时cascade高层的槽，然后取出第0层对应槽中的定时器
+  void run_tick(uint64_t tick, std::vector<Timer::Ptr> &expired);
+
+  // 把第level层第index个槽中的定时器重新插入
+  void cascade(int level, size_t index);
+
+ private:
+  // 下一个要处理的tick，之前的tick都已经处理过
+  uint64_t _current;
+  // 定时器总数
+  size_t _count = 0;
+  Timer *_root[ROOT_SIZE] = {};
+  Timer *_levels[LEVELS - 1][LEVEL_SIZE] = {};
+};
+}  // namespace fleet
@@ -22,4 +22,7 @@ std::string get_thread_name();
 std::string backtrace_to_string(int size = 64, int skip = 2, const std::string &prefix = "");
 
 uint64_t get_elapsed_ms();
+
+// 微秒精度的get_elapsed_ms()
+uint64_t get_elapsed_us();
 }  // namespace fleet
\ No newline at end of file
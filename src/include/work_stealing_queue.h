@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "uncopyable.h"
+
+namespace fleet {
+
+/**
+ * @brief 定长的Chase-Lev无锁工作窃取队列
+ * @details
+ * 只有所属线程能调用push和pop(在bottom端，后进先出)，其他线程通过steal从top端窃取(先进先出)。
+ * 队列满时push返回false，由调用者放到别处(全局队列)。T必须是指针之类的trivial类型。
+ */
+template <typename T>
+class WorkStealingQueue : private Uncopyable {
+ public:
+  /**
+   * @param capacity 容量，会向上取整到2的幂
+   */
+  WorkStealingQueue(size_t capacity = 4096) {
+    _capacity = 1;
+    while (_capacity < capacity) {
+      _capacity <<= 1;
+    }
+    _mask = _capacity - 1;
+    _buffer.reset(new std::atomic<T>[_capacity]);
+  }
+
+  // 只能由所属线程调用
+  bool push(T item) {
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_acquire);
+    if (b - t >= static_cast<int64_t>(_capacity)) {
+      return false;
+    }
+    _buffer[b & _mask].store(item, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // 只能由所属线程调用，队列为空返回false
+  bool pop(T &item) {
+    int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+    if (t > b) {
+      // 队列为空
+      _bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    item = _buffer[b & _mask].load(std::memory_order_relaxed);
+    if (t == b) {
+      // 只剩最后一个元素，和窃取者竞争
+      bool won = _top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      _bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // 任意线程都可以调用，队列为空或竞争失败返回false
+  bool steal(T &item) {
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = _bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    item = _buffer[t & _mask].load(std::memory_order_relaxed);
+    return _top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  // 近似大小
+  size_t size() const {
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+ private:
+  // top和bottom放在不同的cache line，避免伪共享
+  alignas(64) std::atomic<int64_t> _top = {0};
+  alignas(64) std::atomic<int64_t> _bottom = {0};
+  alignas(64) std::unique_ptr<std::atomic<T>[]> _buffer;
+  size_t _capacity;
+  size_t _mask;
+};
+}  // namespace fleet
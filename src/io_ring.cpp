@@ -0,0 +1,133 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "io_ring.h"
+#include "log.h"
+
+namespace fleet {
+
+IORing::IORing(unsigned entries, unsigned cq_entries) {
+  memset(&_params, 0, sizeof(_params));
+  _params.flags = IORING_SETUP_CQSIZE;
+  _params.cq_entries = cq_entries;
+  int fd = syscall(__NR_io_uring_setup, entries, &_params);
+  if (fd < 0) {
+    WarnL << "io_uring_setup failed: " << errno << " (" << strerror(errno) << ")";
+    return;
+  }
+
+  _sq_ring_size = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+  _cq_ring_size = _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe);
+  if (_params.features & IORING_FEAT_SINGLE_MMAP) {
+    // SQ和CQ在同一块映射中
+    _sq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+    _cq_ring_size = 0;
+  }
+  _sq_ring = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (_sq_ring == MAP_FAILED) {
+    _sq_ring = nullptr;
+    close(fd);
+    return;
+  }
+  if (_cq_ring_size) {
+    _cq_ring = mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (_cq_ring == MAP_FAILED) {
+      _cq_ring = nullptr;
+      munmap(_sq_ring, _sq_ring_size);
+      close(fd);
+      return;
+    }
+  } else {
+    _cq_ring = _sq_ring;
+  }
+  _sqes_size = _params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (_cq_ring_size) {
+      munmap(_cq_ring, _cq_ring_size);
+    }
+    munmap(_sq_ring, _sq_ring_size);
+    close(fd);
+    return;
+  }
+  _sqes = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(_sq_ring);
+  _sq_head = reinterpret_cast<unsigned *>(sq + _params.sq_off.head);
+  _sq_tail = reinterpret_cast<unsigned *>(sq + _params.sq_off.tail);
+  _sq_flags = reinterpret_cast<unsigned *>(sq + _params.sq_off.flags);
+  _sq_array = reinterpret_cast<unsigned *>(sq + _params.sq_off.array);
+  _sq_mask = *reinterpret_cast<unsigned *>(sq + _params.sq_off.ring_mask);
+  _sqe_tail = *_sq_tail;
+
+  char *cq = static_cast<char *>(_cq_ring);
+  _cq_head = reinterpret_cast<unsigned *>(cq + _params.cq_off.head);
+  _cq_tail = reinterpret_cast<unsigned *>(cq + _params.cq_off.tail);
+  _cqes = reinterpret_cast<io_uring_cqe *>(cq + _params.cq_off.cqes);
+  _cq_mask = *reinterpret_cast<unsigned *>(cq + _params.cq_off.ring_mask);
+
+  // 查询内核支持的操作
+  size_t probe_size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+  auto probe = static_cast<io_uring_probe *>(calloc(1, probe_size));
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+    for (int i = 0; i < probe->ops_len && i < IORING_OP_LAST; i++) {
+      _ops_supported[i] = probe->ops[i].flags & IO_URING_OP_SUPPORTED;
+    }
+  }
+  free(probe);
+
+  _ring_fd = fd;
+}
+
+IORing::~IORing() {
+  if (_ring_fd < 0) {
+    return;
+  }
+  munmap(_sqes, _sqes_size);
+  if (_cq_ring_size) {
+    munmap(_cq_ring, _cq_ring_size);
+  }
+  munmap(_sq_ring, _sq_ring_size);
+  close(_ring_fd);
+}
+
+bool IORing::is_op_supported(int op) const { return op >= 0 && op < IORING_OP_LAST && _ops_supported[op]; }
+
+io_uring_sqe *IORing::get_sqe() {
+  unsigned head = reinterpret_cast<std::atomic<unsigned> *>(_sq_head)->load(std::memory_order_acquire);
+  if (_sqe_tail - head >= _params.sq_entries) {
+    return nullptr;
+  }
+  io_uring_sqe *sqe = &_sqes[_sqe_tail & _sq_mask];
+  _sq_array[_sqe_tail & _sq_mask] = _sqe_tail & _sq_mask;
+  ++_sqe_tail;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+unsigned IORing::publish() {
+  auto tail = reinterpret_cast<std::atomic<unsigned> *>(_sq_tail);
+  unsigned count = _sqe_tail - tail->load(std::memory_order_relaxed);
+  // SQE的内容要在tail之前对内核可见
+  tail->store(_sqe_tail, std::memory_order_release);
+  return count;
+}
+
+int IORing::enter(unsigned to_submit, unsigned flags) {
+  int ret = 0;
+  do {
+    ret = syscall(__NR_io_uring_enter, _ring_fd, to_submit, 0, flags, nullptr, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret < 0 ? -errno : ret;
+}
+
+bool IORing::is_cq_overflow() const {
+  return reinterpret_cast<std::atomic<unsigned> *>(_sq_flags)->load(std::memory_order_relaxed) &
+         IORING_SQ_CQ_OVERFLOW;
+}
+}  // namespace fleet
@@ -1,13 +1,20 @@
 #include <error.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <algorithm>
 #include <cerrno>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <vector>
 
@@ -15,52 +22,139 @@
 #include "scheduler.h"
 #include "fd_manager.h"
 #include "hook.h"
+#include "io_ring.h"
 #include "iomanager.h"
 #include "log.h"
 #include "macro.h"
 
 namespace fleet {
 
-IOManager::IOManager(size_t threads, const std::string &name) : Scheduler(threads, name) {
-  _epfd = epoll_create(1000);
-  ASSERT(_epfd > 0);
-
-  set_hook_enable(true);  // 主线程要早点开，让后面的pipe hook
-
-  int ret = pipe(_notify_fds);
-  ASSERT(ret == 0);
-
-  epoll_event epev;
-  epev.events = EPOLLIN | EPOLLET;  // 监听读事件，边缘触发
-  epev.data.fd = _notify_fds[0];    // 让epoll监听管道的可读事件
+// 内核是否支持epoll_pwait2，不支持时退回timerfd
+static std::atomic<bool> s_epoll_pwait2_supported = {true};
+
+// io_uring的SQ大小
+static constexpr unsigned RING_ENTRIES = 256;
+// CQ要能放下所有同时完成的操作，放不下时内核会暂存到溢出链表
+static constexpr unsigned RING_CQ_ENTRIES = 4096;
+// 攒够这么多SQE就立即提交，不等到线程空闲
+static constexpr unsigned RING_SUBMIT_BATCH = 32;
+
+// 所有还没有析构的IOManager，用于在不属于任何IOManager的线程中关闭fd
+static Mutex s_instances_mutex;
+static std::vector<IOManager *> s_instances;
+
+struct IOManager::IOWaiter {
+  // 等待完成的协程
+  Fiber::Ptr fiber;
+  FdTask *fd_ctx = nullptr;
+  Event event = Event::NONE;
+  // 完成结果，失败为-errno
+  int result = 0;
+  // 是否被cancel_io取消，用来区分超时
+  bool cancelled = false;
+  // 链接的超时，提交之前要一直有效
+  __kernel_timespec timeout;
+};
+
+IOManager::IOManager(size_t threads, const std::string &name, TimerBackend timer_backend, IOBackend io_backend,
+                     ReactorMode reactor_mode)
+    : Scheduler(threads, name),
+      // 多reactor模式下每个工作线程一个定时器分片
+      TimerManager(timer_backend,
+                   timer_backend == TimerBackend::WHEEL || reactor_mode == ReactorMode::PER_WORKER ? threads : 1),
+      _reactor_mode(reactor_mode) {
+  set_hook_enable(true);  // 主线程要早点开
+
+  _fd_tables.emplace_back(new FdTable(64));
+  _fd_table = _fd_tables.back().get();
+
+  size_t reactor_count = _reactor_mode == ReactorMode::PER_WORKER ? std::max<size_t>(_thread_count, 1) : 1;
+  for (size_t i = 0; i < reactor_count; i++) {
+    std::unique_ptr<Reactor> reactor(new Reactor);
+    reactor->epfd = epoll_create(1000);
+    ASSERT(reactor->epfd > 0);
+
+    // 不支持epoll_pwait2时用timerfd实现微秒级的超时
+    reactor->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ASSERT(reactor->timer_fd >= 0);
+    epoll_event timer_epev;
+    timer_epev.events = EPOLLIN | EPOLLET;
+    timer_epev.data.u64 = internal_epoll_data(reactor->timer_fd);
+    int rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->timer_fd, &timer_epev);
+    ASSERT(rt == 0);
+    _reactors.push_back(std::move(reactor));
+  }
 
-  // 设置成非阻塞
-  ret = fcntl(_notify_fds[0], F_SETFL, O_NONBLOCK);
-  ASSERT(ret != -1);
+  // 每个工作线程一个eventfd，用于唤醒
+  _worker_states.reset(new std::atomic<int>[_thread_count]);
+  for (size_t i = 0; i < _thread_count; i++) {
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ASSERT(efd >= 0);
+    epoll_event epev;
+    epev.events = EPOLLIN | EPOLLET;  // 监听读事件，边缘触发
+    epev.data.u64 = internal_epoll_data(efd);
+    int ret = epoll_ctl(_reactors[i % reactor_count]->epfd, EPOLL_CTL_ADD, efd, &epev);
+    ASSERT(ret == 0);
+    _worker_event_fds.push_back(efd);
+    _worker_states[i] = WORKER_RUNNING;
+  }
+  _syscall_counts.reset(new SyscallCount[_thread_count + 1]);
+
+  if (io_backend == IOBackend::IO_URING) {
+    std::unique_ptr<IORing> ring(new IORing(RING_ENTRIES, RING_CQ_ENTRIES));
+    bool supported = ring->is_valid();
+    for (int op : {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_RECV, IORING_OP_SEND,
+                   IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_LINK_TIMEOUT,
+                   IORING_OP_ASYNC_CANCEL}) {
+      supported = supported && ring->is_op_supported(op);
+    }
+    if (supported) {
+      // CQ非空时ring fd可读，水平触发，没收割完的会在下次epoll_wait再次返回。多reactor模式下由0号线程收割
+      epoll_event epev;
+      epev.events = EPOLLIN;
+      epev.data.u64 = internal_epoll_data(ring->get_fd());
+      int rt = epoll_ctl(_reactors[0]->epfd, EPOLL_CTL_ADD, ring->get_fd(), &epev);
+      ASSERT(rt == 0);
+      _ring = std::move(ring);
+      _io_backend = IOBackend::IO_URING;
+    } else {
+      WarnL << "io_uring is not supported by the kernel, fall back to epoll";
+    }
+  }
 
-  // 加入监听
-  ret = epoll_ctl(_epfd, EPOLL_CTL_ADD, _notify_fds[0], &epev);
-  ASSERT(ret == 0);
+  {
+    Mutex::Lock lock(s_instances_mutex);
+    s_instances.push_back(this);
+  }
 
   start();  // Scheduler继承来的方法，开辟线程池处理任务队列
 }
 
 IOManager::~IOManager() {
   stop();
-  close(_epfd);
-  close(_notify_fds[0]);
-  close(_notify_fds[1]);
+  {
+    // 持有锁的s_del_and_trigger_all结束后才能释放资源
+    Mutex::Lock lock(s_instances_mutex);
+    s_instances.erase(std::find(s_instances.begin(), s_instances.end(), this));
+  }
+  for (auto &reactor : _reactors) {
+    close(reactor->epfd);
+    close(reactor->timer_fd);
+  }
+  for (auto efd : _worker_event_fds) {
+    close(efd);
+  }
+  FdTable *table = _fd_table;
+  for (size_t i = 0; i < table->size; i++) {
+    FdTask *fd_ctx = table->tasks[i];
+    if (fd_ctx) {
+      fd_ctx->~FdTask();
+      free(fd_ctx);
+    }
+  }
 }
 int IOManager::add_event(int fd, Event event, const std::function<void()> &cb) {
-  // 判断是否fd有对应的FdContext
-  _event_mutex.wrlock();
-  auto it = _fd_contexts.find(fd);
-  if (it == _fd_contexts.end()) {
-    _fd_contexts[fd] = std::make_shared<FdTask>();
-  }
-  _event_mutex.unlock();
-
-  FdTask::Ptr fd_ctx = _fd_contexts[fd];
+  FdTask *fd_ctx = get_or_create_fd_task(fd);
   FdTask::MutexType::Lock lock(fd_ctx->mutex);
   // 不能重复加入相同的事件
   if (UNLIKELY(fd_ctx->events & event)) {
@@ -68,16 +162,19 @@ int IOManager::add_event(int fd, Event event, const std::function<void()> &cb) {
            << "fd=" << fd << " fd_ctx->events=" << fd_ctx->events << " event=" << event;
     ASSERT(!(fd_ctx->events & event));
   }
-  // 判断op
-  int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-  epoll_event epev;
-  epev.events = EPOLLET | fd_ctx->events | event;
-  epev.data.fd = fd;
-  int rt = epoll_ctl(_epfd, op, fd, &epev);
-  if (rt) {
-    ErrorL << "epoll_ctl(" << _epfd << ", " << op << ", " << fd << ", " << static_cast<int>(epev.events) << "): " << rt
-           << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events=" << fd_ctx->events;
-    return -1;
+  if (!fd_ctx->persistent) {
+    // 判断op
+    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    epoll_event epev;
+    epev.events = EPOLLET | fd_ctx->events | event;
+    epev.data.u64 = fd_ctx->epoll_data();
+    int epfd = get_reactor(fd_ctx).epfd;
+    int rt = ctl_event(fd_ctx, op, &epev);
+    if (rt) {
+      ErrorL << "epoll_ctl(" << epfd << ", " << op << ", " << fd << ", " << static_cast<int>(epev.events) << "): " << rt
+             << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events=" << fd_ctx->events;
+      return -1;
+    }
   }
 
   ++_pending_event_count;  // 带触发的IO事件数+1
@@ -94,38 +191,50 @@ int IOManager::add_event(int fd, Event event, const std::function<void()> &cb) {
     task.fiber = Fiber::s_get_this();
     ASSERT(task.fiber->get_state() == Fiber::RUNNING);  // 当前的状态应该是RUNNING
   }
+  if (fd_ctx->ready & event) {
+    // 常驻模式下事件在注册等待者之前已经就绪，直接触发。就绪可能是旧的，等待者需要重试IO
+    fd_ctx->ready = static_cast<Event>(fd_ctx->ready & ~event);
+    fd_ctx->trigger_event(event, nullptr, nullptr, get_owner_thread(fd_ctx));
+    --_pending_event_count;
+  }
   return 0;
 }
 
 bool IOManager::del_event(int fd, Event event, bool trigger_task) {
-  {
-    RWMutexType::ReadLock lock(_event_mutex);
-    auto it = _fd_contexts.find(fd);
-    if (it == _fd_contexts.end()) {
-      // 不存在该fd对应的事件
-      return false;
-    }
+  FdTask *fd_ctx = get_fd_task(fd);
+  if (!fd_ctx) {
+    // 不存在该fd对应的事件
+    return false;
   }
-  // 存在
-  FdTask::Ptr fd_ctx = _fd_contexts[fd];
 
   FdTask::MutexType::Lock lock(fd_ctx->mutex);
+  if (_ring && event != Event::ERROR && fd_ctx->get_io_op(event)) {
+    // io_uring模式下等待的协程在io_uring上，取消后协程会被唤醒
+    return cancel_io(fd_ctx, event);
+  }
   // fd没有对应的事件
   if (UNLIKELY(!(event & fd_ctx->events))) {
     return false;
   }
   // 清除event
   Event new_events = static_cast<Event>(fd_ctx->events & ~event);
-  // 判断op
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-  epoll_event epev;
-  epev.events = EPOLLET | new_events;
-
-  int rt = epoll_ctl(_epfd, op, fd, &epev);
-  if (rt) {
-    ErrorL << "epoll_ctl(" << _epfd << ", " << op << ", " << fd << ", " << static_cast<int>(epev.events) << "): " << rt
-           << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events=" << fd_ctx->events;
-    return false;
+  if (!fd_ctx->persistent) {
+    // 判断op
+    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epev;
+    epev.events = EPOLLET | new_events;
+    epev.data.u64 = fd_ctx->epoll_data();
+
+    int epfd = get_reactor(fd_ctx).epfd;
+    int rt = ctl_event(fd_ctx, op, &epev);
+    if (rt) {
+      ErrorL << "epoll_ctl(" << epfd << ", " << op << ", " << fd << ", " << static_cast<int>(epev.events) << "): " << rt
+             << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events=" << fd_ctx->events;
+      return false;
+    }
+    if (!new_events) {
+      retire_epoll_data(fd_ctx);
+    }
   }
 
   if (!trigger_task) {
@@ -135,11 +244,7 @@ bool IOManager::del_event(int fd, Event event, bool trigger_task) {
     fd_ctx->reset_task(task);
   } else {
     // trigger_event里不仅更新task，还将回调放入Scheduler中
-    fd_ctx->trigger_event(event);
-  }
-  if (!new_events) {
-    RWMutexType::WriteLock lock(_event_mutex);
-    _fd_contexts.erase(fd);
+    fd_ctx->trigger_event(event, nullptr, nullptr, get_owner_thread(fd_ctx));
   }
   // 待触发事件-1
   --_pending_event_count;
@@ -147,61 +252,409 @@ bool IOManager::del_event(int fd, Event event, bool trigger_task) {
   return true;
 }
 bool IOManager::del_and_trigger_all(int fd) {
-  {
-    RWMutexType::ReadLock lock(_event_mutex);
-    auto it = _fd_contexts.find(fd);
-    if (it == _fd_contexts.end()) {
-      // 不存在该fd对应的事件
-      return false;
-    }
+  FdTask *fd_ctx = get_fd_task(fd);
+  if (!fd_ctx) {
+    // 不存在该fd对应的事件
+    return false;
   }
-  // 存在
-  FdTask::Ptr fd_ctx = _fd_contexts[fd];
 
   FdTask::MutexType::Lock lock(fd_ctx->mutex);
+  bool cancelled = false;
+  if (_ring) {
+    cancelled = cancel_io(fd_ctx, Event::READ);
+    cancelled = cancel_io(fd_ctx, Event::WRITE) || cancelled;
+  }
   // 没有任何事件
-  if (!fd_ctx->events) {
-    return false;
+  if (!fd_ctx->events && !fd_ctx->persistent) {
+    release_reactor(fd_ctx);
+    return cancelled;
   }
 
   // 删除全部事件
   int op = EPOLL_CTL_DEL;
   epoll_event epev;
   epev.events = 0;
-  int rt = epoll_ctl(_epfd, op, fd, &epev);
+  int epfd = get_reactor(fd_ctx).epfd;
+  int rt = ctl_event(fd_ctx, op, &epev);
+  int owner = get_owner_thread(fd_ctx);
+  fd_ctx->persistent = false;
+  fd_ctx->ready = Event::NONE;
+  release_reactor(fd_ctx);
   if (rt) {
-    ErrorL << "epoll_ctl(" << _epfd << ", " << op << ", " << fd << ", " << static_cast<int>(epev.events) << "): " << rt
+    ErrorL << "epoll_ctl(" << epfd << ", " << op << ", " << fd << ", " << static_cast<int>(epev.events) << "): " << rt
            << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events=" << fd_ctx->events;
     return false;
   }
+  retire_epoll_data(fd_ctx);
 
   // 触发全部已注册事件
   if (fd_ctx->events & Event::READ) {
-    fd_ctx->trigger_event(Event::READ);
+    fd_ctx->trigger_event(Event::READ, nullptr, nullptr, owner);
     --_pending_event_count;
   }
   if (fd_ctx->events & Event::WRITE) {
-    fd_ctx->trigger_event(Event::WRITE);
+    fd_ctx->trigger_event(Event::WRITE, nullptr, nullptr, owner);
     --_pending_event_count;
   }
-  {
-    RWMutexType::WriteLock lock(_event_mutex);
-    _fd_contexts.erase(fd);
+  if (fd_ctx->events & Event::ERROR) {
+    fd_ctx->trigger_event(Event::ERROR, nullptr, nullptr, owner);
+    --_pending_event_count;
   }
 
   ASSERT(fd_ctx->events == 0);
   return true;
 }
+
+bool IOManager::register_persistent(int fd) {
+  FdTask *fd_ctx = get_or_create_fd_task(fd);
+  FdTask::MutexType::Lock lock(fd_ctx->mutex);
+  if (UNLIKELY(fd_ctx->events)) {
+    // 已经以一次性模式注册了事件
+    return false;
+  }
+  // 上一个同号的fd没有经过del_and_trigger_all就关闭了，内核已经把它从epoll中删除
+  retire_epoll_data(fd_ctx);
+  fd_ctx->ready = Event::NONE;
+
+  epoll_event epev;
+  epev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  epev.data.u64 = fd_ctx->epoll_data();
+  int epfd = get_reactor(fd_ctx).epfd;
+  int rt = ctl_event(fd_ctx, EPOLL_CTL_ADD, &epev);
+  if (rt) {
+    ErrorL << "epoll_ctl(" << epfd << ", " << EPOLL_CTL_ADD << ", " << fd << ", " << static_cast<int>(epev.events)
+           << "): " << rt << " (" << errno << ") (" << strerror(errno) << ")";
+    fd_ctx->persistent = false;
+    return false;
+  }
+  fd_ctx->persistent = true;
+  return true;
+}
+
+int IOManager::submit_io(int fd, Event event, const io_uring_sqe &sqe, uint64_t timeout_ms,
+                         const std::atomic<bool> *closed) {
+  ASSERT(_ring);
+  FdTask *fd_ctx = get_or_create_fd_task(fd);
+  IOWaiter waiter;
+  waiter.fiber = Fiber::s_get_this();
+  waiter.fd_ctx = fd_ctx;
+  waiter.event = event;
+  bool has_timeout = timeout_ms != UINT64_MAX;
+  if (has_timeout) {
+    waiter.timeout.tv_sec = timeout_ms / 1000;
+    waiter.timeout.tv_nsec = timeout_ms % 1000 * 1000000;
+  }
+  {
+    // 在fd的锁内放入SQ，保证cancel_io看到waiter时操作一定排在取消之前
+    FdTask::MutexType::Lock lock(fd_ctx->mutex);
+    if (closed && *closed) {
+      return -EBADF;
+    }
+    IOWaiter *&op = fd_ctx->get_io_op(event);
+    if (UNLIKELY(op)) {
+      ErrorL << "事件重复! fd=" << fd << " event=" << event;
+      return -EBUSY;
+    }
+    op = &waiter;
+    ++_pending_event_count;
+    enqueue_sqes(has_timeout ? 2 : 1, [&](io_uring_sqe **sqes) {
+      *sqes[0] = sqe;
+      sqes[0]->user_data = reinterpret_cast<uintptr_t>(&waiter);
+      if (has_timeout) {
+        // 超时后操作以-ECANCELED完成，超时本身的CQE忽略
+        sqes[0]->flags |= IOSQE_IO_LINK;
+        sqes[1]->opcode = IORING_OP_LINK_TIMEOUT;
+        sqes[1]->fd = -1;
+        sqes[1]->addr = reinterpret_cast<uintptr_t>(&waiter.timeout);
+        sqes[1]->len = 1;
+      }
+    });
+  }
+  if (_ring_unsubmitted >= RING_SUBMIT_BATCH) {
+    submit_ring();
+  }
+  Fiber::yield_to_hold();
+  return waiter.result;
+}
+
+void IOManager::enqueue_sqes(unsigned count, const std::function<void(io_uring_sqe **)> &fill) {
+  io_uring_sqe *sqes[2];
+  ASSERT(count <= 2);
+  while (true) {
+    {
+      MutexType::Lock lock(_ring_mutex);
+      if (_ring->space_left() >= count) {
+        for (unsigned i = 0; i < count; i++) {
+          sqes[i] = _ring->get_sqe();
+        }
+        fill(sqes);
+        _ring_unsubmitted += _ring->publish();
+        return;
+      }
+    }
+    // SQ满了，先提交
+    submit_ring();
+  }
+}
+
+bool IOManager::cancel_io(FdTask *fd_ctx, Event event) {
+  IOWaiter *waiter = fd_ctx->get_io_op(event);
+  if (!waiter) {
+    return false;
+  }
+  waiter->cancelled = true;
+  enqueue_sqes(1, [waiter](io_uring_sqe **sqes) {
+    sqes[0]->opcode = IORING_OP_ASYNC_CANCEL;
+    sqes[0]->fd = -1;
+    sqes[0]->addr = reinterpret_cast<uintptr_t>(waiter);
+  });
+  // 调用者接下来可能关闭fd，立即提交
+  submit_ring();
+  return true;
+}
+
+void IOManager::submit_ring() {
+  unsigned count = _ring_unsubmitted.exchange(0);
+  if (!count) {
+    return;
+  }
+  add_syscall_count();
+  int ret = _ring->enter(count);
+  if (ret < static_cast<int>(count)) {
+    // 内核资源暂时不足时留到下次再提交
+    _ring_unsubmitted += ret < 0 ? count : count - ret;
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY) {
+      ErrorL << "io_uring_enter(" << _ring->get_fd() << ", " << count << "): " << ret << " (" << strerror(-ret) << ")";
+    }
+  }
+}
+
+void IOManager::reap_ring(std::vector<Fiber::Ptr> &fibers) {
+  // 同一时刻只有一个线程收割，其他线程跳过，剩下的CQE会让ring fd保持可读
+  if (_ring_reaping.exchange(true, std::memory_order_acquire)) {
+    return;
+  }
+  while (true) {
+    _ring->reap([this, &fibers](const io_uring_cqe &cqe) {
+      if (!cqe.user_data) {
+        // 超时和取消操作本身的结果
+        return;
+      }
+      auto waiter = reinterpret_cast<IOWaiter *>(cqe.user_data);
+      FdTask::MutexType::Lock lock(waiter->fd_ctx->mutex);
+      waiter->fd_ctx->get_io_op(waiter->event) = nullptr;
+      waiter->result = (cqe.res == -ECANCELED && !waiter->cancelled) ? -ETIMEDOUT : cqe.res;
+      int owner = get_owner_thread(waiter->fd_ctx);
+      if (owner >= 0) {
+        // 多reactor模式下由fd所属的工作线程恢复
+        schedule(std::move(waiter->fiber), owner);
+      } else {
+        fibers.push_back(std::move(waiter->fiber));
+      }
+      --_pending_event_count;
+    });
+    if (!_ring->is_cq_overflow()) {
+      break;
+    }
+    // 取回溢出的CQE
+    add_syscall_count();
+    _ring->enter(0, IORING_ENTER_GETEVENTS);
+  }
+  _ring_reaping.store(false, std::memory_order_release);
+}
+
+uint64_t IOManager::get_syscall_count() const {
+  uint64_t count = 0;
+  for (size_t i = 0; i <= _thread_count; i++) {
+    count += _syscall_counts[i].value.load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+int IOManager::ctl_event(FdTask *fd_ctx, int op, epoll_event *epev) {
+  ++_epoll_ctl_count;
+  add_syscall_count();
+  return epoll_ctl(get_reactor(fd_ctx).epfd, op, fd_ctx->fd, epev);
+}
+
+void *IOManager::Reactor::operator new(size_t size) {
+  void *mem = nullptr;
+  if (posix_memalign(&mem, alignof(Reactor), size) != 0) {
+    throw std::bad_alloc();
+  }
+  return mem;
+}
+
+void IOManager::Reactor::operator delete(void *ptr) { free(ptr); }
+
+IOManager::Reactor &IOManager::get_reactor(FdTask *fd_ctx) {
+  if (UNLIKELY(fd_ctx->reactor < 0)) {
+    int index = get_worker_index();
+    if (_reactors.size() == 1 || index < 0) {
+      index = 0;
+    }
+    fd_ctx->reactor = index;
+    ++_reactors[index]->fd_count;
+  }
+  return *_reactors[fd_ctx->reactor];
+}
+
+void IOManager::release_reactor(FdTask *fd_ctx) {
+  if (fd_ctx->reactor >= 0) {
+    --_reactors[fd_ctx->reactor]->fd_count;
+    fd_ctx->reactor = -1;
+  }
+}
+
+int IOManager::get_owner_thread(const FdTask *fd_ctx) const {
+  if (_reactor_mode != ReactorMode::PER_WORKER || fd_ctx->reactor < 0) {
+    return -1;
+  }
+  // 工作线程还没有启动时不指定
+  return get_worker_thread_id(fd_ctx->reactor);
+}
+
+bool IOManager::assign_reactor(int fd, int index) {
+  if (index < 0 || static_cast<size_t>(index) >= _reactors.size()) {
+    // 选择fd最少的reactor
+    index = 0;
+    for (size_t i = 1; i < _reactors.size(); i++) {
+      if (_reactors[i]->fd_count < _reactors[index]->fd_count) {
+        index = i;
+      }
+    }
+  }
+  FdTask *fd_ctx = get_or_create_fd_task(fd);
+  FdTask::MutexType::Lock lock(fd_ctx->mutex);
+  if (fd_ctx->reactor == index) {
+    return true;
+  }
+  if (fd_ctx->events) {
+    // 还有协程等在原来的epoll上
+    return false;
+  }
+  if (!fd_ctx->persistent) {
+    release_reactor(fd_ctx);
+    fd_ctx->reactor = index;
+    ++_reactors[index]->fd_count;
+    return true;
+  }
+
+  // 常驻注册没有等待者，从原来的epoll删除后加到新的epoll，就绪状态留在上下文中
+  epoll_event epev;
+  epev.events = 0;
+  int epfd = get_reactor(fd_ctx).epfd;
+  int rt = ctl_event(fd_ctx, EPOLL_CTL_DEL, &epev);
+  if (rt) {
+    ErrorL << "epoll_ctl(" << epfd << ", " << EPOLL_CTL_DEL << ", " << fd << ", 0): " << rt << " (" << errno << ") ("
+           << strerror(errno) << ")";
+    return false;
+  }
+  // 原来的reactor已经取出的事件带着旧的generation会被丢弃，ADD时内核会重新报告当前的就绪状态
+  retire_epoll_data(fd_ctx);
+  release_reactor(fd_ctx);
+  fd_ctx->reactor = index;
+  ++_reactors[index]->fd_count;
+  epev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  epev.data.u64 = fd_ctx->epoll_data();
+  epfd = get_reactor(fd_ctx).epfd;
+  rt = ctl_event(fd_ctx, EPOLL_CTL_ADD, &epev);
+  if (rt) {
+    ErrorL << "epoll_ctl(" << epfd << ", " << EPOLL_CTL_ADD << ", " << fd << ", " << static_cast<int>(epev.events)
+           << "): " << rt << " (" << errno << ") (" << strerror(errno) << ")";
+    fd_ctx->persistent = false;
+    return false;
+  }
+  return true;
+}
+
+std::vector<IOManager::ReactorLoad> IOManager::get_reactor_loads() const {
+  std::vector<ReactorLoad> loads;
+  for (auto &reactor : _reactors) {
+    ReactorLoad load;
+    load.fds = reactor->fd_count;
+    load.events = reactor->event_count;
+    load.timers = reactor->timer_count;
+    loads.push_back(load);
+  }
+  return loads;
+}
+IOManager::FdTable::FdTable(size_t n) : size(n), tasks(new std::atomic<FdTask *>[n]) {
+  for (size_t i = 0; i < n; i++) {
+    tasks[i] = nullptr;
+  }
+}
+
+IOManager::FdTask *IOManager::get_fd_task(int fd) const {
+  FdTable *table = _fd_table.load(std::memory_order_acquire);
+  if (UNLIKELY(fd < 0 || static_cast<size_t>(fd) >= table->size)) {
+    return nullptr;
+  }
+  return table->tasks[fd].load(std::memory_order_acquire);
+}
+
+IOManager::FdTask *IOManager::get_or_create_fd_task(int fd) {
+  FdTask *fd_ctx = get_fd_task(fd);
+  if (LIKELY(fd_ctx)) {
+    return fd_ctx;
+  }
+  ASSERT(fd >= 0);
+  MutexType::Lock lock(_event_mutex);
+  FdTable *table = _fd_table.load(std::memory_order_relaxed);
+  if (static_cast<size_t>(fd) >= table->size) {
+    // 扩容到原来的1.5倍，复制后再发布，读者看到的新旧表都是完整的
+    size_t size = std::max(static_cast<size_t>(fd) + 1, table->size + table->size / 2);
+    std::unique_ptr<FdTable> new_table(new FdTable(size));
+    for (size_t i = 0; i < table->size; i++) {
+      new_table->tasks[i] = table->tasks[i].load(std::memory_order_relaxed);
+    }
+    table = new_table.get();
+    _fd_tables.push_back(std::move(new_table));
+    _fd_table.store(table, std::memory_order_release);
+  }
+  fd_ctx = table->tasks[fd].load(std::memory_order_relaxed);
+  if (!fd_ctx) {
+    // FdTask要求64字节对齐，C++14的new不保证
+    void *mem = nullptr;
+    int rt = posix_memalign(&mem, alignof(FdTask), sizeof(FdTask));
+    ASSERT(rt == 0);
+    fd_ctx = new (mem) FdTask();
+    fd_ctx->fd = fd;
+    // epoll_data()把地址放在低48位
+    ASSERT((reinterpret_cast<uintptr_t>(fd_ctx) >> 48) == 0);
+    table->tasks[fd].store(fd_ctx, std::memory_order_release);
+  }
+  return fd_ctx;
+}
+
+bool IOManager::s_del_and_trigger_all(int fd) {
+  Mutex::Lock lock(s_instances_mutex);
+  bool found = false;
+  for (auto iom : s_instances) {
+    if (iom->get_fd_task(fd)) {
+      found = iom->del_and_trigger_all(fd) || found;
+    }
+  }
+  return found;
+}
+
 IOManager *IOManager::s_get_this() { return dynamic_cast<IOManager *>(Scheduler::s_get_this()); }
 
-void IOManager::FdTask::trigger_event(Event event) {
+void IOManager::FdTask::trigger_event(Event event, std::vector<Fiber::Ptr> *fibers,
+                                      std::vector<std::function<void()>> *cbs, int thread_id) {
   ASSERT(this->events & event);
   this->events = static_cast<Event>(events & ~event);
   Task &task = get_task(event);
-  if (task.cb) {
-    Scheduler::s_get_this()->schedule(task.cb);
+  if (fibers && cbs) {
+    if (task.cb) {
+      cbs->push_back(std::move(task.cb));
+    } else {
+      fibers->push_back(std::move(task.fiber));
+    }
+  } else if (task.cb) {
+    Scheduler::s_get_this()->schedule(task.cb, thread_id);
   } else {
-    Scheduler::s_get_this()->schedule(task.fiber);
+    Scheduler::s_get_this()->schedule(task.fiber, thread_id);
   }
   reset_task(task);
 }
@@ -212,6 +665,8 @@ IOManager::FdTask::Task &IOManager::FdTask::get_task(Event event) {
       return readCB;
     case IOManager::WRITE:
       return writeCB;
+    case IOManager::ERROR:
+      return errorCB;
     default:
       ASSERT2(false, "get_task");
   }
@@ -230,31 +685,127 @@ void IOManager::start() {
   _stopping = false;  // 启动后为false，当调用stop()方法时又变为true
 
   for (size_t i = 0; i < _thread_count; ++i) {
-    auto th = std::make_shared<Thread>(
-        [this]() {
-          set_hook_enable(true);
-          Scheduler::run();
-        },
-        _name + "_" + std::to_string(i));  // 设置线程名，好调试
-    _threads.push_back(th);
-    _thread_ids.push_back(th->get_id());  // 记录线程id
+    create_worker_thread(i, []() { set_hook_enable(true); });
   }
 }
 
 void IOManager::notify() {
-  DebugL << "notify";
-  int rt = ::write(_notify_fds[1], "1", 1);
-  ASSERT(rt == 1);
+  // 没有线程在睡眠，所有线程都会在进入idle前检查队列，不需要唤醒
+  if (_sleeping_count == 0) {
+    ++_wakeups_suppressed;
+    return;
+  }
+  // 已经有一个线程正在被唤醒，它拿到任务后如果还有剩余任务会继续唤醒其他线程
+  if (_waking.exchange(true)) {
+    ++_wakeups_suppressed;
+    return;
+  }
+  if (wake_follower()) {
+    return;
+  }
+  // 没有follower在睡眠，唤醒poller
+  int poller = _poller;
+  if (poller >= 0) {
+    wake_worker(poller);
+    return;
+  }
+  _waking = false;
+  ++_wakeups_suppressed;
 }
 
-bool IOManager::stopping() {
-  uint64_t timeout = 0;
-  return stopping(timeout);
+void IOManager::notify_worker(size_t index) {
+  // 与等待前的状态设置配对，保证要么这里看到线程在睡眠，要么线程看到信箱里的任务
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_worker_states[index] == WORKER_RUNNING) {
+    ++_wakeups_suppressed;
+    return;
+  }
+  wake_worker(index);
+}
+
+void IOManager::wake_worker(size_t index) {
+  ++_wakeups_issued;
+  add_syscall_count();
+  uint64_t one = 1;
+  int rt = write_p(_worker_event_fds[index], &one, sizeof(one));
+  ASSERT(rt == sizeof(one));
 }
 
-bool IOManager::stopping(uint64_t &timeout) {
-  timeout = get_next_timer();
-  return timeout == UINT64_MAX && _pending_event_count == 0 && Scheduler::stopping();
+bool IOManager::wake_follower() {
+  for (size_t i = 0; i < _thread_count; i++) {
+    int state = WORKER_FOLLOWER;
+    // 抢到标记的线程才去唤醒，避免多次notify唤醒同一个线程
+    if (_worker_states[i].load(std::memory_order_relaxed) == WORKER_FOLLOWER &&
+        _worker_states[i].compare_exchange_strong(state, WORKER_RUNNING)) {
+      wake_worker(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void IOManager::wait_as_follower(int index) {
+  constexpr int MAX_TIMEOUT = 5000;
+  int efd = _worker_event_fds[index];
+  _worker_states[index] = WORKER_FOLLOWER;
+  ++_sleeping_count;
+  // 标记之后再检查一次：poller可能刚好退出了，也可能在标记之前有新任务到来
+  if (_poller != -1 && !has_pending_task()) {
+    pollfd pfd;
+    pfd.fd = efd;
+    pfd.events = POLLIN;
+    int rt = 0;
+    do {
+      rt = poll(&pfd, 1, MAX_TIMEOUT);
+    } while (rt < 0 && errno == EINTR);
+
+    uint64_t value = 0;
+    read_p(efd, &value, sizeof(value));
+    add_syscall_count(2);
+  }
+  --_sleeping_count;
+  _worker_states[index] = WORKER_RUNNING;
+  _waking = false;
+}
+
+int IOManager::wait_events(Reactor &reactor, epoll_event *events, int max_events, uint64_t timeout_us) {
+#ifdef SYS_epoll_pwait2
+  if (s_epoll_pwait2_supported) {
+    timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = timeout_us % 1000000 * 1000;
+    add_syscall_count();
+    int ret = syscall(SYS_epoll_pwait2, reactor.epfd, events, max_events, &ts, nullptr, 0);
+    if (ret >= 0 || errno != ENOSYS) {
+      return ret;
+    }
+    // 内核不支持，以后都用timerfd
+    s_epoll_pwait2_supported = false;
+  }
+#endif
+  if (timeout_us % 1000 == 0) {
+    add_syscall_count();
+    return epoll_wait(reactor.epfd, events, max_events, timeout_us / 1000);
+  }
+  // 不是整毫秒的超时用timerfd实现，epoll_wait的超时向上取整作为兜底
+  itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = timeout_us / 1000000;
+  its.it_value.tv_nsec = timeout_us % 1000000 * 1000;
+  int rt = timerfd_settime(reactor.timer_fd, 0, &its, nullptr);
+  ASSERT(rt == 0);
+  add_syscall_count(2);
+  return epoll_wait(reactor.epfd, events, max_events, (timeout_us + 999) / 1000);
+}
+
+bool IOManager::stopping() {
+  // 先确认已经调用了stop()再看定时器，否则stop()之前刚添加的定时器可能被漏掉
+  if (!_stopping) {
+    return false;
+  }
+  // 先看定时器和事件再看批次数，最后看任务数，保证取出的回调在放入任务队列前一直能被看到。
+  // 不查询到期时间，多reactor模式下那会改动各分片记录的到期时间
+  return !has_timer() && _pending_event_count == 0 && _dispatching_count == 0 && Scheduler::stopping();
 }
 
 void IOManager::idle() {
@@ -263,26 +814,51 @@ void IOManager::idle() {
   constexpr uint64_t MAX_EVENTS = 256;
 
   epoll_event events[MAX_EVENTS];
+  // 本轮触发的回调，处理完所有事件后批量调度
+  std::vector<Fiber::Ptr> fibers;
+  std::vector<std::function<void()>> cbs;
+  int self = get_worker_index();
+  int self_event_fd = _worker_event_fds[self];
+  // 多reactor模式下每个线程只等待自己的epoll和定时器分片
+  bool per_worker = _reactor_mode == ReactorMode::PER_WORKER;
+  Reactor &reactor = *_reactors[per_worker ? self : 0];
 
   while (true) {
-    // 获取下一个定时器的超时时间，顺便判断调度器是否停止
-    uint64_t next_timeout = 0;
-    if (UNLIKELY(stopping(next_timeout))) {
+    if (_ring) {
+      // 本线程和其他线程攒下的SQE在空闲时一起提交
+      submit_ring();
+    }
+    if (UNLIKELY(stopping())) {
       DebugL << "name = " << get_name() << "idle stopping exit";
+      // 让其他还在睡眠的线程也退出
+      notify();
       break;
     }
-    // 阻塞在epoll_wait上，等待事件发生
-    constexpr uint64_t MAX_TIMEOUT = 5000;
+
+    int expected = -1;
+    if (!per_worker && !_poller.compare_exchange_strong(expected, self)) {
+      // 已经有线程阻塞在epoll_wait上了，在自己的eventfd上等待被唤醒
+      wait_as_follower(self);
+      Fiber::yield_to_hold();
+      continue;
+    }
+    // 多reactor模式下睡眠的线程都通过自己的eventfd唤醒，和follower一样
+    _worker_states[self] = per_worker ? WORKER_FOLLOWER : WORKER_POLLER;
+    ++_sleeping_count;
+    // 标记睡眠之后插入的更早的定时器会唤醒本线程，所以在这之后获取超时时间
+    uint64_t next_timeout = per_worker ? get_next_timer_us(self) : get_next_timer_us();
+    if (has_pending_task()) {
+      // 标记睡眠之前有新任务到来，只收集已经发生的事件，不阻塞
+      next_timeout = 0;
+    }
+
+    // 阻塞在epoll上，等待事件发生
+    constexpr uint64_t MAX_TIMEOUT_US = 5000 * 1000;
     int ret = 0;
     while (true) {
-      if (next_timeout == UINT64_MAX) {
-        // 没有定时器了
-        next_timeout = MAX_TIMEOUT;
-      } else {
-        // 有定时器
-        next_timeout = std::min(next_timeout, MAX_TIMEOUT);
-      }
-      ret = epoll_wait(_epfd, events, MAX_EVENTS, next_timeout);
+      // 没有定时器时也最多等MAX_TIMEOUT_US
+      next_timeout = std::min(next_timeout, MAX_TIMEOUT_US);
+      ret = wait_events(reactor, events, MAX_EVENTS, next_timeout);
       if (ret < 0 && errno == EINTR) {
         // 被中断
         continue;
@@ -291,29 +867,69 @@ void IOManager::idle() {
         break;
       }
     }
-
-    // 收集所有已超时的定时器，执行回调
-    auto cbs = list_expired_cb();
-    for (auto const &cb : cbs) {
-      schedule(cb);
+    --_sleeping_count;
+    _worker_states[self] = WORKER_RUNNING;
+    _waking = false;
+    if (!per_worker) {
+      _poller = -1;
     }
 
+    ++_dispatching_count;
+    // 收集所有已超时的定时器的回调
+    cbs = per_worker ? list_expired_cb(self) : list_expired_cb();
+    reactor.timer_count += cbs.size();
+
     // 遍历所有发生的事件
     for (int i = 0; i < ret; i++) {
       epoll_event &epev = events[i];
-      if (epev.data.fd == _notify_fds[0]) {
-        // 通知事件
-        static char dump[16];
-        int err = 0;
-        do {
-          if (read(_notify_fds[0], dump, sizeof(dump)) > 0) {
-            continue;
-          }
-          err = errno;
-        } while (err != EAGAIN);
+      if (epev.data.u64 & 1) {
+        int fd = static_cast<int>(epev.data.u64 >> 1);
+        if (fd == reactor.timer_fd || fd == self_event_fd) {
+          // timerfd超时或定向唤醒本线程，只用于唤醒
+          uint64_t value = 0;
+          read_p(fd, &value, sizeof(value));
+          add_syscall_count();
+        } else if (_ring && fd == _ring->get_fd()) {
+          // io_uring有操作完成
+          reap_ring(fibers);
+        }
+        // 唤醒其他线程的事件，由该线程自己处理
       } else {
-        auto fd_ctx = _fd_contexts[epev.data.fd];
+        // 上下文不会被释放，可以直接解引用
+        auto fd_ctx = reinterpret_cast<FdTask *>(epev.data.u64 & ((1ULL << 48) - 1));
+        uint16_t generation = static_cast<uint16_t>(epev.data.u64 >> 48);
         FdTask::MutexType::Lock lock(fd_ctx->mutex);
+        if (generation != fd_ctx->generation) {
+          // fd已经从epoll中删除，这是之前的注册遗留的事件
+          continue;
+        }
+        ++reactor.event_count;
+
+        if (fd_ctx->persistent) {
+          // 常驻模式：有等待者就触发，否则记为就绪，都不需要epoll_ctl
+          int fired = Event::NONE;
+          if (epev.events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+            fired |= Event::READ;
+          }
+          if (epev.events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            fired |= Event::WRITE;
+          }
+          if (epev.events & EPOLLERR) {
+            fired |= Event::ERROR;
+          }
+          for (Event event : {Event::READ, Event::WRITE, Event::ERROR}) {
+            if (!(fired & event)) {
+              continue;
+            }
+            if (fd_ctx->events & event) {
+              fd_ctx->trigger_event(event, &fibers, &cbs);
+              --_pending_event_count;
+            } else {
+              fd_ctx->ready = static_cast<Event>(fd_ctx->ready | event);
+            }
+          }
+          continue;
+        }
 
         // 出现错误要触发读写事件
         if (epev.events & (EPOLLERR | EPOLLHUP)) {
@@ -327,6 +943,10 @@ void IOManager::idle() {
         if (epev.events & EPOLLOUT) {
           real_events |= Event::WRITE;
         }
+        // EPOLLERR总会报告，只在关注时才算作错误事件。对端关闭的EPOLLHUP不触发
+        if ((epev.events & EPOLLERR) && (fd_ctx->events & Event::ERROR)) {
+          real_events |= Event::ERROR;
+        }
 
         if ((fd_ctx->events & real_events) == Event::NONE) {
           // 关注的事件和发生的事件没有交集
@@ -338,31 +958,66 @@ void IOManager::idle() {
         int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
         epev.events = EPOLLET | left_events;
 
-        int ret2 = epoll_ctl(_epfd, op, epev.data.fd, &epev);
+        int ret2 = ctl_event(fd_ctx, op, &epev);
         if (ret2) {
-          ErrorL << "epoll_ctl(" << _epfd << ", " << op << ", " << static_cast<int>(epev.data.fd) << ", "
+          ErrorL << "epoll_ctl(" << reactor.epfd << ", " << op << ", " << fd_ctx->fd << ", "
                  << static_cast<int>(epev.events) << "): " << ret2 << " (" << errno << ") (" << strerror(errno)
                  << ") fd_ctx->events=" << fd_ctx->events;
           continue;
         }
+        if (!left_events) {
+          retire_epoll_data(fd_ctx);
+        }
 
         if (real_events & Event::READ) {
-          fd_ctx->trigger_event(Event::READ);
+          fd_ctx->trigger_event(Event::READ, &fibers, &cbs);
           --_pending_event_count;
         }
         if (real_events & Event::WRITE) {
-          fd_ctx->trigger_event(Event::WRITE);
+          fd_ctx->trigger_event(Event::WRITE, &fibers, &cbs);
+          --_pending_event_count;
+        }
+        if (real_events & Event::ERROR) {
+          fd_ctx->trigger_event(Event::ERROR, &fibers, &cbs);
           --_pending_event_count;
         }
       }
     }
+
+    // 一次放入所有回调，最多唤醒一个线程。被唤醒的follower会接替poller，
+    // 拿到任务的线程发现还有剩余任务时会继续唤醒其他线程。
+    // 多reactor模式下放入本线程的收件箱，不唤醒也不让其他线程窃取，在数据还在cache中的线程上恢复
+    size_t count = push_batch(std::make_move_iterator(cbs.begin()), std::make_move_iterator(cbs.end()), per_worker);
+    count += push_batch(std::make_move_iterator(fibers.begin()), std::make_move_iterator(fibers.end()), per_worker);
+    --_dispatching_count;
+    cbs.clear();
+    fibers.clear();
+    if (count > 0 && !per_worker) {
+      notify();
+    }
     // idle协程yield，让其他任务能够执行
     Fiber::yield_to_hold();
   }
 }
-void IOManager::on_timer_inserted_front() {
-  // 有比之前更快的定时器出现，需要重新epoll_wait()
-  notify();
+void IOManager::on_timer_inserted_front(size_t shard) {
+  if (_reactor_mode == ReactorMode::PER_WORKER) {
+    // 分片和工作线程一一对应，唤醒等待该分片的线程
+    notify_worker(shard);
+    return;
+  }
+  // 有比之前更快的定时器出现，需要poller重新epoll_wait()
+  int poller = _poller;
+  if (poller >= 0) {
+    wake_worker(poller);
+  }
+}
+
+size_t IOManager::select_timer_shard() {
+  int index = get_worker_index();
+  if (_reactor_mode == ReactorMode::PER_WORKER && index >= 0 && s_get_this() == this) {
+    return index;
+  }
+  return TimerManager::select_timer_shard();
 }
 
-}  // namespace fleet
\ No newline at end of file
+}  // namespace fleet
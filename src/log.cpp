@@ -1,17 +1,30 @@
 #include <bits/types/struct_timeval.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 #include <sys/select.h>
-#include <array>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
 #include <cstring>
+#include <deque>
 #include <fstream>
-#include <iomanip>
 #include <ios>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <thread>
+#ifdef FLEET_HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include <log.h>
 #include "fiber.h"
+#include "hook.h"
+#include "macro.h"
 #include "utils.h"
 
 namespace fleet {
@@ -22,57 +35,349 @@ Logger &Logger::Instance() {
   return instance;
 }
 
-Logger::~Logger() { InfoL << "Program ends."; }
+Logger::~Logger() {
+  // 先取完异步日志，保证最后一条在最后输出
+  _writer.reset();
+  InfoL << "Program ends.";
+}
 
 // 写到_channels中
 void Logger::write_event(LogEvent::Ptr event) {
-  if (event->_level < _level) {
+  if (!should_log(event->_level)) {
     return;
   }
   if (_writer) {  // 异步
-    _writer->push_event(event, this);
+    _writer->push_event(*event);
   } else {  // 同步
-    write_to_channels(event);
+    LogRecord record;
+    record.assign(*event);
+    write_to_channels(record);
   }
 }
 
-void Logger::add_channel(std::shared_ptr<LogChannel> ch) { _channels.push_back(ch); }
+void Logger::add_channel(std::shared_ptr<LogChannel> ch) {
+  // 写线程可能正在遍历_channels
+  Mutex::Lock lock(_channel_mtx);
+  _channels.push_back(ch);
+}
+
+void Logger::write_to_channels(const LogRecord &record) {
+  Mutex::Lock lock(_channel_mtx);
+  write_record(record);
+  flush_channels();
+}
+
+void Logger::write_record(const LogRecord &record) {
+  for (auto &ch : _channels) {
+    ch->write(record);
+  }
+}
 
-void Logger::write_to_channels(LogEvent::Ptr event) {
+void Logger::flush_channels() {
   for (auto &ch : _channels) {
-    ch->write(event);
+    ch->flush();
+  }
+}
+
+void Logger::write_capture(LogEventCapture &capture) {
+  if (!should_log(capture._level)) {
+    return;
+  }
+  if (_writer) {  // 异步
+    _writer->push_event(capture);
+  } else {  // 同步
+    LogRecord record;
+    record.assign(capture);
+    write_to_channels(record);
   }
 }
 
-void Logger::set_async() { _writer = std::make_shared<AsyncWriter>(); }
+void Logger::set_async(LogFullPolicy policy, size_t ring_size) {
+  // 先析构旧的，取完其中的日志
+  _writer.reset();
+  _writer = std::make_shared<AsyncWriter>(this, policy, ring_size);
+}
+
+uint64_t Logger::get_dropped_count() const { return _writer ? _writer->get_dropped() : 0; }
 
 void Logger::set_level(LogLevel level) { _level = level; }
 
+// gettid是系统调用，每个线程只调用一次
+static pid_t get_cached_thread_id() {
+  static thread_local pid_t t_thread_id = get_thread_id();
+  return t_thread_id;
+}
+
 /*******************LogEvent*******************/
 LogEvent::LogEvent(LogLevel level, const char *file, const char *function, int line)
-    : _level(level), _file(strrchr(file, '/') + 1), _function(function), _line(line) {
+    : _level(level), _file(file), _function(function), _line(line) {
   gettimeofday(&_tv, nullptr);  // 获取时间，精确到毫秒
-  _thread_id = get_thread_id();
+  _thread_id = get_cached_thread_id();
   _fiber_id = fleet::Fiber::get_fiber_id();
 }
 
 /*******************LogEventCapture*******************/
 LogEventCapture::LogEventCapture(Logger &logger, LogLevel level, const char *file, const char *function, int line)
-    : _logger(logger), _event(new LogEvent(level, file, function, line)) {}
+    : _logger(logger) {
+  if (!logger._deferred.load(std::memory_order_relaxed)) {
+    _event.reset(new LogEvent(level, file, function, line));
+    return;
+  }
+  _active = true;
+  _level = level;
+  _file = file;
+  _function = function;
+  _line = line;
+  gettimeofday(&_tv, nullptr);
+  _thread_id = get_cached_thread_id();
+  _fiber_id = fleet::Fiber::get_fiber_id();
+}
 
-LogEventCapture::LogEventCapture(LogEventCapture &&other) : _logger(other._logger), _event(other._event) {
+LogEventCapture::LogEventCapture(LogEventCapture &&other)
+    : _logger(other._logger),
+      _event(other._event),
+      _active(other._active),
+      _level(other._level),
+      _file(other._file),
+      _function(other._function),
+      _line(other._line),
+      _tv(other._tv),
+      _thread_id(other._thread_id),
+      _fiber_id(other._fiber_id),
+      _length(other._length),
+      _overflow(std::move(other._overflow)) {
+  if (!_overflow) {
+    memcpy(_inline, other._inline, _length);
+  }
   other._event.reset();
+  other._active = false;
 }
 
 LogEventCapture::~LogEventCapture() {
   // LogEventCapture对象里面可能会存放空的_event
   if (_event) {
     _logger.write_event(_event);
+  } else if (_active) {
+    _logger.write_capture(*this);
+  }
+}
+
+void LogEventCapture::encode_string(const char *data, size_t length) {
+  uint32_t len = length;
+  if (!_overflow && _length + 1 + sizeof(len) + length <= sizeof(_inline)) {
+    put(LogArgType::String, &len, sizeof(len));
+    memcpy(_inline + _length, data, length);
+    _length += length;
+    return;
+  }
+  put_overflow(LogArgType::String, &len, sizeof(len));
+  _overflow->append(data, length);
+  _length = _overflow->size();
+}
+
+void LogEventCapture::put_overflow(LogArgType type, const void *data, size_t length) {
+  if (!_overflow) {
+    _overflow.reset(new std::string(_inline, _length));
+  }
+  _overflow->push_back(static_cast<char>(type));
+  _overflow->append(static_cast<const char *>(data), length);
+  _length = _overflow->size();
+}
+
+/*******************LogRecord*******************/
+void LogRecord::assign(const LogEvent &event) {
+  _level = event._level;
+  _file = event._file;
+  _function = event._function;
+  _line = event._line;
+  _tv = event._tv;
+  _thread_id = event._thread_id;
+  _fiber_id = event._fiber_id;
+  _binary = false;
+  std::string msg = event.str();
+  _length = msg.size();
+  if (msg.size() <= INLINE_SIZE) {
+    memcpy(_inline, msg.data(), msg.size());
+    _overflow.reset();
+  } else {
+    _overflow.reset(new std::string(std::move(msg)));
+  }
+}
+
+void LogRecord::assign(LogEventCapture &capture) {
+  _level = capture._level;
+  _file = capture._file;
+  _function = capture._function;
+  _line = capture._line;
+  _tv = capture._tv;
+  _thread_id = capture._thread_id;
+  _fiber_id = capture._fiber_id;
+  _binary = true;
+  _length = capture._length;
+  if (capture._overflow) {
+    _overflow = std::move(capture._overflow);
+  } else {
+    memcpy(_inline, capture._inline, _length);
+    _overflow.reset();
+  }
+}
+
+void LogRecord::write_message(std::ostream &os) const {
+  if (!_binary) {
+    os.write(data(), _length);
+    return;
+  }
+  std::string out;
+  write_message(out);
+  os.write(out.data(), out.size());
+}
+
+static void append_uint(std::string &out, uint64_t value) {
+  char buf[20];
+  char *p = buf + sizeof(buf);
+  do {
+    *--p = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  out.append(p, buf + sizeof(buf) - p);
+}
+
+static void append_int(std::string &out, int64_t value) {
+  if (value < 0) {
+    out.push_back('-');
+    append_uint(out, 0 - static_cast<uint64_t>(value));
+  } else {
+    append_uint(out, value);
+  }
+}
+
+void LogRecord::write_message(std::string &out) const {
+  const char *p = data();
+  const char *end = p + _length;
+  if (!_binary) {
+    out.append(p, _length);
+    return;
+  }
+  // 从二进制日志文件解码时数据可能损坏，每次读取都检查边界
+  auto read = [&p, end](void *dest, size_t length) {
+    if (static_cast<size_t>(end - p) < length) {
+      return false;
+    }
+    memcpy(dest, p, length);
+    p += length;
+    return true;
+  };
+  // 输出和ostream的默认格式一致
+  char buf[64];
+  uint8_t type;
+  while (read(&type, sizeof(type))) {
+    switch (static_cast<LogArgType>(type)) {
+      case LogArgType::Int: {
+        int64_t v;
+        if (!read(&v, sizeof(v))) {
+          return;
+        }
+        append_int(out, v);
+        break;
+      }
+      case LogArgType::UInt: {
+        uint64_t v;
+        if (!read(&v, sizeof(v))) {
+          return;
+        }
+        append_uint(out, v);
+        break;
+      }
+      case LogArgType::Double: {
+        double v;
+        if (!read(&v, sizeof(v))) {
+          return;
+        }
+        out.append(buf, snprintf(buf, sizeof(buf), "%g", v));
+        break;
+      }
+      case LogArgType::Char: {
+        char v;
+        if (!read(&v, sizeof(v))) {
+          return;
+        }
+        out.push_back(v);
+        break;
+      }
+      case LogArgType::Bool: {
+        bool v;
+        if (!read(&v, sizeof(v))) {
+          return;
+        }
+        out.push_back(v ? '1' : '0');
+        break;
+      }
+      case LogArgType::String: {
+        uint32_t len;
+        if (!read(&len, sizeof(len)) || static_cast<size_t>(end - p) < len) {
+          return;
+        }
+        out.append(p, len);
+        p += len;
+        break;
+      }
+      case LogArgType::Pointer: {
+        const void *v;
+        if (!read(&v, sizeof(v))) {
+          return;
+        }
+        if (v) {
+          out.append(buf, snprintf(buf, sizeof(buf), "%p", v));
+        } else {
+          out.push_back('0');
+        }
+        break;
+      }
+      default:
+        return;
+    }
+  }
+}
+
+/*******************LogRing*******************/
+LogRing::LogRing(size_t capacity) {
+  _capacity = 1;
+  while (_capacity < capacity) {
+    _capacity <<= 1;
   }
+  _mask = _capacity - 1;
+  _records.reset(new LogRecord[_capacity]);
 }
 
 /*******************AsyncWriter*******************/
-AsyncWriter::AsyncWriter() : _exit(false) {
+static std::atomic<uint64_t> s_writer_id = {0};
+
+// 线程本地缓存是否已经析构，trivial类型，线程退出时也能安全访问
+static thread_local bool t_ring_holder_destroyed = false;
+
+// 当前线程的环形缓冲区，线程退出时关闭
+struct RingHolder {
+  uint64_t writer_id = 0;
+  LogRing::Ptr ring;
+
+  ~RingHolder() {
+    t_ring_holder_destroyed = true;
+    if (ring) {
+      ring->close();
+    }
+  }
+};
+
+static RingHolder *get_ring_holder() {
+  if (t_ring_holder_destroyed) {
+    return nullptr;
+  }
+  static thread_local RingHolder t_holder;
+  return &t_holder;
+}
+
+AsyncWriter::AsyncWriter(Logger *logger, LogFullPolicy policy, size_t ring_size)
+    : _logger(logger), _policy(policy), _ring_size(ring_size), _id(++s_writer_id) {
   _thread = std::make_shared<Thread>([this]() { this->run(); }, "Logger Async Writer");
 }
 
@@ -80,116 +385,746 @@ AsyncWriter::~AsyncWriter() {
   _exit = true;
   _sem.post();  // 让run线程的_sem.wait()通过，从而跳出循环
   _thread->join();
-  flush_all();  // 处理run线程结束之后，this正式析构之前的Events
+  flush_all();  // 处理run线程结束之后，this正式析构之前的日志
+}
+
+LogRing *AsyncWriter::get_ring() {
+  auto holder = get_ring_holder();
+  if (!holder) {
+    return nullptr;
+  }
+  if (UNLIKELY(holder->writer_id != _id)) {
+    // 第一次写日志，或者之前的环形缓冲区属于已经析构的AsyncWriter
+    if (holder->ring) {
+      holder->ring->close();
+    }
+    holder->ring = std::make_shared<LogRing>(_ring_size);
+    holder->writer_id = _id;
+    Mutex::Lock lock(_rings_mtx);
+    _new_rings.push_back(holder->ring);
+    _has_new_rings = true;
+  }
+  return holder->ring.get();
 }
 
-void AsyncWriter::push_event(LogEvent::Ptr event, Logger *logger) {
-  {
-    Mutex::Lock lock(_mtx);
-    _pending.emplace_back(event, logger);
+void AsyncWriter::push_event(const LogEvent &event) { push(event); }
+
+void AsyncWriter::push_event(LogEventCapture &capture) { push(capture); }
+
+template <class Source>
+void AsyncWriter::push(Source &source) {
+  auto ring = get_ring();
+  LogRecord *record = ring ? ring->try_reserve() : nullptr;
+  while (UNLIKELY(!record)) {
+    if (!ring || _policy == LogFullPolicy::Sync) {
+      LogRecord tmp;
+      tmp.assign(source);
+      _logger->write_to_channels(tmp);
+      return;
+    }
+    if (_policy == LogFullPolicy::Drop) {
+      ++_dropped;
+      return;
+    }
+    wake_up();
+    std::this_thread::yield();
+    record = ring->try_reserve();
+  }
+  record->assign(source);
+  ring->publish();
+  wake_up();
+}
+
+void AsyncWriter::wake_up() {
+  // 和run中先设置_sleeping再检查环形缓冲区配对，保证不会错过唤醒
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_sleeping.load(std::memory_order_relaxed) && _sleeping.exchange(false)) {
+    _sem.post();
   }
-  _sem.post();
 }
 
 void AsyncWriter::run() {
-  while (!_exit) {
+  while (true) {
+    if (flush_all()) {
+      continue;
+    }
+    if (_exit) {
+      break;
+    }
+    _sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (flush_all()) {
+      _sleeping = false;
+      continue;
+    }
+    if (_exit) {
+      break;
+    }
     _sem.wait();
-    flush_all();
+    _sleeping = false;
   }
 }
 
-void AsyncWriter::flush_all() {
-  decltype(_pending) tmp;
-  {
-    Mutex::Lock lock(_mtx);
-    tmp.swap(_pending);
+size_t AsyncWriter::flush_all() {
+  if (_has_new_rings.load(std::memory_order_acquire)) {
+    Mutex::Lock lock(_rings_mtx);
+    _has_new_rings = false;
+    _rings.insert(_rings.end(), _new_rings.begin(), _new_rings.end());
+    _new_rings.clear();
+  }
+  size_t count = 0;
+  // 一批日志只加一次锁，写完后flush一次
+  Mutex::Lock lock(_logger->_channel_mtx);
+  for (size_t i = 0; i < _rings.size();) {
+    // 先检查关闭再取，关闭之后生产者不会再写入
+    bool closed = _rings[i]->is_closed();
+    count += _rings[i]->drain([this](LogRecord &record) {
+      _logger->write_record(record);
+      record._overflow.reset();
+    });
+    if (closed) {
+      _rings[i] = _rings.back();
+      _rings.pop_back();
+    } else {
+      i++;
+    }
   }
-  tmp.for_each([](std::pair<LogEvent::Ptr, Logger *> &p) { p.second->write_to_channels(p.first); });
+  if (count) {
+    _logger->flush_channels();
+  }
+  return count;
 }
 
 /*******************LogChannel*******************/
-void LogChannel::format(LogEvent::Ptr event, std::ostream &stream, bool if_color) {
+static const char *s_level_names[] = {"    Trace", "    Debug", "     Info", "     Warn", "    Error"};
+static const char *s_level_colors[] = {"\033[1;34m", "\033[1;32m", "\033[1;37m", "\033[1;33m", "\033[1;31m"};
+static const char s_color_reset[] = "\033[0m";
+
+// 右对齐到width，同std::setw
+static void append_padded(std::string &out, const char *str, size_t length, size_t width) {
+  if (length < width) {
+    out.append(width - length, ' ');
+  }
+  out.append(str, length);
+}
+
+static void append_padded(std::string &out, int64_t value, size_t width) {
+  std::string str;
+  append_int(str, value);
+  append_padded(out, str.data(), str.size(), width);
+}
+
+// 每个线程缓存上一次格式化的秒
+struct TimeCache {
+  time_t sec = -1;
+  char str[32];
+  size_t length = 0;
+};
+
+static void append_time(std::string &out, const struct timeval &tv) {
+  static thread_local TimeCache t_cache;
+  if (tv.tv_sec != t_cache.sec) {
+    struct tm lct;
+    localtime_r(&tv.tv_sec, &lct);
+    t_cache.length = strftime(t_cache.str, sizeof(t_cache.str), "%Y-%m-%d %H:%M:%S", &lct);
+    t_cache.sec = tv.tv_sec;
+  }
+  out.append(t_cache.str, t_cache.length);
+  int ms = tv.tv_usec / 1000;
+  char buf[4] = {'.', static_cast<char>('0' + ms / 100), static_cast<char>('0' + ms / 10 % 10),
+                 static_cast<char>('0' + ms % 10)};
+  out.append(buf, sizeof(buf));
+}
+
+void LogChannel::format(const LogRecord &record, std::ostream &stream, bool if_color) {
+  std::string out;
+  format(record, out, if_color);
+  stream.write(out.data(), out.size());
+}
+
+void LogChannel::format(const LogRecord &record, std::string &out, bool if_color) {
   // 时间
-  stream << '[';
-  char sec[64], ms[64];
-  auto lct = localtime(&(event->_tv.tv_sec));
-  strftime(sec, sizeof sec, "%Y-%m-%d %H:%M:%S", lct);
-  snprintf(ms, sizeof ms, "%s.%03d", sec, static_cast<int>(event->_tv.tv_usec / 1000));
-  stream << ms;
-  stream << "] ";
+  out.push_back('[');
+  append_time(out, record._tv);
+  out.append("] ");
 
   // 日志等级
-  static std::array<std::string, 5> color{"34", "32", "37", "33", "31"};
-#define CASE(level)                                                                     \
-  case LogLevel::level:                                                                 \
-    if (if_color) {                                                                     \
-      stream << "\033[1;" << color[static_cast<unsigned long>(LogLevel::level)] << "m"; \
-    }                                                                                   \
-    stream << std::setw(9) << #level;                                                   \
-    if (if_color) {                                                                     \
-      stream << "\033[0m";                                                              \
-    }                                                                                   \
-    stream << " ";                                                                      \
-    break;
-  switch (event->_level) {
-    CASE(Trace)
-    CASE(Debug)
-    CASE(Info)
-    CASE(Warn)
-    CASE(Error)
-  }
-#undef CASE
-
-  // 文件信息
-  stream << std::setw(20);
-  stream << event->_file;
-  stream << std::setw(20);
-  stream << event->_function;
-  stream << std::setw(6);
-  stream << event->_line;
+  auto level = static_cast<size_t>(record._level);
+  if (if_color) {
+    out.append(s_level_colors[level]);
+  }
+  out.append(s_level_names[level]);
+  if (if_color) {
+    out.append(s_color_reset);
+  }
+  out.push_back(' ');
+
+  // 文件信息，只保留文件名，__FILE__是相对路径且不带目录时没有'/'
+  auto slash = strrchr(record._file, '/');
+  auto file = slash ? slash + 1 : record._file;
+  append_padded(out, file, strlen(file), 20);
+  append_padded(out, record._function, strlen(record._function), 20);
+  append_padded(out, record._line, 6);
 
   // 线程号
-  stream << "     <";
-  stream << std::setw(2);
-  stream << event->_thread_id;
-  stream << ">";
+  out.append("     <");
+  append_padded(out, record._thread_id, 2);
+  out.push_back('>');
 
   // 协程号
-  stream << "  {";
-  stream << event->_fiber_id;
-  stream << "} \t";
+  out.append("  {");
+  append_uint(out, record._fiber_id);
+  out.append("} \t");
 
   // 日志内容
   if (if_color) {
-    stream << "\033[1;" << color[static_cast<unsigned long>(event->_level)] << "m";
+    out.append(s_level_colors[level]);
   }
-  stream << event->str() << '\n';
+  record.write_message(out);
+  out.push_back('\n');
   if (if_color) {
-    stream << "\033[0m";
+    out.append(s_color_reset);
+  }
+}
+
+/*******************FdChannel*******************/
+// 直接调用原始的write：hook的write对没有FdCtx的fd返回EBADF，静态初始化期间write_p可能还没有初始化
+static void write_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write_p ? write_p(fd, data, length) : syscall(SYS_write, fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // 写日志出错无处报告，丢弃
+      return;
+    }
+    data += n;
+    length -= n;
+  }
+}
+
+FdChannel::~FdChannel() { write_out(); }
+
+void FdChannel::write(const LogRecord &record) {
+  format(record, _buffer, _color);
+  if (_buffer.size() >= _buffer_size) {
+    write_out();
+  }
+}
+
+void FdChannel::flush() {
+  if (_flush_policy == LogFlushPolicy::Batch) {
+    write_out();
+  }
+}
+
+void FdChannel::set_flush_policy(LogFlushPolicy policy, size_t buffer_size) {
+  _flush_policy = policy;
+  _buffer_size = buffer_size;
+}
+
+void FdChannel::set_sync_policy(LogSyncPolicy policy, uint64_t interval_ms) {
+  _sync_policy = policy;
+  _sync_interval_ms = interval_ms;
+}
+
+void FdChannel::write_out() {
+  if (_buffer.empty()) {
+    return;
+  }
+  if (_fd >= 0) {
+    write_all(_fd, _buffer.data(), _buffer.size());
+    _written += _buffer.size();
+  }
+  // clear保留容量，下一批不用重新分配
+  _buffer.clear();
+  if (_fd < 0 || _sync_policy == LogSyncPolicy::Never) {
+    return;
+  }
+  if (_sync_policy == LogSyncPolicy::Interval) {
+    uint64_t now = get_elapsed_ms();
+    if (now - _last_sync_ms < _sync_interval_ms) {
+      return;
+    }
+    _last_sync_ms = now;
+  }
+  fdatasync(_fd);
+}
+
+ConsoleChannel::ConsoleChannel() : FdChannel(STDOUT_FILENO, true) {}
+
+/*******************LogArchiver*******************/
+#ifdef FLEET_HAVE_ZLIB
+// 先写到临时文件，成功后再改名并删除原文件
+static bool gzip_file(const std::string &path, const std::string &gz_path) {
+  int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    return false;
+  }
+  std::string tmp_path = gz_path + ".tmp";
+  gzFile out = gzopen(tmp_path.c_str(), "wb6");
+  if (!out) {
+    ::close(in);
+    return false;
+  }
+  std::vector<char> buf(64 * 1024);
+  bool ok = true;
+  while (true) {
+    ssize_t n = ::read(in, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      ok = n == 0;
+      break;
+    }
+    if (gzwrite(out, buf.data(), n) != n) {
+      ok = false;
+      break;
+    }
+  }
+  ::close(in);
+  if (gzclose(out) != Z_OK) {
+    ok = false;
+  }
+  if (!ok || rename(tmp_path.c_str(), gz_path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
   }
+  unlink(path.c_str());
+  return true;
 }
+#endif
+
+static bool ends_with(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// 之前轮转留下的文件
+struct LogSegment {
+  std::string path;
+  std::string time;
+  int seq;
+};
+
+// 解析open_segment生成的"%Y-%m-%d-%H_%M_%S[.seq]"，不是这个格式的文件不动
+static bool parse_segment_name(const std::string &name, std::string &time, int &seq) {
+  static const char *FORMAT = "0000-00-00-00_00_00";
+  static const size_t TIME_LEN = strlen(FORMAT);
+  if (name.size() < TIME_LEN) {
+    return false;
+  }
+  for (size_t i = 0; i < TIME_LEN; i++) {
+    if (FORMAT[i] == '0' ? !isdigit(static_cast<unsigned char>(name[i])) : name[i] != FORMAT[i]) {
+      return false;
+    }
+  }
+  time = name.substr(0, TIME_LEN);
+  seq = 0;
+  if (name.size() == TIME_LEN) {
+    return true;
+  }
+  if (name[TIME_LEN] != '.' || name.size() == TIME_LEN + 1 || name.size() > TIME_LEN + 10) {
+    return false;
+  }
+  for (size_t i = TIME_LEN + 1; i < name.size(); i++) {
+    if (!isdigit(static_cast<unsigned char>(name[i]))) {
+      return false;
+    }
+    seq = seq * 10 + (name[i] - '0');
+  }
+  return true;
+}
+
+/**
+ * @brief 找出目录中stem.*ext和stem.*ext.gz形式的已轮转文件
+ * @return 按轮转顺序排列，时间相同时按序号
+ */
+static std::vector<LogSegment> scan_segments(const std::string &stem, const std::string &ext) {
+  std::vector<LogSegment> segments;
+  // 没有'/'时npos + 1为0，dir为空
+  auto slash = stem.rfind('/');
+  std::string dir = stem.substr(0, slash + 1);
+  std::string prefix = stem.substr(slash + 1) + ".";
+  DIR *d = opendir(dir.empty() ? "." : dir.c_str());
+  if (!d) {
+    return segments;
+  }
+  while (auto entry = readdir(d)) {
+    std::string name = entry->d_name;
+    if (name.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    // 扩展名为空时任何文件都以ext结尾，先判断.gz
+    std::string middle = name.substr(prefix.size());
+    if (ends_with(middle, ext + ".gz")) {
+      middle.resize(middle.size() - ext.size() - 3);
+    } else if (ends_with(middle, ext)) {
+      middle.resize(middle.size() - ext.size());
+    } else {
+      continue;
+    }
+    LogSegment segment;
+    if (parse_segment_name(middle, segment.time, segment.seq)) {
+      segment.path = dir + name;
+      segments.push_back(std::move(segment));
+    }
+  }
+  closedir(d);
+  std::sort(segments.begin(), segments.end(), [](const LogSegment &a, const LogSegment &b) {
+    return a.time != b.time ? a.time < b.time : a.seq < b.seq;
+  });
+  return segments;
+}
+
+/**
+ * @brief 在后台线程中压缩已轮转的文件并删除超出保留数的旧文件
+ */
+class LogArchiver {
+ public:
+  // existing是之前轮转留下的文件，按轮转顺序排列，一起计入max_files。需要压缩但还没压缩的重新提交
+  LogArchiver(bool compress, size_t max_files, const std::vector<std::string> &existing)
+      : _compress(compress), _max_files(max_files) {
+    for (auto &path : existing) {
+      if (_compress && !ends_with(path, ".gz")) {
+        _pending.push_back(path);
+      } else {
+        _archived.push_back(path);
+      }
+    }
+    if (!_pending.empty()) {
+      _sem.post();
+    }
+    _thread = std::make_shared<Thread>([this]() { this->run(); }, "Log Archiver");
+  }
+
+  // 处理完已经提交的文件再退出
+  ~LogArchiver() {
+    {
+      Mutex::Lock lock(_mtx);
+      _exit = true;
+    }
+    _sem.post();
+    _thread->join();
+  }
+
+  void push(const std::string &path) {
+    {
+      Mutex::Lock lock(_mtx);
+      _pending.push_back(path);
+    }
+    _sem.post();
+  }
+
+ private:
+  void run() {
+    // 压缩不能和写日志、处理请求抢CPU
+    setpriority(PRIO_PROCESS, get_thread_id(), 19);
+    prune();
+    bool exit = false;
+    while (!exit) {
+      _sem.wait();
+      std::deque<std::string> pending;
+      {
+        Mutex::Lock lock(_mtx);
+        pending.swap(_pending);
+        exit = _exit;
+      }
+      for (auto &path : pending) {
+        archive(path);
+      }
+    }
+  }
+
+  void archive(const std::string &path) {
+    std::string final_path = path;
+#ifdef FLEET_HAVE_ZLIB
+    if (_compress && gzip_file(path, path + ".gz")) {
+      final_path = path + ".gz";
+    }
+#endif
+    _archived.push_back(final_path);
+    prune();
+  }
 
-void ConsoleChannel::write(LogEvent::Ptr event) { format(event, std::cout, true); }
+  void prune() {
+    while (_max_files && _archived.size() > _max_files) {
+      unlink(_archived.front().c_str());
+      _archived.pop_front();
+    }
+  }
+
+ private:
+  bool _compress;
+  size_t _max_files;
+  Mutex _mtx;
+  Semaphore _sem;
+  std::deque<std::string> _pending;
+  bool _exit = false;
+  // 只有后台线程访问，按轮转顺序排列
+  std::deque<std::string> _archived;
+  std::shared_ptr<Thread> _thread;
+};
 
-FileChannel::FileChannel() {
+/*******************FileChannel*******************/
+FileChannel::FileChannel() : FdChannel(-1, false) {
   struct timeval tv;
   gettimeofday(&tv, nullptr);  // 获取时间
   char time_buf[64];
-  auto lct = localtime(&(tv.tv_sec));
-  strftime(time_buf, sizeof time_buf, "%Y-%m-%d-%H_%M_%S", lct);
+  struct tm lct;
+  localtime_r(&tv.tv_sec, &lct);
+  strftime(time_buf, sizeof time_buf, "%Y-%m-%d-%H_%M_%S", &lct);
   _path.assign(time_buf);
   _path += ".log";
-  reopen();
+  open_file(O_TRUNC);
+}
+
+FileChannel::FileChannel(const std::string &path) : FdChannel(-1, false), _path(path) { open_file(O_TRUNC); }
+
+FileChannel::FileChannel(const std::string &path, const LogRotation &rotation)
+    : FdChannel(-1, false), _path(path), _rotation(rotation) {
+  _rotating = rotation.max_size || rotation.interval_sec;
+  if (!_rotating) {
+    open_file(O_TRUNC);
+    return;
+  }
+  // 扩展名只在最后一个'/'之后找
+  auto dot = path.rfind('.');
+  auto slash = path.rfind('/');
+  if (dot != std::string::npos && (slash == std::string::npos || dot > slash + 1)) {
+    _stem = path.substr(0, dot);
+    _ext = path.substr(dot);
+  } else {
+    _stem = path;
+  }
+#ifndef FLEET_HAVE_ZLIB
+  if (rotation.compress) {
+    WarnL << "built without zlib, rotated log files of " << path << " will not be compressed";
+  }
+#endif
+  auto segments = scan_segments(_stem, _ext);
+  if (!segments.empty()) {
+    // 同一秒内重启时接着之前的序号，不覆盖已有的文件
+    _segment_time = segments.back().time;
+    _segment_seq = segments.back().seq;
+  }
+  if (rotation.compress || rotation.max_files) {
+    std::vector<std::string> existing;
+    for (auto &segment : segments) {
+      existing.push_back(segment.path);
+    }
+    _archiver.reset(new LogArchiver(rotation.compress, rotation.max_files, existing));
+  }
+  open_segment(time(nullptr));
+}
+
+FileChannel::~FileChannel() {
+  // 基类析构时fd已经关闭，先写出
+  write_out();
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+  _fd = -1;
+  // 等后台线程处理完已经轮转的文件
+  _archiver.reset();
+}
+
+void FileChannel::write(const LogRecord &record) {
+  if (UNLIKELY(_reopen.load(std::memory_order_relaxed))) {
+    _reopen = false;
+    write_out();
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+    open_file(O_APPEND);
+  }
+  // 用日志自己的时间判断，不用再取时间
+  if (_rotating && (record._tv.tv_sec >= _next_rotate_sec ||
+                    (_rotation.max_size && get_file_size() >= _rotation.max_size))) {
+    rotate(record._tv.tv_sec);
+  }
+  FdChannel::write(record);
+}
+
+void FileChannel::reopen() { _reopen = true; }
+
+void FileChannel::open_file(int flags) {
+  _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0644);
+  _written = 0;
+  struct stat st;
+  if (_fd >= 0 && (flags & O_APPEND) && fstat(_fd, &st) == 0) {
+    _written = st.st_size;
+  }
+}
+
+void FileChannel::open_segment(time_t now) {
+  struct tm lct;
+  localtime_r(&now, &lct);
+  char time_buf[64];
+  strftime(time_buf, sizeof time_buf, "%Y-%m-%d-%H_%M_%S", &lct);
+  if (_segment_time == time_buf) {
+    _segment_seq++;
+  } else {
+    _segment_time = time_buf;
+    _segment_seq = 0;
+  }
+  _path = _stem + "." + _segment_time;
+  if (_segment_seq) {
+    _path += "." + std::to_string(_segment_seq);
+  }
+  _path += _ext;
+  open_file(O_TRUNC);
+
+  if (_rotation.interval_sec) {
+    // 按本地时间对齐到间隔的整数倍
+    time_t interval = _rotation.interval_sec;
+    time_t local = now + lct.tm_gmtoff;
+    _next_rotate_sec = (local / interval + 1) * interval - lct.tm_gmtoff;
+  } else {
+    _next_rotate_sec = std::numeric_limits<time_t>::max();
+  }
+}
+
+void FileChannel::rotate(time_t now) {
+  // 缓冲的日志属于旧文件
+  write_out();
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+  std::string closed = _path;
+  open_segment(now);
+  if (_archiver) {
+    _archiver->push(closed);
+  }
+}
+
+/*******************BinaryFileChannel*******************/
+static const char s_binary_log_magic[8] = {'F', 'L', 'E', 'E', 'T', 'L', 'O', 'G'};
+static const uint32_t s_binary_log_version = 1;
+// 文件中每一项的类型
+static const uint8_t s_binary_log_site = 1;
+static const uint8_t s_binary_log_record = 2;
+
+template <class T>
+static void write_pod(std::ostream &os, const T &value) {
+  os.write(reinterpret_cast<const char *>(&value), sizeof(value));
 }
 
-FileChannel::~FileChannel() { _stream.close(); }
+template <class T>
+static bool read_pod(std::istream &is, T &value) {
+  return static_cast<bool>(is.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+static void write_string(std::ostream &os, const char *str) {
+  uint32_t len = strlen(str);
+  write_pod(os, len);
+  os.write(str, len);
+}
+
+static bool read_string(std::istream &is, std::string &str) {
+  uint32_t len;
+  if (!read_pod(is, len)) {
+    return false;
+  }
+  str.resize(len);
+  return len == 0 || static_cast<bool>(is.read(&str[0], len));
+}
 
-void FileChannel::reopen() {
-  if (_stream.is_open()) {
-    _stream.close();
+BinaryFileChannel::BinaryFileChannel(const std::string &path)
+    : _stream(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc) {
+  _stream.write(s_binary_log_magic, sizeof(s_binary_log_magic));
+  write_pod(_stream, s_binary_log_version);
+}
+
+BinaryFileChannel::~BinaryFileChannel() { _stream.close(); }
+
+void BinaryFileChannel::write(const LogRecord &record) {
+  Site site{record._file, record._function, record._line};
+  auto it = _sites.find(site);
+  uint32_t id;
+  if (it == _sites.end()) {
+    id = _sites.size();
+    _sites.emplace(site, id);
+    write_pod(_stream, s_binary_log_site);
+    write_pod(_stream, id);
+    write_pod(_stream, static_cast<int32_t>(record._line));
+    write_string(_stream, record._file);
+    write_string(_stream, record._function);
+  } else {
+    id = it->second;
   }
-  _stream.open(_path, std::fstream::out);
+  write_pod(_stream, s_binary_log_record);
+  write_pod(_stream, id);
+  write_pod(_stream, static_cast<uint8_t>(record._level));
+  write_pod(_stream, static_cast<int64_t>(record._tv.tv_sec));
+  write_pod(_stream, static_cast<int64_t>(record._tv.tv_usec));
+  write_pod(_stream, static_cast<int32_t>(record._thread_id));
+  write_pod(_stream, record._fiber_id);
+  write_pod(_stream, static_cast<uint8_t>(record._binary));
+  write_pod(_stream, static_cast<uint32_t>(record.size()));
+  _stream.write(record.data(), record.size());
 }
 
-void FileChannel::write(LogEvent::Ptr event) { format(event, _stream, false); }
-}  // namespace fleet
\ No newline at end of file
+int64_t BinaryFileChannel::decode(const std::string &path, std::ostream &os) {
+  std::ifstream in(path, std::ifstream::in | std::ifstream::binary);
+  char magic[sizeof(s_binary_log_magic)];
+  uint32_t version;
+  if (!in.read(magic, sizeof(magic)) || memcmp(magic, s_binary_log_magic, sizeof(magic)) != 0 ||
+      !read_pod(in, version) || version != s_binary_log_version) {
+    return -1;
+  }
+  struct DecodedSite {
+    std::string file;
+    std::string function;
+    int line;
+  };
+  std::vector<DecodedSite> sites;
+  LogRecord record;
+  int64_t count = 0;
+  uint8_t kind;
+  while (read_pod(in, kind)) {
+    if (kind == s_binary_log_site) {
+      uint32_t id;
+      int32_t line;
+      DecodedSite site;
+      if (!read_pod(in, id) || id != sites.size() || !read_pod(in, line) || !read_string(in, site.file) ||
+          !read_string(in, site.function)) {
+        return -1;
+      }
+      site.line = line;
+      sites.push_back(std::move(site));
+      continue;
+    }
+    if (kind != s_binary_log_record) {
+      return -1;
+    }
+    uint32_t id, length;
+    uint8_t level, binary;
+    int64_t sec, usec;
+    int32_t thread_id;
+    if (!read_pod(in, id) || id >= sites.size() || !read_pod(in, level) ||
+        level > static_cast<uint8_t>(LogLevel::Error) || !read_pod(in, sec) || !read_pod(in, usec) ||
+        !read_pod(in, thread_id) || !read_pod(in, record._fiber_id) || !read_pod(in, binary) ||
+        !read_pod(in, length)) {
+      return -1;
+    }
+    record._level = static_cast<LogLevel>(level);
+    record._file = sites[id].file.c_str();
+    record._function = sites[id].function.c_str();
+    record._line = sites[id].line;
+    record._tv.tv_sec = sec;
+    record._tv.tv_usec = usec;
+    record._thread_id = thread_id;
+    record._binary = binary;
+    record._length = length;
+    record._overflow.reset(new std::string(length, '\0'));
+    if (length && !in.read(&(*record._overflow)[0], length)) {
+      return -1;
+    }
+    format(record, os, false);
+    count++;
+  }
+  return count;
+}
+}  // namespace fleet
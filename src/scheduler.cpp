@@ -1,6 +1,11 @@
 #include <cstddef>
+#include <cstdlib>
+#include <functional>
 #include <memory>
+#include <new>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "fiber.h"
 #include "scheduler.h"
@@ -13,14 +18,154 @@
 namespace fleet {
 // 保存当前调度器
 static thread_local Scheduler *t_scheduler = nullptr;
+// 当前工作线程在调度器中的序号，非工作线程为-1
+static thread_local int t_worker_index = -1;
+// 当前工作线程取任务的次数，用于定期优先检查全局队列
+static thread_local uint64_t t_schedule_tick = 0;
+
+/*******************Task内存池*******************/
+/**
+ * 每个线程缓存空闲的Task节点，节点通常在一个线程分配、在另一个线程释放，
+ * 所以本地缓存过多时把一半还给全局链表，本地为空时再从全局链表批量取回
+ */
+namespace {
+struct FreeTask {
+  FreeTask *next;
+};
+
+// 线程本地缓存的空闲节点数上限
+constexpr size_t TASK_CACHE_LIMIT = 1024;
+// 每次在线程本地缓存和全局链表之间转移的节点数
+constexpr size_t TASK_CACHE_BATCH = TASK_CACHE_LIMIT / 2;
+
+struct TaskFreeList {
+  FreeTask *head = nullptr;
+  size_t count = 0;
+
+  void push(FreeTask *node) {
+    node->next = head;
+    head = node;
+    ++count;
+  }
+
+  FreeTask *pop() {
+    FreeTask *node = head;
+    head = node->next;
+    --count;
+    return node;
+  }
+
+  // 从本链表头部取出最多n个节点放到to中
+  void move_to(TaskFreeList &to, size_t n) {
+    while (head && n--) {
+      to.push(pop());
+    }
+  }
+};
+
+struct TaskGlobalPool {
+  Mutex mutex;
+  TaskFreeList list;
+};
+
+TaskGlobalPool &get_task_global_pool() {
+  // 不析构，线程退出时还可能往里面放节点
+  static auto s_pool = new TaskGlobalPool;
+  return *s_pool;
+}
+
+struct TaskThreadCache {
+  TaskFreeList list;
+
+  ~TaskThreadCache();
+};
+
+// 线程本地缓存是否已经析构，trivial类型，线程退出时也能安全访问
+static thread_local bool t_task_cache_destroyed = false;
+
+TaskThreadCache::~TaskThreadCache() {
+  t_task_cache_destroyed = true;
+  auto &pool = get_task_global_pool();
+  Mutex::Lock lock(pool.mutex);
+  list.move_to(pool.list, list.count);
+}
+
+TaskThreadCache *get_task_thread_cache() {
+  if (t_task_cache_destroyed) {
+    return nullptr;
+  }
+  static thread_local TaskThreadCache t_cache;
+  return &t_cache;
+}
+}  // namespace
+
+void *Scheduler::Task::operator new(size_t size) {
+  ASSERT(size == sizeof(Task));
+  auto cache = get_task_thread_cache();
+  if (cache && !cache->list.head) {
+    auto &pool = get_task_global_pool();
+    Mutex::Lock lock(pool.mutex);
+    pool.list.move_to(cache->list, TASK_CACHE_BATCH);
+  }
+  if (cache && cache->list.head) {
+    return cache->list.pop();
+  }
+  return ::operator new(sizeof(Task) > sizeof(FreeTask) ? sizeof(Task) : sizeof(FreeTask));
+}
+
+void Scheduler::Task::operator delete(void *ptr) {
+  if (!ptr) {
+    return;
+  }
+  auto node = static_cast<FreeTask *>(ptr);
+  auto cache = get_task_thread_cache();
+  if (!cache) {
+    auto &pool = get_task_global_pool();
+    Mutex::Lock lock(pool.mutex);
+    pool.list.push(node);
+    return;
+  }
+  cache->list.push(node);
+  if (cache->list.count > TASK_CACHE_LIMIT) {
+    auto &pool = get_task_global_pool();
+    Mutex::Lock lock(pool.mutex);
+    cache->list.move_to(pool.list, TASK_CACHE_BATCH);
+  }
+}
+
+void *Scheduler::Worker::operator new(size_t size) {
+  void *mem = nullptr;
+  if (posix_memalign(&mem, alignof(Worker), size) != 0) {
+    throw std::bad_alloc();
+  }
+  return mem;
+}
+
+void Scheduler::Worker::operator delete(void *ptr) { free(ptr); }
 
 Scheduler::Scheduler(size_t threads, const std::string &name) : _name(name) {
   ASSERT(threads > 0);
   _thread_count = threads;
+  for (size_t i = 0; i < _thread_count; i++) {
+    _workers.emplace_back(new Worker());
+  }
 }
 
 Scheduler::~Scheduler() {
   ASSERT(_stopping);
+  // 正常停止时队列已经为空，这里只是防止泄漏
+  for (auto task : _tasks) {
+    delete task;
+  }
+  Task *task = nullptr;
+  for (auto &worker : _workers) {
+    while (worker->queue.steal(task)) {
+      delete task;
+    }
+    while ((task = pop_mailbox_task(*worker))) {
+      delete task;
+    }
+  }
   if (s_get_this() == this) {
     t_scheduler = nullptr;
   }
@@ -36,13 +181,25 @@ void Scheduler::start() {
   _stopping = false;  // 启动后为false，当调用stop()方法时又变为true
 
   for (size_t i = 0; i < _thread_count; ++i) {
-    auto th = std::make_shared<Thread>([this]() { Scheduler::run(); },
-                                       _name + "_" + std::to_string(i));  // 设置线程名，好调试
-    _threads.push_back(th);
-    _thread_ids.push_back(th->get_id());  // 记录线程id
+    create_worker_thread(i);
   }
 }
 
+void Scheduler::create_worker_thread(size_t index, std::function<void()> init) {
+  auto th = std::make_shared<Thread>(
+      [this, index, init]() {
+        if (init) {
+          init();
+        }
+        Scheduler::run(index);
+      },
+      _name + "_" + std::to_string(index));  // 设置线程名，好调试
+  _threads.push_back(th);
+  _thread_ids.push_back(th->get_id());  // 记录线程id
+  // 线程可能还没有执行到run()，这里先记录，start()返回后就可以指定线程调度
+  _workers[index]->thread_id = th->get_id();
+}
+
 void Scheduler::stop() {
   _auto_stop = true;
   if (_thread_count == 0) {
@@ -78,77 +235,71 @@ void Scheduler::stop() {
   // 到这里线程资源就可以回收了，无需等到Scheduler对象被析构
 }
 
-void Scheduler::run() {
+void Scheduler::run(size_t index) {
   DebugL << _name << " run";
 
   t_scheduler = this;  // 记录
+  ASSERT(index < _workers.size());
+  t_worker_index = index;
+  _workers[t_worker_index]->thread_id = fleet::get_thread_id();
 
   Fiber::s_get_this();  // 创建线程原始协程
 
   Fiber::Ptr idle_fiber(new Fiber([this]() { idle(); }));
+  // 本线程缓存的已结束协程
+  std::vector<Fiber::Ptr> fiber_cache;
+  fiber_cache.reserve(_fiber_cache_size);
 
   while (true) {
-    bool notify_me = false;
-
-    Task::Ptr task = nullptr;
-
-    {
-      MutexType::Lock lock(_task_mutex);
-      auto it = _tasks.begin();
-      while (it != _tasks.end()) {
-        task = *it;
-        if (task->thread_id != -1 && task->thread_id != fleet::get_thread_id()) {
-          // 如果指定了线程而且指定的线程不是此线程
-          ++it;
-          notify_me = true;  // 没遍历完
-          continue;
-        }
-
-        ASSERT(task->fiber || task->cb);  // fiber和cb至少得有一个
-
-        if (task->fiber && task->fiber->get_state() == Fiber::RUNNING) {
-          ++it;
-          continue;
-        }
-
-        it = _tasks.erase(it);   // 从队列中删除此任务
-        ++_active_thread_count;  // 线程进入活跃状态
-        break;
+    // 先进入活跃状态再取任务，避免stopping()看到任务数和活跃线程数同时为0
+    ++_active_thread_count;
+    Task *task = pop_task();
+
+    if (task) {  // 拿到任务
+      if (_stealable_task_count > 0 && has_idle_threads()) {
+        // 还有其他线程能取到的任务，唤醒空闲线程来窃取。信箱和收件箱中的任务只能由所属线程执行，不算
+        notify();
       }
-      notify_me |= (it != _tasks.end());  // 还没有遍历完
-    }
-    if (notify_me) {
-      notify();
-    }
 
-    if (task) {           // 拿到任务
       if (task->fiber) {  // 是fiber
-        if (task->fiber->get_state() == Fiber::TERMINATED || task->fiber->get_state() == Fiber::EXCEPT) {
+        auto state = task->fiber->get_state();
+        if (state == Fiber::TERMINATED || state == Fiber::EXCEPT) {
           // T或E状态的任务不用处理
-          --_active_thread_count;
-          continue;
+        } else if (state == Fiber::RUNNING) {
+          // 协程还没有在其他线程上切出，稍后再试
+          if (task->thread_id != -1) {
+            push_task(task);
+          } else {
+            push_global_task(task);
+          }
+          task = nullptr;
         } else {
           task->fiber->enter();  // 开始执行
           // 执行结束
-          --_active_thread_count;
 
           if (task->fiber->get_state() == Fiber::READY) {
-            // 用户将状态设置为READY表示希望调度器自动将此任务放入调度队列
-            schedule(task->fiber);
+            // 用户将状态设置为READY表示希望调度器自动将此任务放入调度队列。
+            // 本地队列后进先出，放回去会马上又被取出，所以放到全局队列末尾，让其他任务先执行
+            push_global_task(new Task(std::move(task->fiber)));
           }
+          // 用户创建的协程不放入缓存，它的栈大小可能不够执行其他回调
         }
 
       } else if (task->cb) {  // 是callback
-        auto cb_fiber = std::make_shared<Fiber>(std::move(task->cb));
+        auto cb_fiber = acquire_fiber(fiber_cache, std::move(task->cb));
 
         cb_fiber->enter();
-        --_active_thread_count;
 
         if (cb_fiber->get_state() == Fiber::READY) {
-          schedule(cb_fiber);
+          push_global_task(new Task(std::move(cb_fiber)));
+        } else {
+          release_fiber(fiber_cache, std::move(cb_fiber));
         }
       }
+      delete task;
+      --_active_thread_count;
     } else {
+      --_active_thread_count;
       // 没有拿到任务，则执行idle协程
       if (idle_fiber->get_state() == Fiber::TERMINATED) {
         InfoL << "idle fiber terminated";
@@ -161,11 +312,227 @@ void Scheduler::run() {
   }
 }
 
+int Scheduler::push_task(Task *task) {
+  ++_task_count;
+  if (task->thread_id != -1) {
+    int index = find_worker(task->thread_id);
+    if (LIKELY(index >= 0)) {
+      // 放入目标线程的信箱
+      auto &mailbox = _workers[index]->mailbox;
+      Task *head = mailbox.load(std::memory_order_relaxed);
+      do {
+        task->next = head;
+      } while (!mailbox.compare_exchange_weak(head, task, std::memory_order_release, std::memory_order_relaxed));
+      return index;
+    }
+    ErrorL << "thread " << task->thread_id << " is not a worker of scheduler " << _name;
+    task->thread_id = -1;
+  }
+  ++_stealable_task_count;
+  if (t_scheduler == this && t_worker_index >= 0 && _workers[t_worker_index]->queue.push(task)) {
+    return -1;
+  }
+  MutexType::Lock lock(_task_mutex);
+  _tasks.push_back(task);
+  ++_global_task_count;
+  return -1;
+}
+
+void Scheduler::push_task_list(Task *head, size_t count) {
+  _task_count += count;
+  _stealable_task_count += count;
+  if (t_scheduler == this && t_worker_index >= 0) {
+    auto &queue = _workers[t_worker_index]->queue;
+    while (head) {
+      // 放入队列后任务可能马上被窃取执行，要先取next
+      Task *next = head->next;
+      head->next = nullptr;
+      if (!queue.push(head)) {
+        head->next = next;
+        break;
+      }
+      head = next;
+    }
+    if (!head) {
+      return;
+    }
+  }
+  MutexType::Lock lock(_task_mutex);
+  size_t global_count = 0;
+  while (head) {
+    Task *next = head->next;
+    head->next = nullptr;
+    _tasks.push_back(head);
+    ++global_count;
+    head = next;
+  }
+  _global_task_count += global_count;
+}
+
+void Scheduler::push_inbox(Task *head, Task *tail, size_t count) {
+  ASSERT(t_scheduler == this && t_worker_index >= 0);
+  _task_count += count;
+  auto &worker = *_workers[t_worker_index];
+  if (worker.inbox) {
+    worker.inbox_tail->next = head;
+  } else {
+    worker.inbox = head;
+  }
+  worker.inbox_tail = tail;
+}
+
+void Scheduler::push_global_task(Task *task) {
+  ++_task_count;
+  ++_stealable_task_count;
+  MutexType::Lock lock(_task_mutex);
+  _tasks.push_back(task);
+  ++_global_task_count;
+}
+
+int Scheduler::find_worker(thread_id_t thread_id) const {
+  // 最常见的情况是指定当前线程
+  if (t_scheduler == this && t_worker_index >= 0 && _workers[t_worker_index]->thread_id == thread_id) {
+    return t_worker_index;
+  }
+  for (size_t i = 0; i < _workers.size(); i++) {
+    if (_workers[i]->thread_id == thread_id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+Scheduler::Task *Scheduler::pop_mailbox_task(Worker &worker) {
+  if (!worker.inbox) {
+    // 取走整个信箱，反转成先进先出
+    Task *list = worker.mailbox.exchange(nullptr, std::memory_order_acquire);
+    // 最后放入的任务反转后排在最后
+    worker.inbox_tail = list;
+    while (list) {
+      Task *next = list->next;
+      list->next = worker.inbox;
+      worker.inbox = list;
+      list = next;
+    }
+  }
+  Task *task = worker.inbox;
+  if (task) {
+    worker.inbox = task->next;
+    task->next = nullptr;
+    if (!worker.inbox) {
+      worker.inbox_tail = nullptr;
+    }
+  }
+  return task;
+}
+
+Scheduler::Task *Scheduler::pop_task() {
+  Task *task = nullptr;
+  auto &worker = *_workers[t_worker_index];
+  if (worker.inbox || worker.mailbox.load(std::memory_order_relaxed)) {
+    task = pop_mailbox_task(worker);
+  }
+  if (task) {
+    --_task_count;
+    return task;
+  }
+  // 本地队列是后进先出的，定期先检查全局队列，防止全局队列里的任务饿死
+  if (++t_schedule_tick % 61 == 0) {
+    task = pop_global_task();
+  }
+  if (!task && !worker.queue.pop(task)) {
+    task = pop_global_task();
+  }
+  if (!task) {
+    task = steal_task();
+  }
+  if (task) {
+    --_stealable_task_count;
+    --_task_count;
+  }
+  return task;
+}
+
+bool Scheduler::has_pending_task() const {
+  auto &worker = *_workers[t_worker_index];
+  if (worker.inbox || worker.mailbox.load()) {
+    return true;
+  }
+  if (_global_task_count > 0) {
+    return true;
+  }
+  for (auto &w : _workers) {
+    if (!w->queue.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Scheduler::Task *Scheduler::pop_global_task() {
+  if (_global_task_count == 0) {
+    return nullptr;
+  }
+  MutexType::Lock lock(_task_mutex);
+  if (_tasks.empty()) {
+    return nullptr;
+  }
+  Task *task = _tasks.front();
+  _tasks.pop_front();
+  --_global_task_count;
+  return task;
+}
+
+Scheduler::Task *Scheduler::steal_task() {
+  Task *task = nullptr;
+  size_t n = _workers.size();
+  for (size_t i = 1; i < n; i++) {
+    auto &queue = _workers[(t_worker_index + i) % n]->queue;
+    if (queue.steal(task)) {
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+Fiber::Ptr Scheduler::acquire_fiber(std::vector<Fiber::Ptr> &fiber_cache, Callback &&cb) {
+  if (fiber_cache.empty()) {
+    ++_fiber_cache_misses;
+    return std::make_shared<Fiber>(std::move(cb));
+  }
+  ++_fiber_cache_hits;
+  auto fiber = std::move(fiber_cache.back());
+  fiber_cache.pop_back();
+  fiber->reuse(std::move(cb));
+  return fiber;
+}
+
+void Scheduler::release_fiber(std::vector<Fiber::Ptr> &fiber_cache, Fiber::Ptr &&fiber) {
+  auto state = fiber->get_state();
+  // HOLD状态的协程还会被别人唤醒；有其他引用的协程不能被复用
+  if ((state != Fiber::TERMINATED && state != Fiber::EXCEPT) || fiber.use_count() != 1) {
+    return;
+  }
+  // 缓存中的协程会执行任意回调，只接受默认栈大小的
+  if (fiber->get_stack_size() != Fiber::get_default_stack_size()) {
+    return;
+  }
+  if (fiber_cache.size() < _fiber_cache_size) {
+    fiber_cache.push_back(std::move(fiber));
+  }
+}
+
 void Scheduler::notify() { InfoL << "notify"; }
 
+void Scheduler::notify_worker(size_t index) { notify(); }
+
+int Scheduler::get_worker_index() { return t_worker_index; }
+
+Scheduler::thread_id_t Scheduler::get_worker_thread_id(size_t index) const { return _workers[index]->thread_id; }
+
 bool Scheduler::stopping() {
   MutexType::Lock lock(_mutex);
-  return _auto_stop && _stopping && _tasks.empty() && _active_thread_count == 0;
+  return _auto_stop && _stopping && _task_count == 0 && _active_thread_count == 0;
 }
 
 void Scheduler::idle() {
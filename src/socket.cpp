@@ -5,8 +5,14 @@
 #include "log.h"
 #include "macro.h"
 
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
+#include <algorithm>
 
 namespace fleet {
 Socket::Ptr Socket::create_TCP_Socket(int family) {
@@ -93,16 +99,59 @@ bool Socket::set_option(int level, int option, const void *result, socklen_t len
   return true;
 }
 
+bool Socket::set_reuse_port() {
+  if (!is_valid()) {
+    // 选项要在bind之前设置，先创建socket
+    new_Socket();
+    if (UNLIKELY(!is_valid())) {
+      return false;
+    }
+  }
+  int val = 1;
+  return set_option(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 Socket::Ptr Socket::accept() {
-  Socket::Ptr client_sock(new Socket(_family, _type, _protocol));
-  int raw_client_sock = ::accept(_sock, nullptr, nullptr);
+  int raw_client_sock = ::accept4(_sock, nullptr, nullptr, SOCK_CLOEXEC);
   if (raw_client_sock == -1) {
-    ErrorL << "accept(" << _sock << ") errno=" << errno << " errstr=" << strerror(errno);
+    // 监听socket被其他协程关闭时返回EBADF，不算错误
+    if (errno != EBADF) {
+      ErrorL << "accept(" << _sock << ") errno=" << errno << " errstr=" << strerror(errno);
+    }
     return nullptr;
   }
-  if (client_sock->init(raw_client_sock)) {
+  return create_accepted(raw_client_sock);
+}
+
+size_t Socket::accept_batch(std::vector<Socket::Ptr> &clients, size_t max) {
+  if (max == 0) {
+    return 0;
+  }
+  size_t count = 0;
+  auto client = accept();
+  while (client) {
+    clients.push_back(client);
+    if (++count == max) {
+      break;
+    }
+    int raw_client_sock = ::accept4_nowait(_sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (raw_client_sock == -1) {
+      if (errno != EAGAIN && errno != EBADF) {
+        ErrorL << "accept(" << _sock << ") errno=" << errno << " errstr=" << strerror(errno);
+      }
+      break;
+    }
+    client = create_accepted(raw_client_sock);
+  }
+  return count;
+}
+
+Socket::Ptr Socket::create_accepted(int sock) {
+  Socket::Ptr client_sock(new Socket(_family, _type, _protocol));
+  if (client_sock->init(sock)) {
     return client_sock;
   }
+  ::close(sock);
   return nullptr;
 }
 
@@ -112,8 +161,7 @@ bool Socket::init(int sock) {
     _sock = sock;
     _is_connected = true;
     init_Socket();
-    get_local_Address();
-    get_remote_Address();
+    // 地址在get_local_Address/get_remote_Address第一次调用时再获取，不用的连接省去两次系统调用
     return true;
   }
   return false;
@@ -141,6 +189,8 @@ bool Socket::bind(const Address::Ptr addr) {
     ErrorL << "bind error errrno=" << errno << " errstr=" << strerror(errno);
     return false;
   }
+  // 端口为0时由内核分配，重新获取实际绑定的地址
+  _local_Address = nullptr;
   get_local_Address();
   return true;
 }
@@ -291,6 +341,229 @@ int Socket::recv_from(iovec *buffers, size_t length, Address::Ptr from, int flag
   return -1;
 }
 
+// recv_into和send_buffer每次系统调用最多使用的iovec数，远小于IOV_MAX
+static const size_t s_max_iovecs = 64;
+
+int Socket::recv_into(Buffer &buffer, size_t length, int flags) {
+  if (!is_connected()) {
+    return -1;
+  }
+  iovec iovs[s_max_iovecs];
+  size_t count = buffer.prepare(length, iovs, s_max_iovecs);
+  int n = recv(iovs, count, flags);
+  buffer.commit(n > 0 ? n : 0);
+  return n;
+}
+
+ssize_t Socket::send_buffer(Buffer &buffer, int flags) {
+  if (!is_connected()) {
+    return -1;
+  }
+  ssize_t total = 0;
+  iovec iovs[s_max_iovecs];
+  while (!buffer.empty()) {
+    size_t count = buffer.get_read_iovecs(iovs, s_max_iovecs);
+    int n = send(iovs, count, flags);
+    if (n <= 0) {
+      return -1;
+    }
+    buffer.consume(n);
+    total += n;
+  }
+  return total;
+}
+
+ssize_t Socket::send_file(int fd, off_t offset, size_t length) {
+  if (!is_connected()) {
+    return -1;
+  }
+  size_t total = 0;
+  while (total < length) {
+    ssize_t n = ::sendfile(_sock, fd, &offset, length - total);
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      // 文件已经结束
+      break;
+    }
+    total += n;
+  }
+  return total;
+}
+
+ssize_t Socket::splice_to(Socket &dst, size_t length) {
+  if (!is_connected() || !dst.is_connected()) {
+    return -1;
+  }
+  int pipe_fd[2];
+  if (pipe2(pipe_fd, O_CLOEXEC) == -1) {
+    ErrorL << "pipe2 errno=" << errno << " errstr=" << strerror(errno);
+    return -1;
+  }
+  // 管道的容量，每次最多读入这么多，保证写出前管道不会满
+  static const size_t s_pipe_size = 64 * 1024;
+  ssize_t total = 0;
+  while (static_cast<size_t>(total) < length) {
+    ssize_t n = ::splice(_sock, nullptr, pipe_fd[1], nullptr, std::min(length - total, s_pipe_size),
+                         SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n <= 0) {
+      if (n < 0) {
+        total = -1;
+      }
+      break;
+    }
+    // 读入管道的数据全部写给dst
+    while (n > 0) {
+      ssize_t m = ::splice(pipe_fd[0], nullptr, dst._sock, nullptr, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (m <= 0) {
+        n = -1;
+        break;
+      }
+      n -= m;
+      total += m;
+    }
+    if (n < 0) {
+      total = -1;
+      break;
+    }
+  }
+  ::close(pipe_fd[0]);
+  ::close(pipe_fd[1]);
+  return total;
+}
+
+bool Socket::set_zerocopy(bool flag) {
+  int val = flag;
+  if (!set_option(SOL_SOCKET, SO_ZEROCOPY, val)) {
+    return false;
+  }
+  _zerocopy = flag;
+  return true;
+}
+
+int Socket::send_zerocopy(const void *buffer, size_t length, int flags) {
+  if (!_zerocopy) {
+    return send(buffer, length, flags);
+  }
+  if (!is_connected()) {
+    return -1;
+  }
+  // 顺便取走已经到达的完成通知，避免错误队列堆积
+  if (get_zerocopy_pending()) {
+    reap_zerocopy();
+  }
+  int n = ::send(_sock, buffer, length, flags | MSG_ZEROCOPY);
+  if (n > 0) {
+    // 只有发送了数据的调用才占用一个编号
+    ++_zerocopy_sent;
+  } else if (n < 0 && errno == ENOBUFS) {
+    // 锁定的页超过了optmem的限制，退回普通发送
+    return send(buffer, length, flags);
+  }
+  return n;
+}
+
+// 处理一条错误队列中的消息，返回完成的发送次数，没有消息时返回-1
+static ssize_t read_zerocopy_notification(int sock, int flags, uint64_t &copied) {
+  char control[128];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  // MSG_DONTWAIT时直接调用原函数，hook的recvmsg会挂起协程
+  ssize_t ret = (flags & MSG_DONTWAIT) ? recvmsg_p(sock, &msg, flags | MSG_ERRQUEUE)
+                                       : ::recvmsg(sock, &msg, flags | MSG_ERRQUEUE);
+  if (ret < 0) {
+    return -1;
+  }
+  size_t completed = 0;
+  for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+          (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+      continue;
+    }
+    auto err = reinterpret_cast<sock_extended_err *>(CMSG_DATA(cm));
+    if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+      continue;
+    }
+    // [ee_info, ee_data]是完成的发送编号
+    uint32_t count = err->ee_data - err->ee_info + 1;
+    completed += count;
+    if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+      copied += count;
+    }
+  }
+  return completed;
+}
+
+size_t Socket::reap_zerocopy() {
+  size_t total = 0;
+  ssize_t n;
+  while ((n = read_zerocopy_notification(_sock, MSG_DONTWAIT, _zerocopy_copied)) >= 0) {
+    total += n;
+  }
+  _zerocopy_completed += total;
+  return total;
+}
+
+bool Socket::wait_zerocopy() {
+  reap_zerocopy();
+  if (!get_zerocopy_pending()) {
+    return true;
+  }
+  uint64_t to = static_cast<uint64_t>(get_recv_timeout());
+  auto iom = IOManager::s_get_this();
+  FdCtx::Ptr ctx = FdManager::Instance().get_FdCtx(_sock);
+  if (!iom || !ctx) {
+    // 不在IOManager中时阻塞在poll上，只关注POLLERR
+    while (get_zerocopy_pending()) {
+      pollfd pfd;
+      pfd.fd = _sock;
+      pfd.events = 0;
+      int rt = poll(&pfd, 1, to == UINT64_MAX ? -1 : static_cast<int>(to));
+      if (rt == 0 || (rt < 0 && errno != EINTR)) {
+        ErrorL << "wait zerocopy sock=" << _sock << " errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+      }
+      reap_zerocopy();
+    }
+    return true;
+  }
+
+  // 完成通知放在错误队列中，到达时epoll报告EPOLLERR，由ERROR事件唤醒
+  Timer::Ptr timer;
+  auto is_timeout = std::make_shared<bool>(false);
+  if (to != UINT64_MAX) {
+    int sock = _sock;
+    timer = iom->add_timer(to, [iom, sock, is_timeout]() {
+      *is_timeout = true;
+      iom->del_event(sock, IOManager::ERROR, true);
+    });
+  }
+  while (get_zerocopy_pending()) {
+    if (*is_timeout || ctx->is_close()) {
+      ErrorL << "wait zerocopy sock=" << _sock << (*is_timeout ? " timeout" : " closed");
+      break;
+    }
+    // 注册时错误队列已经有消息epoll也会报告，不会漏掉注册前到达的通知
+    if (iom->add_event(_sock, IOManager::ERROR)) {
+      ErrorL << "wait zerocopy sock=" << _sock << " add_event error";
+      break;
+    }
+    if (UNLIKELY(ctx->is_close())) {
+      // 注册前socket已经被close，close中的del_and_trigger_all可能没看到这次注册
+      iom->del_event(_sock, IOManager::ERROR, true);
+    }
+    Fiber::yield_to_hold();
+    reap_zerocopy();
+  }
+  if (timer) {
+    timer->cancel();
+  }
+  return get_zerocopy_pending() == 0;
+}
+
 Address::Ptr Socket::get_remote_Address() {
   if (_remote_Address) {
     return _remote_Address;
@@ -0,0 +1,210 @@
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+#include "stack_allocator.h"
+#include "log.h"
+#include "macro.h"
+
+namespace fleet {
+
+static StackAllocator *s_default_allocator = nullptr;
+
+StackAllocator *StackAllocator::s_get_default() {
+  if (!s_default_allocator) {
+    s_default_allocator = &PooledStackAllocator::Instance();
+  }
+  return s_default_allocator;
+}
+
+void StackAllocator::s_set_default(StackAllocator *allocator) { s_default_allocator = allocator; }
+
+/*******************MallocStackAllocator*******************/
+void *MallocStackAllocator::alloc(size_t size) { return malloc(size); }
+
+void MallocStackAllocator::dealloc(void *sp, size_t size) { free(sp); }
+
+/*******************MmapStackAllocator*******************/
+size_t MmapStackAllocator::page_size() {
+  static size_t s_page_size = sysconf(_SC_PAGESIZE);
+  return s_page_size;
+}
+
+size_t MmapStackAllocator::round_to_page(size_t size) {
+  size_t page = page_size();
+  return (size + page - 1) / page * page;
+}
+
+void *MmapStackAllocator::alloc(size_t size) {
+  size_t page = page_size();
+  size = round_to_page(size);
+  // 多分配一页作为保护页
+  void *base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    ErrorL << "mmap stack failed, size = " << size << " errno = " << errno << " errstr = " << strerror(errno);
+    return nullptr;
+  }
+  // 栈向低地址增长，所以保护页放在最低端
+  if (mprotect(base, page, PROT_NONE)) {
+    ErrorL << "mprotect guard page failed, errno = " << errno << " errstr = " << strerror(errno);
+    munmap(base, size + page);
+    return nullptr;
+  }
+  return static_cast<char *>(base) + page;
+}
+
+void MmapStackAllocator::dealloc(void *sp, size_t size) {
+  if (!sp) {
+    return;
+  }
+  size_t page = page_size();
+  munmap(static_cast<char *>(sp) - page, round_to_page(size) + page);
+}
+
+/*******************PooledStackAllocator*******************/
+struct PooledStackAllocator::ThreadCache {
+  // 每个档位一个空闲链表
+  std::vector<std::vector<void *>> free_lists;
+  PooledStackAllocator *owner = nullptr;
+
+  ~ThreadCache();
+};
+
+// 线程本地缓存是否已经析构，trivial类型，线程退出时也能安全访问
+static thread_local bool t_cache_destroyed = false;
+
+PooledStackAllocator::ThreadCache::~ThreadCache() {
+  t_cache_destroyed = true;
+  if (!owner) {
+    return;
+  }
+  MmapStackAllocator mmap_allocator;
+  for (size_t i = 0; i < free_lists.size() && i < owner->_size_classes.size(); i++) {
+    for (auto sp : free_lists[i]) {
+      mmap_allocator.dealloc(sp, owner->_size_classes[i]);
+      --owner->_pooled;
+    }
+  }
+}
+
+PooledStackAllocator &PooledStackAllocator::Instance() {
+  static PooledStackAllocator instance;
+  return instance;
+}
+
+PooledStackAllocator::PooledStackAllocator() {
+  set_size_classes({32 * 1024, 64 * 1024, 128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024});
+}
+
+void PooledStackAllocator::set_size_classes(const std::vector<size_t> &size_classes) {
+  std::vector<size_t> classes;
+  for (auto size : size_classes) {
+    classes.push_back(MmapStackAllocator::round_to_page(size));
+  }
+  std::sort(classes.begin(), classes.end());
+  classes.erase(std::unique(classes.begin(), classes.end()), classes.end());
+  _size_classes.swap(classes);
+}
+
+int PooledStackAllocator::size_class_index(size_t size) const {
+  auto it = std::lower_bound(_size_classes.begin(), _size_classes.end(), size);
+  if (it == _size_classes.end()) {
+    return -1;
+  }
+  return it - _size_classes.begin();
+}
+
+PooledStackAllocator::ThreadCache *PooledStackAllocator::get_thread_cache() {
+  if (t_cache_destroyed) {
+    return nullptr;
+  }
+  static thread_local ThreadCache t_cache;
+  return &t_cache;
+}
+
+void *PooledStackAllocator::alloc(size_t size) {
+  MmapStackAllocator mmap_allocator;
+  ++_allocated;
+  ++_live;
+
+  int idx = size_class_index(MmapStackAllocator::round_to_page(size));
+  if (idx < 0) {
+    // 超过最大档位，不缓存
+    ++_mapped;
+    void *sp = mmap_allocator.alloc(size);
+    if (UNLIKELY(!sp)) {
+      --_live;
+    }
+    return sp;
+  }
+
+  auto cache = get_thread_cache();
+  if (cache) {
+    cache->owner = this;
+    if (cache->free_lists.size() <= static_cast<size_t>(idx)) {
+      cache->free_lists.resize(_size_classes.size());
+    }
+    auto &free_list = cache->free_lists[idx];
+    if (!free_list.empty()) {
+      // 命中缓存
+      void *sp = free_list.back();
+      free_list.pop_back();
+      --_pooled;
+      return sp;
+    }
+  }
+
+  ++_mapped;
+  void *sp = mmap_allocator.alloc(_size_classes[idx]);
+  if (UNLIKELY(!sp)) {
+    --_live;
+  }
+  return sp;
+}
+
+void PooledStackAllocator::dealloc(void *sp, size_t size) {
+  if (!sp) {
+    return;
+  }
+  MmapStackAllocator mmap_allocator;
+  ++_returned;
+  --_live;
+
+  int idx = size_class_index(MmapStackAllocator::round_to_page(size));
+  if (idx < 0) {
+    mmap_allocator.dealloc(sp, size);
+    return;
+  }
+
+  auto cache = get_thread_cache();
+  if (cache) {
+    cache->owner = this;
+    if (cache->free_lists.size() <= static_cast<size_t>(idx)) {
+      cache->free_lists.resize(_size_classes.size());
+    }
+    auto &free_list = cache->free_lists[idx];
+    if (free_list.size() < _max_pooled) {
+      // 放回当前线程的空闲链表，不管是哪个线程分配的
+      free_list.push_back(sp);
+      ++_pooled;
+      return;
+    }
+  }
+  // 超过上限或线程已经退出，直接还给系统
+  mmap_allocator.dealloc(sp, _size_classes[idx]);
+}
+
+PooledStackAllocator::Stats PooledStackAllocator::get_stats() const {
+  Stats stats;
+  stats.live = _live;
+  stats.pooled = _pooled;
+  stats.allocated = _allocated;
+  stats.returned = _returned;
+  stats.mapped = _mapped;
+  return stats;
+}
+}  // namespace fleet
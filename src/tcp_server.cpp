@@ -1,4 +1,7 @@
 #include "tcp_server.h"
+#include <linux/filter.h>
+#include <sys/socket.h>
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <sstream>
@@ -6,12 +9,15 @@
 
 #include "log.h"
 #include "socket.h"
+#include "utils.h"
 
 namespace fleet {
 TCPServer::TCPServer(uint64_t recv_timeout, IOManager *io_worker, IOManager *accept_worker)
     : _io_worker(io_worker), _accept_worker(accept_worker), _recv_timeout(recv_timeout) {}
 
-TCPServer::~TCPServer() { stop(); }
+// accept循环持有shared_ptr，析构时它们已经结束，监听socket由Socket的析构函数关闭。
+// 析构函数中不能调用stop()，shared_from_this()会抛出bad_weak_ptr
+TCPServer::~TCPServer() { _is_running = false; }
 
 bool TCPServer::bind(Address::Ptr addr) {
   std::vector<Address::Ptr> addrs;
@@ -22,6 +28,12 @@ bool TCPServer::bind(Address::Ptr addr) {
 
 bool TCPServer::bind(const std::vector<Address::Ptr> &addrs, std::vector<Address::Ptr> &fails) {
   for (auto &addr : addrs) {
+    if (_sharded_accept) {
+      if (!bind_sharded(addr)) {
+        fails.push_back(addr);
+      }
+      continue;
+    }
     // 根据Address创建Socket
     auto sock = Socket::create_TCP_Socket(addr->get_family());
     if (!sock->bind(addr)) {
@@ -37,6 +49,7 @@ bool TCPServer::bind(const std::vector<Address::Ptr> &addrs, std::vector<Address
       continue;
     }
     _socks.push_back(sock);
+    _sock_shards.push_back(-1);
   }
 
   if (!fails.empty()) {
@@ -49,40 +62,235 @@ bool TCPServer::bind(const std::vector<Address::Ptr> &addrs, std::vector<Address
 
   return true;
 }
+bool TCPServer::bind_sharded(Address::Ptr addr) {
+  size_t shards = _io_worker->get_thread_count();
+  std::vector<Socket::Ptr> group;
+  for (size_t i = 0; i < shards; i++) {
+    auto sock = Socket::create_TCP_Socket(addr->get_family());
+    // 端口为0时第一个socket分到的端口给其他socket使用
+    auto bind_addr = group.empty() ? addr : group.front()->get_local_Address();
+    if (!sock->set_reuse_port() || !sock->bind(bind_addr) || !sock->listen()) {
+      ErrorL << "sharded bind fails errno = " << errno << " errstr = " << strerror(errno) << " addr = ["
+             << addr->to_string() << "] shard = " << i;
+      return false;
+    }
+    // 监听socket的事件由所属的工作线程处理，常驻模式下hook的socket()已经把它注册到了创建线程的reactor
+    if (!_io_worker->assign_reactor(sock->get_socket(), i)) {
+      ErrorL << "sharded bind fails to assign reactor, addr = [" << addr->to_string() << "] shard = " << i;
+      return false;
+    }
+    group.push_back(sock);
+  }
+
+  if (_random_balance && shards > 1) {
+    // 返回值是新连接分给的socket在组内的序号，组内按listen的顺序排列
+    sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_RANDOM)},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(shards)},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (!group.front()->set_option(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, prog)) {
+      WarnL << "attach reuseport cbpf fails errno = " << errno << " errstr = " << strerror(errno)
+            << ", fall back to hash";
+    }
+  }
+
+  for (size_t i = 0; i < shards; i++) {
+    _socks.push_back(group[i]);
+    _sock_shards.push_back(i);
+  }
+  return true;
+}
+
 void TCPServer::start() {
   if (_is_running) {
     // 已经处于运行状态了
   }
   _is_running = true;  // 设置成非停止状态
-  for (auto &sock : _socks) {
-    _accept_worker->schedule(std::bind(&TCPServer::start_accept, shared_from_this(), sock));
+  for (size_t i = 0; i < _socks.size(); i++) {
+    auto accept_loop = std::bind(&TCPServer::start_accept, shared_from_this(), _socks[i]);
+    if (_sock_shards[i] >= 0) {
+      // 分片的accept循环放到所属的工作线程上
+      _io_worker->schedule(accept_loop, _io_worker->get_worker_thread_id(_sock_shards[i]));
+    } else {
+      _accept_worker->schedule(accept_loop);
+    }
   }
 }
 void TCPServer::stop() {
   _is_running = false;
+  // 暂停的accept循环醒来后看到_is_running为false而结束
+  resume_accept();
   auto self = shared_from_this();
-  _accept_worker->schedule([this, self]() {
-    // lambda表达式复制了一份self，所以在本lambda结束前this不会析构
-    for (auto &sock : _socks) {
-      sock->cancel_all();
-    }
-  });
+  // 分片的监听socket注册在io_worker中，要在io_worker的线程中取消
+  auto cancel = [this, self](IOManager *worker) {
+    worker->schedule([this, self, worker]() {
+      // lambda表达式复制了一份self，所以在本lambda结束前this不会析构
+      for (size_t i = 0; i < _socks.size(); i++) {
+        if ((_sock_shards[i] >= 0 ? _io_worker : _accept_worker) == worker) {
+          // 只取消的话accept会重试并再次注册事件，关闭后阻塞在accept上的协程返回EBADF，accept循环结束
+          _socks[i]->cancel_all();
+          _socks[i]->close();
+        }
+      }
+    });
+  };
+  cancel(_accept_worker);
+  if (_io_worker != _accept_worker) {
+    cancel(_io_worker);
+  }
 }
 
 // 继承重写相关业务
 void TCPServer::handle_client(Socket::Ptr client) { InfoL << "handle_client: " << *client; }
 
 void TCPServer::start_accept(Socket::Ptr sock) {
+  // 分片accept时连接留在监听socket所属的工作线程，accept协程被唤醒后可能被其他线程窃取，不能用当前线程
+  int shard = -1;
+  for (size_t i = 0; i < _socks.size(); i++) {
+    if (_socks[i] == sock) {
+      shard = _sock_shards[i];
+    }
+  }
+  std::vector<Socket::Ptr> clients;
+  clients.reserve(_max_accepts_per_loop);
   while (_is_running) {
-    auto client = sock->accept();
-    if (client) {
+    wait_for_capacity();
+    if (!_is_running) {
+      break;
+    }
+    size_t max_accepts = _max_accepts_per_loop;
+    if (_max_connections) {
+      // 不要一次接受超过上限的连接
+      size_t count = _connection_count;
+      max_accepts = std::min(max_accepts, count < _max_connections ? _max_connections - count : 1);
+    }
+    clients.clear();
+    if (sock->accept_batch(clients, max_accepts) == 0) {
+      if (_is_running) {
+        ErrorL << "accept errno = " << errno << " errstr = " << strerror(errno);
+      }
+      continue;
+    }
+    for (auto &client : clients) {
+      size_t count = ++_connection_count;
+      if (_max_connections && count > _max_connections) {
+        // 多个accept循环同时通过了检查，超出上限的连接直接关闭
+        --_connection_count;
+        ++_rejected_count;
+        client->close();
+        continue;
+      }
+      ++_accepted_count;
       client->set_recv_timeout(_recv_timeout);
-      _io_worker->schedule(std::bind(&TCPServer::handle_client, shared_from_this(), client));
-    } else {
-      ErrorL << "accept errno = " << errno << " errstr = " << strerror(errno);
+      if (shard >= 0) {
+        // accept时分给了fd最少的reactor，改为所属线程
+        if (!_io_worker->assign_reactor(client->get_socket(), shard)) {
+          WarnL << "assign reactor fails, client stays on its reactor: " << *client;
+        }
+        _io_worker->schedule(std::bind(&TCPServer::serve_client, shared_from_this(), client),
+                             _io_worker->get_worker_thread_id(shard));
+      } else {
+        _io_worker->schedule(std::bind(&TCPServer::serve_client, shared_from_this(), client));
+      }
+    }
+    if (clients.size() == max_accepts) {
+      // 可能还有连接在排队，先让同一线程上的其他协程执行
+      Fiber::yield_to_ready();
     }
   }
 }
+
+void TCPServer::serve_client(Socket::Ptr client) {
+  handle_client(client);
+  --_connection_count;
+  if (_paused_fiber_count > 0 && !is_overloaded(true)) {
+    resume_accept();
+  }
+}
+
+bool TCPServer::is_overloaded(bool paused) const {
+  double ratio = paused ? _resume_ratio : 1.0;
+  if (_max_connections) {
+    size_t count = _connection_count;
+    if (paused ? count > _max_connections * ratio : count >= _max_connections) {
+      return true;
+    }
+  }
+  if (_max_pending_tasks) {
+    size_t tasks = _io_worker->get_task_count();
+    if (paused ? tasks > _max_pending_tasks * ratio : tasks >= _max_pending_tasks) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TCPServer::wait_for_capacity() {
+  if (!is_overloaded(false)) {
+    return;
+  }
+  // 暂停期间不调用accept，监听socket不会注册到epoll中，新连接留在内核的backlog里
+  ++_pause_count;
+  uint64_t begin = get_elapsed_us();
+  std::weak_ptr<TCPServer> weak_self = shared_from_this();
+  do {
+    {
+      Mutex::Lock lock(_pause_mutex);
+      _paused_fibers.push_back({IOManager::s_get_this(), Fiber::s_get_this(), get_thread_id()});
+      ++_paused_fiber_count;
+    }
+    // 加入等待列表后再检查一次，检查和加入之间结束的连接可能没有看到本协程
+    if (!is_overloaded(true)) {
+      resume_accept();
+    }
+    Timer::Ptr timer;
+    if (_max_pending_tasks) {
+      // 任务数减少时没有通知，定时检查直到恢复
+      timer = IOManager::s_get_this()->add_timer(
+          1,
+          [weak_self]() {
+            auto self = weak_self.lock();
+            if (self && !self->is_overloaded(true)) {
+              self->resume_accept();
+            }
+          },
+          true);
+    }
+    Fiber::yield_to_hold();
+    if (timer) {
+      timer->cancel();
+    }
+  } while (_is_running && is_overloaded(true));
+  _paused_us += get_elapsed_us() - begin;
+}
+
+void TCPServer::resume_accept() {
+  std::vector<PausedAccept> paused;
+  {
+    Mutex::Lock lock(_pause_mutex);
+    paused.swap(_paused_fibers);
+    _paused_fiber_count = 0;
+  }
+  for (auto &accept : paused) {
+    // 协程可能还没有切出，调度器会等它切出后再执行
+    accept.iom->schedule(accept.fiber, accept.thread_id);
+  }
+}
+
+TCPServer::Stats TCPServer::get_stats() const {
+  Stats stats;
+  stats.connections = _connection_count;
+  stats.accepted = _accepted_count;
+  stats.rejected = _rejected_count;
+  stats.pauses = _pause_count;
+  stats.paused_us = _paused_us;
+  return stats;
+}
+
 std::string TCPServer::to_string(const std::string &prefix) {
   std::stringstream ss;
   ss << prefix << "[type = " << _type << " name = " << _name
@@ -1,73 +1,73 @@
+#include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <iterator>
 #include <memory>
 #include <vector>
 
 #include "timer.h"
+#include "timer_queue.h"
 #include "utils.h"
 
 namespace fleet {
-Timer::Timer(uint64_t period, std::function<void()> cb, bool repeat, TimerManager *manager)
-    : _repeat(repeat), _period(period), _cb(cb), _manager(manager) {
-  _next = _period + get_elapsed_ms();
+Timer::Timer(uint64_t period_us, std::function<void()> cb, bool repeat, TimerManager *manager)
+    : _repeat(repeat), _period(period_us), _cb(cb), _manager(manager) {
+  _next = _period + get_elapsed_us();
 }
 
 Timer::Timer(uint64_t next) : _next(next) {}
 
 bool Timer::cancel() {
   // 加锁
-  TimerManager::RWMutexType::WriteLock lock(_manager->_timer_list_mutex);
+  auto &shard = *_manager->_shards[_shard];
+  TimerManager::RWMutexType::WriteLock lock(shard.mutex);
   if (_cb) {
     _cb = nullptr;
-    auto it = _manager->_timers.find(shared_from_this());
-    if (it != _manager->_timers.end()) {
-      _manager->_timers.erase(it);
-      return true;
-    }
+    return shard.queue->erase(shared_from_this());
   }
   return false;
 }
 
 bool Timer::refresh() {
-  TimerManager::RWMutexType::WriteLock lock(_manager->_timer_list_mutex);
+  auto &shard = *_manager->_shards[_shard];
+  TimerManager::RWMutexType::WriteLock lock(shard.mutex);
   if (!_cb) {
     // 没有回调直接返回
     return false;
   }
-  auto it = _manager->_timers.find(shared_from_this());
-  if (it == _manager->_timers.end()) {
+  // 删掉后重新插入才能保证有序
+  if (!shard.queue->erase(shared_from_this())) {
     return false;
   }
-  // 删掉后重新插入才能保证_timers有序
-  _manager->_timers.erase(it);
-  _next = _period + get_elapsed_ms();
-  _manager->_timers.insert(shared_from_this());
+  _next = _period + get_elapsed_us();
+  shard.queue->insert(shared_from_this());
   return true;
 }
 
-bool Timer::reset(uint64_t period, bool from_now) {
+bool Timer::reset(uint64_t period, bool from_now) { return reset_us(period * 1000, from_now); }
+
+bool Timer::reset_us(uint64_t period, bool from_now) {
   if (period == _period && !from_now) {
     // 不需要处理
     return true;
   }
 
-  TimerManager::RWMutexType::WriteLock lock(_manager->_timer_list_mutex);
+  auto &shard = *_manager->_shards[_shard];
+  TimerManager::RWMutexType::WriteLock lock(shard.mutex);
   if (!_cb) {
     // 没有cb也不用处理
     return false;
   }
-  auto it = _manager->_timers.find(shared_from_this());
-  if (it == _manager->_timers.end()) {
+  if (!shard.queue->erase(shared_from_this())) {
     // 找不到对应的Timer，直接return
     return false;
   }
 
-  _manager->_timers.erase(it);
   // 修改周期
   if (from_now) {
     // from_now 会修改起始时间
     _period = period;
-    _next = get_elapsed_ms() + _period;
+    _next = get_elapsed_us() + _period;
   } else {
     // !from_now则不会
     _next += period - _period;
@@ -78,14 +78,32 @@ bool Timer::reset(uint64_t period, bool from_now) {
   return true;
 }
 
-TimerManager::TimerManager() {}
+TimerManager::TimerManager(TimerBackend backend, size_t shards) : _backend(backend) {
+  if (shards == 0) {
+    shards = 1;
+  }
+  for (size_t i = 0; i < shards; i++) {
+    std::unique_ptr<Shard> shard(new Shard);
+    if (_backend == TimerBackend::WHEEL) {
+      shard->queue.reset(new TimingWheel(get_elapsed_us()));
+    } else {
+      shard->queue.reset(new TimerSet);
+    }
+    _shards.push_back(std::move(shard));
+  }
+}
 
 TimerManager::~TimerManager() {}
 
 Timer::Ptr TimerManager::add_timer(uint64_t ms, std::function<void()> cb, bool repeat) {
-  Timer::Ptr timer(new Timer(ms, cb, repeat, this));
+  return add_timer_us(ms * 1000, std::move(cb), repeat);
+}
+
+Timer::Ptr TimerManager::add_timer_us(uint64_t us, std::function<void()> cb, bool repeat) {
+  Timer::Ptr timer(new Timer(us, std::move(cb), repeat, this));
+  timer->_shard = select_timer_shard() % _shards.size();
 
-  RWMutexType::WriteLock lock(_timer_list_mutex);
+  RWMutexType::WriteLock lock(_shards[timer->_shard]->mutex);
   // 传lock进去是为了提前释放_mutex，减少加锁时间
   add_timer(timer, lock);
   return timer;
@@ -94,19 +112,24 @@ Timer::Ptr TimerManager::add_timer(uint64_t ms, std::function<void()> cb, bool r
 // private方法
 void TimerManager::add_timer(Timer::Ptr timer, RWMutexType::WriteLock &lock) {
   // 插入Timer
-  auto it = _timers.insert(timer).first;  // .first是指向插入的元素的迭代器
-  bool at_front = (it == _timers.begin()) && !_tickled;
+  auto &shard = *_shards[timer->_shard];
+  shard.queue->insert(timer);
+  bool at_front = timer->_next < shard.next_deadline;
 
   // 这时候已经可以解锁了
   lock.unlock();
 
-  if (at_front) {
-    _tickled = true;
+  if (at_front && !shard.tickled.exchange(true)) {
     // 触发回调
-    on_timer_inserted_front();
+    on_timer_inserted_front(timer->_shard);
   }
 }
 
+size_t TimerManager::select_timer_shard() {
+  // 同一个线程添加的定时器放在同一个分片，不同线程之间不竞争锁
+  return static_cast<size_t>(get_thread_id());
+}
+
 Timer::Ptr TimerManager::add_condition_timer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond,
                                              bool repeat) {
   return add_timer(
@@ -121,60 +144,89 @@ Timer::Ptr TimerManager::add_condition_timer(uint64_t ms, std::function<void()>
 }
 
 uint64_t TimerManager::get_next_timer() {
-  RWMutexType::ReadLock lock(_timer_list_mutex);
-  _tickled = false;
-  if (_timers.empty()) {
+  uint64_t us = get_next_timer_us();
+  if (us == UINT64_MAX) {
     return UINT64_MAX;
   }
+  return (us + 999) / 1000;
+}
 
-  const Timer::Ptr &next = *_timers.begin();
-  auto now_ms = get_elapsed_ms();
-  if (now_ms >= next->_next) {
-    return 0;  // 有定时器到期了
-  } else {
-    return next->_next - now_ms;  // 返回最早的到期时间
+uint64_t TimerManager::get_next_timer_us() {
+  // 先置为最大，计算期间插入的定时器都会通知，不会被漏掉
+  for (auto &shard : _shards) {
+    reset_deadline(*shard);
+  }
+  uint64_t next = UINT64_MAX;
+  for (auto &shard : _shards) {
+    RWMutexType::ReadLock lock(shard->mutex);
+    next = std::min(next, shard->queue->next_expire());
   }
+  // 等待的是所有分片中最早的，比它晚的插入不用通知
+  for (auto &shard : _shards) {
+    shard->next_deadline = next;
+  }
+  return time_until(next);
 }
 
-std::vector<std::function<void()>> TimerManager::list_expired_cb() {
-  auto now_ms = get_elapsed_ms();
-  RWMutexType::WriteLock lock(_timer_list_mutex);
-  // 没有Timer
-  if (_timers.empty()) {
-    return {};
+uint64_t TimerManager::get_next_timer_us(size_t index) {
+  auto &shard = *_shards[index];
+  reset_deadline(shard);
+  uint64_t next = UINT64_MAX;
+  {
+    RWMutexType::ReadLock lock(shard.mutex);
+    next = shard.queue->next_expire();
   }
-  // 没有超时的
-  if ((*_timers.begin())->_next > now_ms) {
-    return {};
+  shard.next_deadline = next;
+  return time_until(next);
+}
+
+uint64_t TimerManager::time_until(uint64_t next) {
+  if (next == UINT64_MAX) {
+    return UINT64_MAX;
   }
 
-  Timer::Ptr now_timer(new Timer(now_ms));
-  // 获取指向第一个大于等于now_timer的迭代器
-  auto first_greater = _timers.lower_bound(now_timer);
-  // 获取指向第一个大于now_timer的迭代器
-  while (first_greater != _timers.end() && (*first_greater)->_next == now_ms) {
-    first_greater++;
+  auto now_us = get_elapsed_us();
+  if (now_us >= next) {
+    return 0;  // 有定时器到期了
+  } else {
+    return next - now_us;  // 返回最早的到期时间
   }
+}
 
+std::vector<std::function<void()>> TimerManager::list_expired_cb() {
   std::vector<std::function<void()>> cbs;
-  for (auto it = _timers.begin(); it != first_greater;) {
-    auto timer = (*it);
-    // 将cb放入cbs
+  for (size_t i = 0; i < _shards.size(); i++) {
+    auto shard_cbs = list_expired_cb(i);
+    std::move(shard_cbs.begin(), shard_cbs.end(), std::back_inserter(cbs));
+  }
+  return cbs;
+}
+
+std::vector<std::function<void()>> TimerManager::list_expired_cb(size_t index) {
+  auto &shard = *_shards[index];
+  auto now_us = get_elapsed_us();
+  std::vector<std::function<void()>> cbs;
+  std::vector<Timer::Ptr> expired;
+  RWMutexType::WriteLock lock(shard.mutex);
+  shard.queue->pop_expired(now_us, expired);
+  for (auto &timer : expired) {
     cbs.push_back(timer->_cb);
-    // 删除过期Timer
-    it = _timers.erase(it);  // 返回值是被删除的下一个
     if (timer->_repeat) {
       // 将更新后的Timer重新插入
-      timer->_next = now_ms + timer->_period;
-      _timers.insert(timer);
+      timer->_next = now_us + timer->_period;
+      shard.queue->insert(timer);
     }
   }
-
   return cbs;
 }
 
 bool TimerManager::has_timer() {
-  RWMutexType::ReadLock lock(_timer_list_mutex);
-  return !_timers.empty();
+  for (auto &shard : _shards) {
+    RWMutexType::ReadLock lock(shard->mutex);
+    if (!shard->queue->empty()) {
+      return true;
+    }
+  }
+  return false;
 }
-}  // namespace fleet
\ No newline at end of file
+}  // namespace fleet
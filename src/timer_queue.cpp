@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "timer_queue.h"
+
+namespace fleet {
+
+/*******************TimerSet*******************/
+void TimerSet::insert(const Timer::Ptr &timer) { _timers.insert(timer); }
+
+bool TimerSet::erase(const Timer::Ptr &timer) { return _timers.erase(timer) > 0; }
+
+uint64_t TimerSet::next_expire() const {
+  if (_timers.empty()) {
+    return UINT64_MAX;
+  }
+  return (*_timers.begin())->_next;
+}
+
+void TimerSet::pop_expired(uint64_t now, std::vector<Timer::Ptr> &expired) {
+  auto it = _timers.begin();
+  while (it != _timers.end() && (*it)->_next <= now) {
+    expired.push_back(*it);
+    it = _timers.erase(it);  // 返回值是被删除的下一个
+  }
+}
+
+/*******************TimingWheel*******************/
+constexpr int TimingWheel::LEVELS;
+constexpr size_t TimingWheel::ROOT_SIZE;
+constexpr size_t TimingWheel::LEVEL_SIZE;
+
+TimingWheel::TimingWheel(uint64_t now) : _current(now) {}
+
+TimingWheel::~TimingWheel() {
+  // 解除定时器对自己的引用
+  for (int level = 0; level < LEVELS; level++) {
+    Timer **slot = slots(level);
+    for (size_t i = 0; i < slot_count(level); i++) {
+      while (slot[i]) {
+        auto timer = slot[i]->_wheel_hold;
+        unlink(timer.get());
+      }
+    }
+  }
+}
+
+void TimingWheel::insert(const Timer::Ptr &timer) {
+  timer->_wheel_hold = timer;
+  link(timer.get());
+  ++_count;
+}
+
+bool TimingWheel::erase(const Timer::Ptr &timer) {
+  if (!timer->_wheel_slot) {
+    return false;
+  }
+  --_count;
+  auto hold = std::move(timer->_wheel_hold);
+  unlink(timer.get());
+  return true;
+}
+
+void TimingWheel::link(Timer *timer) {
+  // 已经过期的定时器在下一个tick处理
+  uint64_t expire = std::max(timer->_next, _current);
+  uint64_t delta = expire - _current;
+  Timer **slot = nullptr;
+  if (delta < ROOT_SIZE) {
+    slot = &_root[expire & (ROOT_SIZE - 1)];
+  } else {
+    int level = 1;
+    while (level < LEVELS - 1 && delta >= (static_cast<uint64_t>(LEVEL_SIZE) << level_shift(level))) {
+      level++;
+    }
+    uint64_t max_delta = (static_cast<uint64_t>(LEVEL_SIZE) << level_shift(level)) - 1;
+    if (delta > max_delta) {
+      // 超出范围，先放在最高层最远的槽，cascade时再重新计算
+      expire = _current + max_delta;
+    }
+    slot = &_levels[level - 1][(expire >> level_shift(level)) & (LEVEL_SIZE - 1)];
+  }
+  timer->_wheel_slot = slot;
+  timer->_wheel_prev = nullptr;
+  timer->_wheel_next = *slot;
+  if (*slot) {
+    (*slot)->_wheel_prev = timer;
+  }
+  *slot = timer;
+}
+
+void TimingWheel::unlink(Timer *timer) {
+  if (timer->_wheel_prev) {
+    timer->_wheel_prev->_wheel_next = timer->_wheel_next;
+  } else {
+    *timer->_wheel_slot = timer->_wheel_next;
+  }
+  if (timer->_wheel_next) {
+    timer->_wheel_next->_wheel_prev = timer->_wheel_prev;
+  }
+  timer->_wheel_prev = nullptr;
+  timer->_wheel_next = nullptr;
+  timer->_wheel_slot = nullptr;
+  timer->_wheel_hold = nullptr;
+}
+
+uint64_t TimingWheel::next_expire() const {
+  if (_count == 0) {
+    return UINT64_MAX;
+  }
+  uint64_t next = UINT64_MAX;
+  // 第0层的槽与tick一一对应，找到的就是准确的到期时间
+  for (uint64_t tick = _current; tick < _current + ROOT_SIZE; tick++) {
+    if (_root[tick & (ROOT_SIZE - 1)]) {
+      next = tick;
+      break;
+    }
+  }
+  // 高层的槽只能得到cascade的时间，这时还不一定到期，但不会比实际的晚
+  for (int level = 1; level < LEVELS; level++) {
+    int shift = level_shift(level);
+    uint64_t first = (_current + (1ULL << shift) - 1) >> shift;  // 第一个不早于_current的cascade点
+    for (uint64_t m = first; m < first + LEVEL_SIZE && (m << shift) < next; m++) {
+      if (_levels[level - 1][m & (LEVEL_SIZE - 1)]) {
+        next = m << shift;
+        break;
+      }
+    }
+  }
+  return next;
+}
+
+void TimingWheel::pop_expired(uint64_t now, std::vector<Timer::Ptr> &expired) {
+  while (_current <= now) {
+    if (!_root[_current & (ROOT_SIZE - 1)] && (_current & (ROOT_SIZE - 1))) {
+      // 中间没有定时器到期也没有要cascade的槽的tick可以直接跳过
+      uint64_t next = next_expire();
+      if (next > now) {
+        _current = now + 1;
+        break;
+      }
+      _current = std::max(_current, next);
+    }
+    run_tick(_current, expired);
+    _current++;
+  }
+}
+
+void TimingWheel::run_tick(uint64_t tick, std::vector<Timer::Ptr> &expired) {
+  // 低层转完一圈时cascade上一层
+  for (int level = 1; level < LEVELS; level++) {
+    int shift = level_shift(level);
+    if (tick & ((1ULL << shift) - 1)) {
+      break;
+    }
+    cascade(level, (tick >> shift) & (LEVEL_SIZE - 1));
+  }
+  Timer *&slot = _root[tick & (ROOT_SIZE - 1)];
+  while (slot) {
+    Timer *timer = slot;
+    --_count;
+    expired.push_back(std::move(timer->_wheel_hold));
+    unlink(timer);
+  }
+}
+
+void TimingWheel::cascade(int level, size_t index) {
+  Timer *list = _levels[level - 1][index];
+  _levels[level - 1][index] = nullptr;
+  while (list) {
+    Timer *next = list->_wheel_next;
+    link(list);
+    list = next;
+  }
+}
+}  // namespace fleet
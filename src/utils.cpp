@@ -56,4 +56,10 @@ uint64_t get_elapsed_ms() {
   clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
   return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
+
+uint64_t get_elapsed_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 }  // namespace fleet
\ No newline at end of file
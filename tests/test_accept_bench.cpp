@@ -0,0 +1,81 @@
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "address.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "socket.h"
+#include "tcp_server.h"
+
+// 短连接洪峰：对比每轮只accept一个连接和一次唤醒取完所有连接，输出连接数/秒和每个连接的系统调用次数
+static const int THREADS = 2;
+static const int CONNECTIONS = 4000;
+static std::atomic<int> s_finished = {0};
+
+class CloseServer : public fleet::TCPServer {
+ public:
+  CloseServer(fleet::IOManager *iom) : fleet::TCPServer(1000 * 5, iom, iom) {}
+
+  fleet::Address::Ptr get_listen_address() { return _socks.front()->get_local_Address(); }
+
+ protected:
+  void handle_client(fleet::Socket::Ptr client) override {
+    char c = 'x';
+    client->send(&c, 1);
+    client->close();
+  }
+};
+
+static void client(fleet::Address::Ptr addr) {
+  auto sock = fleet::Socket::create_TCP_Socket(addr->get_family());
+  bool ok = sock->connect(addr);
+  ASSERT(ok);
+  char c = 0;
+  int n = sock->recv(&c, 1);
+  ASSERT(n == 1);
+  sock->close();
+  ++s_finished;
+}
+
+void bench(size_t max_accepts) {
+  s_finished = 0;
+  uint64_t syscalls = 0;
+  auto begin = std::chrono::steady_clock::now();
+  {
+    fleet::IOManager iom(THREADS, "accept");
+    iom.schedule([&iom, max_accepts]() {
+      std::shared_ptr<CloseServer> server(new CloseServer(&iom));
+      server->set_max_accepts_per_loop(max_accepts);
+      bool ok = server->bind(fleet::Address::lookup_any_IPAddress("127.0.0.1:0"));
+      ASSERT(ok);
+      server->start();
+
+      auto addr = server->get_listen_address();
+      for (int i = 0; i < CONNECTIONS; i++) {
+        iom.schedule([addr]() { client(addr); });
+      }
+      while (s_finished < CONNECTIONS) {
+        usleep(1000);
+      }
+      server->stop();
+    });
+    iom.stop();
+    syscalls = iom.get_syscall_count();
+  }
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  ASSERT(s_finished == CONNECTIONS);
+  WarnL << "max_accepts_per_loop " << max_accepts << ": " << static_cast<uint64_t>(CONNECTIONS / sec)
+        << " connections/s, " << static_cast<double>(syscalls) / CONNECTIONS << " syscalls/connection";
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  bench(1);
+  bench(64);
+  return 0;
+}
@@ -0,0 +1,149 @@
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "address.h"
+#include "buffer.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "socket.h"
+
+// 链式缓冲区：检查追加、切片共享、丢弃、跨段查找和iovec导出，最后在回环TCP上用recv_into/send_buffer回显
+static const size_t DATA_SIZE = 1024 * 1024;
+
+static std::string make_data(size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<char>('a' + rand() % 26);
+  }
+  return data;
+}
+
+static void test_basic() {
+  std::string data = make_data(100 * 1000);
+  fleet::Buffer buf;
+  // 小块追加，数据应该连续写入内存块
+  for (size_t i = 0; i < data.size(); i += 1000) {
+    buf.append(data.data() + i, 1000);
+  }
+  ASSERT(buf.size() == data.size());
+  ASSERT(buf.to_string() == data);
+  ASSERT(buf.segment_count() <= data.size() / (fleet::Buffer::BLOCK_SIZE - 64) + 1);
+
+  // 切片共享内存块，追加到切片不能覆盖原数据
+  fleet::Buffer slice = buf.slice(30000, 40000);
+  ASSERT(slice.to_string() == data.substr(30000, 40000));
+  size_t live = fleet::Buffer::s_get_live_blocks();
+  fleet::Buffer copy = buf;
+  ASSERT(fleet::Buffer::s_get_live_blocks() == live);
+  copy.append(std::string("tail"));
+  slice.append(std::string("xyz"));
+  ASSERT(buf.to_string() == data);
+  ASSERT(copy.to_string() == data + "tail");
+  ASSERT(slice.to_string() == data.substr(30000, 40000) + "xyz");
+
+  // 跨段查找
+  std::string pattern = data.substr(fleet::Buffer::BLOCK_SIZE - 100, 200);
+  ASSERT(buf.find(pattern) == data.find(pattern));
+  ASSERT(buf.find(pattern, 1) == data.find(pattern, 1));
+  ASSERT(buf.find("0123") == fleet::Buffer::npos);
+  ASSERT(copy.find("tail") == data.size());
+
+  // 丢弃开头之后偏移整体前移
+  buf.consume(12345);
+  ASSERT(buf.size() == data.size() - 12345);
+  char head[16];
+  ASSERT(buf.copy_to(head, sizeof(head)) == sizeof(head));
+  ASSERT(std::string(head, sizeof(head)) == data.substr(12345, sizeof(head)));
+
+  // iovec导出覆盖所有数据
+  iovec iovs[64];
+  size_t count = buf.get_read_iovecs(iovs, 64);
+  std::string joined;
+  for (size_t i = 0; i < count; i++) {
+    joined.append(static_cast<char *>(iovs[i].iov_base), iovs[i].iov_len);
+  }
+  ASSERT(joined == data.substr(12345));
+
+  // prepare/commit
+  fleet::Buffer in;
+  in.append(std::string("head"));
+  count = in.prepare(40000, iovs, 64);
+  size_t filled = 0;
+  for (size_t i = 0; i < count && filled < 30000; i++) {
+    size_t n = std::min(iovs[i].iov_len, 30000 - filled);
+    memcpy(iovs[i].iov_base, data.data() + filled, n);
+    filled += n;
+  }
+  in.commit(filled);
+  ASSERT(in.to_string() == "head" + data.substr(0, 30000));
+  in.append(std::string("end"));
+  ASSERT(in.to_string() == "head" + data.substr(0, 30000) + "end");
+}
+
+static void test_echo(fleet::IOManager &iom) {
+  auto listener = fleet::Socket::create_TCP_Socket4();
+  bool ok = listener->bind(fleet::Address::lookup_any_IPAddress("127.0.0.1:0"));
+  ASSERT(ok);
+  ok = listener->listen();
+  ASSERT(ok);
+  auto client = fleet::Socket::create_TCP_Socket4();
+  ok = client->connect(listener->get_local_Address());
+  ASSERT(ok);
+  auto server = listener->accept();
+  ASSERT(server);
+
+  // 服务端原样回显，收到的数据直接从内存块发回
+  iom.schedule([server]() {
+    fleet::Buffer buf;
+    while (true) {
+      int n = server->recv_into(buf);
+      ASSERT(n >= 0);
+      if (n == 0) {
+        break;
+      }
+      ssize_t sent = server->send_buffer(buf);
+      ASSERT(sent == n);
+      ASSERT(buf.empty());
+    }
+    server->close();
+  });
+
+  std::string data = make_data(DATA_SIZE);
+  iom.schedule([client, &data]() {
+    fleet::Buffer out;
+    out.append(data);
+    ssize_t n = client->send_buffer(out);
+    ASSERT(n == static_cast<ssize_t>(data.size()));
+    shutdown(client->get_socket(), SHUT_WR);
+  });
+
+  fleet::Buffer got;
+  while (true) {
+    int n = client->recv_into(got);
+    ASSERT(n >= 0);
+    if (n == 0) {
+      break;
+    }
+  }
+  ASSERT(got.to_string() == data);
+  WarnL << "echo " << got.size() << " bytes in " << got.segment_count() << " segments";
+  client->close();
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  test_basic();
+  ASSERT(fleet::Buffer::s_get_live_blocks() == 0);
+  {
+    fleet::IOManager iom(2, "buffer");
+    iom.schedule([&iom]() { test_echo(iom); });
+  }
+  ASSERT(fleet::Buffer::s_get_live_blocks() == 0);
+  return 0;
+}
@@ -0,0 +1,97 @@
+#include <ucontext.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+#include "context.h"
+#include "fiber.h"
+#include "log.h"
+
+// 协程切换微基准：每次round-trip包含一次切入和一次切出
+static const uint64_t ROUNDS = 1000000;
+static const size_t STACK_SIZE = 64 * 1024;
+
+static double elapsed_ns(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/*******************Fiber::enter/yield*******************/
+void bench_fiber() {
+  auto fiber = std::make_shared<fleet::Fiber>([]() {
+    while (true) {
+      fleet::Fiber::yield_to_hold();
+    }
+  });
+  fiber->enter();  // 预热
+
+  auto begin = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < ROUNDS; i++) {
+    fiber->enter();
+  }
+  WarnL << "Fiber enter/yield (" << fleet::Context::backend_name() << "): " << elapsed_ns(begin) / ROUNDS
+        << " ns/round-trip";
+  // fiber没有结束，析构时会报错，这里故意泄漏
+  new fleet::Fiber::Ptr(fiber);
+}
+
+/*******************raw ucontext*******************/
+static ucontext_t s_main_uctx;
+static ucontext_t s_uctx;
+
+static void ucontext_entry() {
+  while (true) {
+    swapcontext(&s_uctx, &s_main_uctx);
+  }
+}
+
+void bench_ucontext() {
+  void *stack = malloc(STACK_SIZE);
+  getcontext(&s_uctx);
+  s_uctx.uc_link = nullptr;
+  s_uctx.uc_stack.ss_sp = stack;
+  s_uctx.uc_stack.ss_size = STACK_SIZE;
+  makecontext(&s_uctx, &ucontext_entry, 0);
+  swapcontext(&s_main_uctx, &s_uctx);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < ROUNDS; i++) {
+    swapcontext(&s_main_uctx, &s_uctx);
+  }
+  WarnL << "raw swapcontext: " << elapsed_ns(begin) / ROUNDS << " ns/round-trip";
+  free(stack);
+}
+
+/*******************raw fleet::Context*******************/
+static fleet::Context s_main_ctx;
+static fleet::Context s_ctx;
+
+static void context_entry() {
+  while (true) {
+    s_ctx.swap_to(s_main_ctx);
+  }
+}
+
+void bench_context() {
+  void *stack = malloc(STACK_SIZE);
+  s_ctx.make(stack, STACK_SIZE, &context_entry);
+  s_main_ctx.swap_to(s_ctx);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < ROUNDS; i++) {
+    s_main_ctx.swap_to(s_ctx);
+  }
+  WarnL << "raw fleet::Context (" << fleet::Context::backend_name() << "): " << elapsed_ns(begin) / ROUNDS
+        << " ns/round-trip";
+  free(stack);
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  bench_ucontext();
+  bench_context();
+  bench_fiber();
+  return 0;
+}
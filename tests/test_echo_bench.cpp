@@ -0,0 +1,108 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+// 回环TCP上的echo服务，对比不同IO实现的请求数/秒和每个请求的系统调用次数
+static const int CONNECTIONS = 64;
+static const int ROUNDS = 1000;
+static const size_t MSG_SIZE = 64;
+static std::atomic<int> s_finished = {0};
+
+static void echo(int fd) {
+  char buf[MSG_SIZE];
+  while (true) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    if (write(fd, buf, n) != n) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+static void client(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int rt = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  ASSERT(rt == 0);
+
+  char buf[MSG_SIZE] = {0};
+  for (int i = 0; i < ROUNDS; i++) {
+    ssize_t n = write(fd, buf, sizeof(buf));
+    ASSERT(n == static_cast<ssize_t>(sizeof(buf)));
+    size_t got = 0;
+    while (got < sizeof(buf)) {
+      n = read(fd, buf + got, sizeof(buf) - got);
+      ASSERT(n > 0);
+      got += n;
+    }
+  }
+  close(fd);
+  ++s_finished;
+}
+
+void bench(const char *name, fleet::IOBackend backend, bool persistent) {
+  s_finished = 0;
+  uint64_t syscalls = 0;
+  auto begin = std::chrono::steady_clock::now();
+  {
+    fleet::IOManager iom(2, name, fleet::TimerBackend::SET, backend);
+    iom.set_persistent_mode(persistent);
+    if (iom.get_io_backend() != backend) {
+      WarnL << name << ": backend not supported, running on epoll";
+    }
+    iom.schedule([&iom]() {
+      int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      int rt = bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+      ASSERT(rt == 0);
+      rt = listen(listen_fd, CONNECTIONS);
+      ASSERT(rt == 0);
+      socklen_t len = sizeof(addr);
+      getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+
+      for (int i = 0; i < CONNECTIONS; i++) {
+        uint16_t port = ntohs(addr.sin_port);
+        iom.schedule([port]() { client(port); });
+      }
+      for (int i = 0; i < CONNECTIONS; i++) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        ASSERT(fd >= 0);
+        iom.schedule([fd]() { echo(fd); });
+      }
+      close(listen_fd);
+    });
+    iom.stop();
+    syscalls = iom.get_syscall_count();
+  }
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  ASSERT(s_finished == CONNECTIONS);
+  uint64_t requests = static_cast<uint64_t>(CONNECTIONS) * ROUNDS;
+  WarnL << name << ": " << static_cast<uint64_t>(requests / sec) << " requests/s, "
+        << static_cast<double>(syscalls) / requests << " syscalls/request";
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  bench("epoll", fleet::IOBackend::EPOLL, false);
+  bench("epoll persistent", fleet::IOBackend::EPOLL, true);
+  bench("io_uring", fleet::IOBackend::IO_URING, false);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "fiber.h"
+#include "hook.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+// 反复关闭、重新打开fd，检查旧注册遗留的事件不会触发到复用同一fd的新注册上
+static const int FIBERS = 16;
+static const int ROUNDS = 2000;
+static std::atomic<int> s_stale = {0};
+static std::atomic<int> s_done = {0};
+
+void reuse_loop() {
+  auto iom = fleet::IOManager::s_get_this();
+  for (int i = 0; i < ROUNDS; i++) {
+    // 旧fd：写入数据使其可读，注册后马上删除，事件可能已经被其他线程的epoll_wait取走
+    int fds[2];
+    int rt = pipe2(fds, O_NONBLOCK);
+    ASSERT(rt == 0);
+    // pipe没有被hook管理，直接调用原始的write，不影响线程的hook状态
+    ssize_t n = write_p(fds[1], "x", 1);
+    ASSERT(n == 1);
+    iom->add_event(fds[0], fleet::IOManager::READ, []() {});
+    fleet::Fiber::yield_to_ready();
+    iom->del_event(fds[0], fleet::IOManager::READ, false);
+    close(fds[0]);
+    close(fds[1]);
+
+    // 新fd：大概率复用同样的fd号，没有数据，不应该触发
+    rt = pipe2(fds, O_NONBLOCK);
+    ASSERT(rt == 0);
+    iom->add_event(fds[0], fleet::IOManager::READ, []() { ++s_stale; });
+    fleet::Fiber::yield_to_ready();
+    if (!iom->del_event(fds[0], fleet::IOManager::READ, false)) {
+      // 回调已经被触发，事件已删除
+      ++s_stale;
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+  ++s_done;
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  {
+    fleet::IOManager iom(4, "fd_reuse");
+    for (int i = 0; i < FIBERS; i++) {
+      iom.schedule(reuse_loop);
+    }
+    iom.stop();
+  }
+  WarnL << "rounds = " << FIBERS * ROUNDS << " stale events = " << s_stale;
+  ASSERT(s_done == FIBERS);
+  ASSERT(s_stale == 0);
+  return 0;
+}
@@ -10,6 +10,7 @@
 #include "hook.h"
 #include "iomanager.h"
 #include "log.h"
+#include "utils.h"
 
 void test_sleep() {
   InfoL << "test_sleep begin";
@@ -26,6 +27,23 @@ void test_sleep() {
   });
 }
 
+// 亚毫秒的usleep/nanosleep，统计实际睡眠时间
+void test_usleep() {
+  const int ROUNDS = 100;
+  uint64_t begin = fleet::get_elapsed_us();
+  for (int i = 0; i < ROUNDS; i++) {
+    usleep(500);
+  }
+  InfoL << "usleep(500): " << (fleet::get_elapsed_us() - begin) / ROUNDS << "us";
+
+  timespec req = {0, 1900 * 1000};
+  begin = fleet::get_elapsed_us();
+  for (int i = 0; i < ROUNDS; i++) {
+    nanosleep(&req, nullptr);
+  }
+  InfoL << "nanosleep(1.9ms): " << (fleet::get_elapsed_us() - begin) / ROUNDS << "us";
+}
+
 void test_sock() {
   int sock = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -66,6 +84,7 @@ int main() {
 
   fleet::IOManager iom;
   // iom.schedule(test_sleep);
+  iom.schedule(test_usleep);
   iom.schedule(test_sock);
 
   InfoL << "main end";
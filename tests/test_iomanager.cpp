@@ -60,10 +60,21 @@ void test_io() {
   }
 }
 
+void test_notify() {
+  // 连续schedule的唤醒会被合并，没有线程睡眠时不会写eventfd
+  fleet::IOManager iom(4, "notify");
+  for (int i = 0; i < 1000; i++) {
+    iom.schedule([]() {});
+  }
+  iom.stop();
+  InfoL << "wakeups issued = " << iom.get_wakeups_issued() << " suppressed = " << iom.get_wakeups_suppressed();
+}
+
 int main(int argc, char **argv) {
   LOG_DEFAULT;
   fleet::Logger::Instance().set_async();
-  fleet::IOManager iom(1);
+  test_notify();
 
+  fleet::IOManager iom(1);
   iom.schedule(test_io);
 }
\ No newline at end of file
@@ -1,13 +1,21 @@
 #include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <thread>
 
 #include "log.h"
+#include "macro.h"
+
+static int s_evaluated = 0;
+
+static int side_effect() { return ++s_evaluated; }
 
 int main() {
   LOG_DEFAULT;
-  fleet::Logger::Instance().add_channel(std::make_shared<fleet::FileChannel>());
+  auto file = std::make_shared<fleet::FileChannel>();
+  file->set_sync_policy(fleet::LogSyncPolicy::Interval, 1000);
+  fleet::Logger::Instance().add_channel(file);
   fleet::Logger::Instance().set_async();
   TraceL << "第一条log";
   DebugL << 12.345;
@@ -16,4 +24,21 @@ int main() {
   std::string warn("This is a warning");
   WarnL << warn;
   ErrorL << '!';
+  // 超过LogRecord::INLINE_SIZE的消息
+  InfoL << std::string(300, '-');
+
+  // 不带目录的文件名
+  fleet::LogEventCapture(fleet::Logger::Instance(), fleet::LogLevel::Info, "test_log.cpp", __FUNCTION__, __LINE__)
+      << "file without directory";
+
+  // 低于最低级别的日志不计算参数
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+  const int N = 10 * 1000 * 1000;
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < N; i++) {
+    DebugL << "filtered " << side_effect();
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / N;
+  ASSERT(s_evaluated == 0);
+  WarnL << "filtered DebugL: " << ns << " ns/call";
 }
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include <time.h>
+#include <atomic>
+#include <cstdio>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+
+// 异步日志吞吐：1到16个线程同时写日志，输出每秒写入的日志条数和每条日志在写日志线程上的耗时，对比立即格式化和延迟格式化
+static const int LINES = 200 * 1000;
+
+// 只计数不输出，测的是日志管线本身
+class CountChannel : public fleet::LogChannel {
+ public:
+  void write(const fleet::LogRecord &record) override { ++_count; }
+
+  std::atomic<uint64_t> _count = {0};
+};
+
+static uint64_t thread_cpu_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench(std::shared_ptr<CountChannel> channel, fleet::LogFullPolicy policy, bool deferred, const char *name,
+                  int threads) {
+  // 每轮换一个AsyncWriter，清零丢弃计数
+  fleet::Logger::Instance().set_async(policy);
+  fleet::Logger::Instance().set_deferred(deferred);
+  channel->_count = 0;
+  auto begin = std::chrono::steady_clock::now();
+  // 写日志线程自己的CPU时间，不包括写线程和等待CPU的时间
+  std::atomic<uint64_t> cpu_ns = {0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&cpu_ns]() {
+      uint64_t begin = thread_cpu_ns();
+      for (int i = 0; i < LINES; i++) {
+        InfoL << "bench line " << i << ' ' << 3.14;
+      }
+      cpu_ns += thread_cpu_ns() - begin;
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  double produce = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  uint64_t dropped = fleet::Logger::Instance().get_dropped_count();
+  uint64_t total = static_cast<uint64_t>(threads) * LINES;
+  while (channel->_count + dropped < total) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  printf("%-14s %2d threads: %10.0f lines/s written, %10.0f lines/s produced, %6.0f ns/call, %8lu dropped\n", name,
+         threads, channel->_count / sec, total / produce, static_cast<double>(cpu_ns) / total,
+         static_cast<unsigned long>(dropped));
+}
+
+int main() {
+  auto channel = std::make_shared<CountChannel>();
+  fleet::Logger::Instance().add_channel(channel);
+  for (int threads : {1, 2, 4, 8, 16}) {
+    bench(channel, fleet::LogFullPolicy::Block, false, "block", threads);
+    bench(channel, fleet::LogFullPolicy::Drop, false, "drop", threads);
+    bench(channel, fleet::LogFullPolicy::Sync, false, "sync", threads);
+    bench(channel, fleet::LogFullPolicy::Block, true, "deferred block", threads);
+    bench(channel, fleet::LogFullPolicy::Drop, true, "deferred drop", threads);
+  }
+  // 再加上格式化和写文件，每批日志一次write
+  fleet::Logger::Instance().add_channel(std::make_shared<fleet::FileChannel>("/dev/null"));
+  for (int threads : {1, 4, 16}) {
+    bench(channel, fleet::LogFullPolicy::Block, false, "file", threads);
+    bench(channel, fleet::LogFullPolicy::Block, true, "deferred file", threads);
+  }
+  return 0;
+}
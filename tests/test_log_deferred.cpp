@@ -0,0 +1,105 @@
+#include <unistd.h>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+#include "macro.h"
+
+// 延迟格式化：检查各种类型的参数格式化结果和ostream一致，再把多线程的日志写成二进制文件并解码
+static const int THREADS = 4;
+static const int LINES = 10000;
+
+// 只保存消息部分
+class MessageChannel : public fleet::LogChannel {
+ public:
+  void write(const fleet::LogRecord &record) override {
+    std::ostringstream os;
+    record.write_message(os);
+    _messages.push_back(os.str());
+  }
+
+  std::vector<std::string> _messages;
+};
+
+struct Point {
+  int x;
+  int y;
+};
+
+static std::ostream &operator<<(std::ostream &os, const Point &p) { return os << '(' << p.x << ", " << p.y << ')'; }
+
+static void test_types(std::shared_ptr<MessageChannel> channel) {
+  int i = -42;
+  unsigned u = 42;
+  int64_t big = INT64_MIN;
+  uint64_t ubig = UINT64_MAX;
+  double d = 3.14159265;
+  float f = 2.5f;
+  char c = 'x';
+  int8_t i8 = 65;
+  bool b = true;
+  const char *cs = "c string";
+  std::string str = "std::string";
+  void *ptr = &i;
+  Point point{1, 2};
+  std::string long_str(500, 'L');
+
+#define ARGS i << ' ' << u << ' ' << big << ' ' << ubig << ' ' << d << ' ' << f << c << i8 << b << cs << str << ptr << point
+  std::ostringstream expected;
+  expected << ARGS;
+  InfoL << ARGS;
+  ASSERT(channel->_messages.back() == expected.str());
+
+  // 超过内联空间，参数挪到堆上
+  expected << long_str << ARGS;
+  InfoL << ARGS << long_str << ARGS;
+  ASSERT(channel->_messages.back() == expected.str());
+#undef ARGS
+}
+
+static void test_binary_file() {
+  std::string path = "/tmp/fleet_binary_log_" + std::to_string(getpid());
+  auto channel = std::make_shared<fleet::BinaryFileChannel>(path);
+  fleet::Logger::Instance().add_channel(channel);
+  fleet::Logger::Instance().set_async();
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; t++) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < LINES; i++) {
+        InfoL << "thread " << t << " line " << i;
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  // 换一个AsyncWriter，旧的取完所有日志
+  fleet::Logger::Instance().set_async();
+  channel->flush();
+
+  std::ostringstream text;
+  int64_t count = fleet::BinaryFileChannel::decode(path, text);
+  unlink(path.c_str());
+  ASSERT(count >= THREADS * LINES);
+  std::string decoded = text.str();
+  ASSERT(decoded.find("thread 0 line 0\n") != std::string::npos);
+  ASSERT(decoded.find("thread " + std::to_string(THREADS - 1) + " line " + std::to_string(LINES - 1) + "\n") !=
+         std::string::npos);
+  ASSERT(decoded.find("test_log_deferred.cpp") != std::string::npos);
+}
+
+int main() {
+  auto channel = std::make_shared<MessageChannel>();
+  fleet::Logger::Instance().add_channel(channel);
+  fleet::Logger::Instance().set_deferred(true);
+
+  test_types(channel);
+  test_binary_file();
+  return 0;
+}
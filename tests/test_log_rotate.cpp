@@ -0,0 +1,153 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+#include "macro.h"
+
+// 日志轮转：按大小轮转并在后台压缩、只保留最近几个文件，再按1秒的间隔轮转
+static const size_t MAX_SIZE = 64 * 1024;
+static const size_t MAX_FILES = 3;
+
+static std::vector<std::string> list_dir(const std::string &dir) {
+  std::vector<std::string> names;
+  DIR *d = opendir(dir.c_str());
+  ASSERT(d);
+  while (auto entry = readdir(d)) {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..") {
+      names.push_back(name);
+    }
+  }
+  closedir(d);
+  return names;
+}
+
+static bool ends_with(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void remove_dir(const std::string &dir) {
+  for (auto &name : list_dir(dir)) {
+    unlink((dir + "/" + name).c_str());
+  }
+  rmdir(dir.c_str());
+}
+
+static std::string make_dir() {
+  char tmpl[] = "/tmp/fleet_log_rotate_XXXXXX";
+  ASSERT(mkdtemp(tmpl));
+  return tmpl;
+}
+
+static void test_size(std::shared_ptr<fleet::FileChannel> &channel) {
+  std::string dir = make_dir();
+  fleet::LogRotation rotation;
+  rotation.max_size = MAX_SIZE;
+  rotation.max_files = MAX_FILES;
+  rotation.compress = true;
+  channel = std::make_shared<fleet::FileChannel>(dir + "/app.log", rotation);
+  fleet::Logger::Instance().add_channel(channel);
+
+  std::string payload(200, 'x');
+  for (int i = 0; i < 5000; i++) {
+    InfoL << "line " << i << ' ' << payload;
+  }
+
+  // 后台线程处理完之后，除了正在写的文件只剩MAX_FILES个
+  std::vector<std::string> names;
+  for (int i = 0; i < 100; i++) {
+    names = list_dir(dir);
+    bool done = names.size() == MAX_FILES + 1;
+    for (auto &name : names) {
+      done = done && !ends_with(name, ".tmp");
+    }
+    if (done) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  ASSERT(names.size() == MAX_FILES + 1);
+
+  size_t compressed = 0;
+  for (auto &name : names) {
+    ASSERT(name.compare(0, 4, "app.") == 0);
+    if (!ends_with(name, ".gz")) {
+      ASSERT(ends_with(name, ".log"));
+      continue;
+    }
+    compressed++;
+    int fd = open((dir + "/" + name).c_str(), O_RDONLY);
+    ASSERT(fd >= 0);
+    unsigned char magic[2] = {0, 0};
+    ASSERT(read(fd, magic, 2) == 2);
+    close(fd);
+    ASSERT(magic[0] == 0x1f && magic[1] == 0x8b);
+  }
+  WarnL << "size rotation kept " << names.size() << " files, " << compressed << " compressed";
+  remove_dir(dir);
+}
+
+static void test_interval(std::shared_ptr<fleet::FileChannel> &channel) {
+  std::string dir = make_dir();
+  fleet::LogRotation rotation;
+  rotation.interval_sec = 1;
+  channel = std::make_shared<fleet::FileChannel>(dir + "/interval.log", rotation);
+  fleet::Logger::Instance().add_channel(channel);
+
+  auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(2500);
+  int i = 0;
+  while (std::chrono::steady_clock::now() < end) {
+    InfoL << "tick " << i++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  auto names = list_dir(dir);
+  WarnL << "interval rotation produced " << names.size() << " files";
+  ASSERT(names.size() >= 2);
+  for (auto &name : names) {
+    ASSERT(ends_with(name, ".log"));
+  }
+  remove_dir(dir);
+}
+
+// 重启后之前轮转的文件也计入max_files，不是轮转格式的文件不动
+static void test_restart() {
+  std::string dir = make_dir();
+  const char *old_names[] = {"app.2000-01-01-00_00_01.log.gz", "app.2000-01-01-00_00_00.log",
+                             "app.2000-01-01-00_00_00.1.log.gz", "app.debug.log"};
+  for (auto name : old_names) {
+    int fd = open((dir + "/" + name).c_str(), O_WRONLY | O_CREAT, 0644);
+    ASSERT(fd >= 0);
+    close(fd);
+  }
+  fleet::LogRotation rotation;
+  rotation.max_size = MAX_SIZE;
+  rotation.max_files = 2;
+  {
+    // 析构时等后台线程处理完
+    fleet::FileChannel channel(dir + "/app.log", rotation);
+  }
+  auto names = list_dir(dir);
+  ASSERT(names.size() == 4);
+  for (auto &name : names) {
+    ASSERT(name != "app.2000-01-01-00_00_00.log");
+  }
+  WarnL << "restart kept " << names.size() << " files";
+  remove_dir(dir);
+}
+
+int main() {
+  // channel被Logger持有到进程退出，两次测试用不同的目录
+  std::shared_ptr<fleet::FileChannel> size_channel;
+  std::shared_ptr<fleet::FileChannel> interval_channel;
+  test_size(size_channel);
+  test_interval(interval_channel);
+  test_restart();
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+// 回环TCP上的echo服务，对比共享epoll和每个工作线程一个epoll两种模式，并输出每个reactor的负载
+static const int THREADS = 4;
+static const int CONNECTIONS = 64;
+static const int ROUNDS = 500;
+static const size_t MSG_SIZE = 64;
+static std::atomic<int> s_finished = {0};
+
+static void echo(int fd) {
+  char buf[MSG_SIZE];
+  while (true) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    if (write(fd, buf, n) != n) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+static void client(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int rt = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  ASSERT(rt == 0);
+
+  char buf[MSG_SIZE] = {0};
+  for (int i = 0; i < ROUNDS; i++) {
+    ssize_t n = write(fd, buf, sizeof(buf));
+    ASSERT(n == static_cast<ssize_t>(sizeof(buf)));
+    size_t got = 0;
+    while (got < sizeof(buf)) {
+      n = read(fd, buf + got, sizeof(buf) - got);
+      ASSERT(n > 0);
+      got += n;
+    }
+    if (i % 100 == 0) {
+      // 定时器放在当前线程的分片，由当前线程唤醒
+      usleep(100);
+    }
+  }
+  close(fd);
+  ++s_finished;
+}
+
+void bench(const char *name, fleet::ReactorMode mode) {
+  s_finished = 0;
+  std::vector<fleet::IOManager::ReactorLoad> loads;
+  uint64_t wakeups = 0;
+  auto begin = std::chrono::steady_clock::now();
+  {
+    fleet::IOManager iom(THREADS, name, fleet::TimerBackend::WHEEL, fleet::IOBackend::EPOLL, mode);
+    iom.schedule([&iom]() {
+      int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      int rt = bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+      ASSERT(rt == 0);
+      rt = listen(listen_fd, CONNECTIONS);
+      ASSERT(rt == 0);
+      socklen_t len = sizeof(addr);
+      getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+
+      for (int i = 0; i < CONNECTIONS; i++) {
+        uint16_t port = ntohs(addr.sin_port);
+        iom.schedule([port]() { client(port); });
+      }
+      for (int i = 0; i < CONNECTIONS; i++) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        ASSERT(fd >= 0);
+        iom.schedule([fd]() { echo(fd); });
+      }
+      close(listen_fd);
+    });
+    iom.stop();
+    loads = iom.get_reactor_loads();
+    wakeups = iom.get_wakeups_issued();
+  }
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  ASSERT(s_finished == CONNECTIONS);
+  uint64_t requests = static_cast<uint64_t>(CONNECTIONS) * ROUNDS;
+  std::stringstream ss;
+  for (size_t i = 0; i < loads.size(); i++) {
+    ss << " [" << i << "] events=" << loads[i].events << " timers=" << loads[i].timers;
+  }
+  WarnL << name << ": " << static_cast<uint64_t>(requests / sec) << " requests/s, " << wakeups << " wakeups,"
+        << ss.str();
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  bench("shared", fleet::ReactorMode::SHARED);
+  bench("per_worker", fleet::ReactorMode::PER_WORKER);
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "address.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "socket.h"
+#include "tcp_server.h"
+
+// 过载保护：连接数远超上限时暂停accept，检查同时处理的连接数不超过上限，并输出暂停次数和时长
+static const int THREADS = 2;
+static const int CONNECTIONS = 1000;
+static const size_t MAX_CONNECTIONS = 50;
+static std::atomic<int> s_finished = {0};
+static std::atomic<int> s_active = {0};
+static std::atomic<int> s_peak = {0};
+
+class SlowServer : public fleet::TCPServer {
+ public:
+  SlowServer(fleet::IOManager *iom) : fleet::TCPServer(1000 * 5, iom, iom) {}
+
+  fleet::Address::Ptr get_listen_address() { return _socks.front()->get_local_Address(); }
+
+ protected:
+  void handle_client(fleet::Socket::Ptr client) override {
+    int active = ++s_active;
+    int peak = s_peak;
+    while (active > peak && !s_peak.compare_exchange_weak(peak, active)) {
+    }
+    // 模拟耗时的请求
+    usleep(2 * 1000);
+    char c = 'x';
+    client->send(&c, 1);
+    --s_active;
+    client->close();
+  }
+};
+
+static void client(fleet::Address::Ptr addr) {
+  auto sock = fleet::Socket::create_TCP_Socket(addr->get_family());
+  bool ok = sock->connect(addr);
+  ASSERT(ok);
+  char c = 0;
+  int n = sock->recv(&c, 1);
+  ASSERT(n == 1);
+  sock->close();
+  ++s_finished;
+}
+
+void run(size_t max_connections, size_t max_pending_tasks) {
+  s_finished = 0;
+  s_peak = 0;
+  fleet::TCPServer::Stats stats;
+  auto begin = std::chrono::steady_clock::now();
+  {
+    fleet::IOManager iom(THREADS, "overload");
+    iom.schedule([&iom, &stats, max_connections, max_pending_tasks]() {
+      std::shared_ptr<SlowServer> server(new SlowServer(&iom));
+      server->set_max_connections(max_connections);
+      server->set_max_pending_tasks(max_pending_tasks);
+      bool ok = server->bind(fleet::Address::lookup_any_IPAddress("127.0.0.1:0"));
+      ASSERT(ok);
+      server->start();
+
+      auto addr = server->get_listen_address();
+      for (int i = 0; i < CONNECTIONS; i++) {
+        iom.schedule([addr]() { client(addr); });
+      }
+      while (s_finished < CONNECTIONS) {
+        usleep(1000);
+      }
+      stats = server->get_stats();
+      server->stop();
+    });
+    iom.stop();
+  }
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  ASSERT(s_finished == CONNECTIONS);
+  if (max_connections) {
+    ASSERT(static_cast<size_t>(s_peak) <= max_connections);
+  }
+  WarnL << "max_connections " << max_connections << " max_pending_tasks " << max_pending_tasks << ": "
+        << static_cast<uint64_t>(CONNECTIONS / sec) << " connections/s, peak " << s_peak << ", accepted "
+        << stats.accepted << ", rejected " << stats.rejected << ", pauses " << stats.pauses << ", paused "
+        << stats.paused_us / 1000 << "ms";
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  run(0, 0);
+  run(MAX_CONNECTIONS, 0);
+  run(0, 200);
+  return 0;
+}
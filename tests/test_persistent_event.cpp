@@ -0,0 +1,135 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "hook.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+// 回环TCP上的ping-pong，对比一次性注册和常驻注册两种模式下每次往返的epoll_ctl调用次数
+static const int CONNECTIONS = 8;
+static const int ROUNDS = 5000;
+static const size_t MSG_SIZE = 64;
+static std::atomic<int> s_finished = {0};
+
+static void echo(int fd) {
+  char buf[MSG_SIZE];
+  while (true) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    if (write(fd, buf, n) != n) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+static void client(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int rt = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  ASSERT(rt == 0);
+
+  char buf[MSG_SIZE] = {0};
+  for (int i = 0; i < ROUNDS; i++) {
+    ssize_t n = write(fd, buf, sizeof(buf));
+    ASSERT(n == static_cast<ssize_t>(sizeof(buf)));
+    size_t got = 0;
+    while (got < sizeof(buf)) {
+      n = read(fd, buf + got, sizeof(buf) - got);
+      ASSERT(n > 0);
+      got += n;
+    }
+  }
+  close(fd);
+  ++s_finished;
+}
+
+void bench(bool persistent) {
+  s_finished = 0;
+  uint64_t ctl_count = 0;
+  auto begin = std::chrono::steady_clock::now();
+  {
+    fleet::IOManager iom(2, persistent ? "persistent" : "oneshot");
+    iom.set_persistent_mode(persistent);
+    iom.schedule([&iom]() {
+      int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      int rt = bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+      ASSERT(rt == 0);
+      rt = listen(listen_fd, CONNECTIONS);
+      ASSERT(rt == 0);
+      socklen_t len = sizeof(addr);
+      getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+
+      for (int i = 0; i < CONNECTIONS; i++) {
+        uint16_t port = ntohs(addr.sin_port);
+        iom.schedule([port]() { client(port); });
+      }
+      for (int i = 0; i < CONNECTIONS; i++) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        ASSERT(fd >= 0);
+        iom.schedule([fd]() { echo(fd); });
+      }
+      close(listen_fd);
+    });
+    iom.stop();
+    ctl_count = iom.get_epoll_ctl_count();
+  }
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  ASSERT(s_finished == CONNECTIONS);
+  uint64_t round_trips = static_cast<uint64_t>(CONNECTIONS) * ROUNDS;
+  WarnL << (persistent ? "persistent" : "oneshot") << ": epoll_ctl = " << ctl_count
+        << " (" << static_cast<double>(ctl_count) / round_trips << " per round trip), "
+        << static_cast<uint64_t>(round_trips / sec) << " round trips/s";
+}
+
+// 常驻模式的socket在IOManager之外关闭，fd号被pipe复用后add_event仍然要注册到epoll
+static void test_close_outside() {
+  fleet::IOManager iom(1, "close_outside");
+  iom.set_persistent_mode(true);
+  std::atomic<int> sock = {-1};
+  iom.schedule([&sock]() { sock = socket(AF_INET, SOCK_STREAM, 0); });
+  while (sock < 0) {
+    usleep_p(1000);
+  }
+  close(sock);
+
+  int fds[2];
+  int rt = pipe(fds);
+  ASSERT(rt == 0);
+  ASSERT(fds[0] == sock);
+  std::atomic<bool> woke = {false};
+  rt = iom.add_event(fds[0], fleet::IOManager::READ, [&woke]() { woke = true; });
+  ASSERT(rt == 0);
+  rt = write_p(fds[1], "x", 1);
+  ASSERT(rt == 1);
+  for (int i = 0; i < 1000 && !woke; i++) {
+    usleep_p(1000);
+  }
+  ASSERT(woke);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  bench(false);
+  bench(true);
+  test_close_outside();
+  return 0;
+}
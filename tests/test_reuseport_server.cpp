@@ -0,0 +1,99 @@
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+
+#include "address.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "socket.h"
+#include "tcp_server.h"
+
+// 分片accept：每个工作线程一个SO_REUSEPORT监听socket，统计各线程处理的连接数
+static const int THREADS = 4;
+static const int CONNECTIONS = 400;
+static std::atomic<int> s_handled[THREADS];
+static std::atomic<int> s_finished = {0};
+
+class EchoServer : public fleet::TCPServer {
+ public:
+  EchoServer(fleet::IOManager *iom) : fleet::TCPServer(1000 * 5, iom, iom) {}
+
+  // 端口由内核分配，所有分片的监听socket端口相同
+  fleet::Address::Ptr get_listen_address() { return _socks.front()->get_local_Address(); }
+
+ protected:
+  void handle_client(fleet::Socket::Ptr client) override {
+    ++s_handled[fleet::Scheduler::get_worker_index()];
+    char buf[64];
+    while (true) {
+      int n = client->recv(buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      client->send(buf, n);
+    }
+    client->close();
+  }
+};
+
+static void client(fleet::Address::Ptr addr) {
+  auto sock = fleet::Socket::create_TCP_Socket(addr->get_family());
+  bool ok = sock->connect(addr);
+  ASSERT(ok);
+  char buf[8] = "ping";
+  int n = sock->send(buf, sizeof(buf));
+  ASSERT(n == sizeof(buf));
+  n = sock->recv(buf, sizeof(buf));
+  ASSERT(n == sizeof(buf));
+  sock->close();
+  ++s_finished;
+}
+
+void run(bool random_balance, bool persistent) {
+  for (auto &count : s_handled) {
+    count = 0;
+  }
+  s_finished = 0;
+  {
+    fleet::IOManager iom(THREADS, "reuseport", fleet::TimerBackend::SET, fleet::IOBackend::EPOLL,
+                         fleet::ReactorMode::PER_WORKER);
+    // 常驻模式下监听socket创建时就注册到了当前线程的epoll，分片时要转移到所属线程
+    iom.set_persistent_mode(persistent);
+    iom.schedule([&iom, random_balance]() {
+      std::shared_ptr<EchoServer> server(new EchoServer(&iom));
+      server->set_sharded_accept(true, random_balance);
+      bool ok = server->bind(fleet::Address::lookup_any_IPAddress("127.0.0.1:0"));
+      ASSERT(ok);
+      server->start();
+
+      auto addr = server->get_listen_address();
+      for (int i = 0; i < CONNECTIONS; i++) {
+        iom.schedule([addr]() { client(addr); });
+      }
+      while (s_finished < CONNECTIONS) {
+        usleep(10 * 1000);
+      }
+      server->stop();
+    });
+    iom.stop();
+  }
+  ASSERT(s_finished == CONNECTIONS);
+  std::stringstream ss;
+  for (int i = 0; i < THREADS; i++) {
+    ss << " [" << i << "] " << s_handled[i];
+  }
+  WarnL << (random_balance ? "cbpf random" : "hash") << (persistent ? " persistent" : "") << ": connections per worker"
+        << ss.str();
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  run(false, false);
+  run(true, false);
+  run(false, true);
+  return 0;
+}
@@ -1,8 +1,14 @@
 
 #include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <vector>
 
+#include "fiber.h"
 #include "log.h"
+#include "macro.h"
 #include "scheduler.h"
 #include "utils.h"
 
@@ -16,6 +22,36 @@ void test_fiber() {
   }
 }
 
+// 用户创建的小栈协程结束后不能被缓存复用，否则之后用栈较多的回调会踩到保护页
+void test_custom_stack() {
+  fleet::Scheduler sc(1, "custom_stack");
+  sc.start();
+  sc.schedule(std::make_shared<fleet::Fiber>([]() {}, 16 * 1024));
+  sc.schedule([]() {
+    volatile char buf[64 * 1024];
+    memset(const_cast<char *>(buf), 1, sizeof(buf));
+  });
+  sc.stop();
+}
+
+// 让出执行后本地队列中的其他任务要能执行
+void test_yield_to_ready() {
+  fleet::Scheduler sc(1, "yield");
+  sc.start();
+  std::atomic<bool> done = {false};
+  std::atomic<int> yields = {0};
+  sc.schedule([&done, &yields]() {
+    fleet::Scheduler::s_get_this()->schedule([&done]() { done = true; });
+    while (!done) {
+      ++yields;
+      fleet::Fiber::yield_to_ready();
+    }
+  });
+  sc.stop();
+  ASSERT(done);
+  InfoL << "callback ran after " << yields << " yields";
+}
+
 int main() {
   fleet::Logger::Instance().set_async();
   fleet::Logger::Instance().add_channel(std::make_shared<fleet::FileChannel>());
@@ -28,7 +64,16 @@ int main() {
   sleep(1);
   InfoL << "schedule";
   sc.schedule(test_fiber);
+  for (int i = 0; i < 1000; i++) {
+    sc.schedule([]() {});
+  }
+  // 批量调度只加一次锁
+  std::vector<std::function<void()>> cbs(1000, []() {});
+  sc.schedule_batch(cbs.begin(), cbs.end());
   sc.stop();
+  InfoL << "fiber cache hits = " << sc.get_fiber_cache_hits() << " misses = " << sc.get_fiber_cache_misses();
+  test_custom_stack();
+  test_yield_to_ready();
   InfoL << "over";
   return 0;
 }
@@ -0,0 +1,61 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+// 调度吞吐量基准：统计schedule+执行的任务数/秒
+static const uint64_t TASKS = 400000;
+static const uint64_t PRODUCERS = 100;
+static std::atomic<uint64_t> s_done = {0};
+
+static void count_task() { ++s_done; }
+
+// 外部线程调度任务，走全局队列
+void bench_external(size_t threads) {
+  s_done = 0;
+  auto begin = std::chrono::steady_clock::now();
+  {
+    fleet::IOManager iom(threads, "external");
+    for (uint64_t i = 0; i < TASKS; i++) {
+      iom.schedule(count_task);
+    }
+    iom.stop();
+  }
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  ASSERT(s_done == TASKS);
+  WarnL << "external " << threads << " threads: " << static_cast<uint64_t>(TASKS / sec) << " tasks/s";
+}
+
+// 任务中再调度任务，走工作线程的本地队列，其他线程窃取
+void bench_internal(size_t threads) {
+  s_done = 0;
+  auto begin = std::chrono::steady_clock::now();
+  {
+    fleet::IOManager iom(threads, "internal");
+    for (uint64_t i = 0; i < PRODUCERS; i++) {
+      iom.schedule([&iom]() {
+        for (uint64_t j = 0; j < TASKS / PRODUCERS; j++) {
+          iom.schedule(count_task);
+        }
+      });
+    }
+    iom.stop();
+  }
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  ASSERT(s_done == TASKS);
+  WarnL << "internal " << threads << " threads: " << static_cast<uint64_t>(TASKS / sec) << " tasks/s";
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  for (size_t threads : {1, 4, 16}) {
+    bench_external(threads);
+    bench_internal(threads);
+  }
+  return 0;
+}
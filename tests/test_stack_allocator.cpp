@@ -0,0 +1,78 @@
+#include <memory>
+#include <vector>
+
+#include "fiber.h"
+#include "log.h"
+#include "macro.h"
+#include "stack_allocator.h"
+#include "thread.h"
+
+static void print_stats(const char *tag) {
+  auto stats = fleet::PooledStackAllocator::Instance().get_stats();
+  InfoL << tag << ": live = " << stats.live << " pooled = " << stats.pooled << " allocated = " << stats.allocated
+        << " returned = " << stats.returned << " mapped = " << stats.mapped;
+}
+
+void test_pool() {
+  auto before = fleet::PooledStackAllocator::Instance().get_stats();
+  // 第一轮全部mmap，之后全部命中线程缓存
+  for (int round = 0; round < 3; round++) {
+    std::vector<fleet::Fiber::Ptr> fibers;
+    for (int i = 0; i < 10; i++) {
+      fibers.push_back(std::make_shared<fleet::Fiber>([]() { fleet::Fiber::yield_to_hold(); }));
+    }
+    for (auto &f : fibers) {
+      f->enter();
+      f->enter();
+    }
+    print_stats("after round");
+  }
+  auto stats = fleet::PooledStackAllocator::Instance().get_stats();
+  ASSERT(stats.mapped - before.mapped == 10);
+  ASSERT(stats.pooled - before.pooled == 10);
+}
+
+void test_size_class() {
+  auto &allocator = fleet::PooledStackAllocator::Instance();
+  auto before = allocator.get_stats();
+  // 超过最大档位的栈不进入缓存
+  auto big = std::make_shared<fleet::Fiber>([]() {}, 4 * 1024 * 1024);
+  auto stats = allocator.get_stats();
+  ASSERT(stats.live == before.live + 1);
+  ASSERT(stats.mapped == before.mapped + 1);
+  big->enter();
+  big.reset();
+  print_stats("after big stack");
+  stats = allocator.get_stats();
+  ASSERT(stats.live == before.live);
+  ASSERT(stats.pooled == before.pooled);
+  ASSERT(stats.returned == before.returned + 1);
+
+  // mmap失败时不计入正在使用的栈
+  before = stats;
+  void *sp = allocator.alloc(static_cast<size_t>(1) << 60);
+  ASSERT(!sp);
+  stats = allocator.get_stats();
+  ASSERT(stats.live == before.live);
+  ASSERT(stats.allocated == before.allocated + 1);
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::PooledStackAllocator::Instance().set_max_pooled(16);
+
+  test_pool();
+  test_size_class();
+
+  // 线程退出时会释放自己缓存的栈
+  auto before = fleet::PooledStackAllocator::Instance().get_stats();
+  fleet::Thread th(test_pool, "pool");
+  th.join();
+  print_stats("after thread exit");
+  auto stats = fleet::PooledStackAllocator::Instance().get_stats();
+  ASSERT(stats.live == before.live);
+  ASSERT(stats.pooled == before.pooled);
+  ASSERT(stats.mapped == before.mapped + 10);
+  ASSERT(stats.returned - before.returned == stats.allocated - before.allocated);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "timer.h"
+#include "utils.h"
+
+static const int TIMERS = 2000;
+static std::atomic<int> s_fired = {0};
+static std::atomic<int> s_early = {0};
+static std::atomic<uint64_t> s_max_late = {0};
+
+static void on_fire(uint64_t expect) {
+  uint64_t now = fleet::get_elapsed_ms();
+  if (now < expect) {
+    ++s_early;
+    return;
+  }
+  uint64_t late = now - expect;
+  uint64_t max_late = s_max_late;
+  while (late > max_late && !s_max_late.compare_exchange_weak(max_late, late)) {
+  }
+  ++s_fired;
+}
+
+// 随机超时的定时器，取消其中四分之一，检查不会提前触发、取消的不会触发
+void test_accuracy(fleet::TimerBackend backend) {
+  s_fired = 0;
+  s_early = 0;
+  s_max_late = 0;
+  int cancelled = 0;
+  {
+    fleet::IOManager iom(2, "timer", backend);
+    std::vector<fleet::Timer::Ptr> timers;
+    for (int i = 0; i < TIMERS; i++) {
+      uint64_t ms = rand() % 3000 + 1;
+      uint64_t expect = fleet::get_elapsed_ms() + ms;
+      timers.push_back(iom.add_timer(ms, [expect]() { on_fire(expect); }));
+    }
+    for (int i = 0; i < TIMERS; i += 4) {
+      if (timers[i]->cancel()) {
+        cancelled++;
+      }
+    }
+    iom.stop();
+  }
+  InfoL << (backend == fleet::TimerBackend::WHEEL ? "wheel" : "set") << ": fired = " << s_fired
+        << " cancelled = " << cancelled << " max late = " << s_max_late << "ms";
+  ASSERT(s_early == 0);
+  ASSERT(s_fired + cancelled == TIMERS);
+}
+
+// refresh和reset之后按新的时间触发
+void test_reset(fleet::TimerBackend backend) {
+  fleet::IOManager iom(1, "reset", backend);
+  uint64_t begin = fleet::get_elapsed_ms();
+  auto refreshed = iom.add_timer(
+      300, [begin]() { InfoL << "refreshed timer fired after " << fleet::get_elapsed_ms() - begin << "ms"; });
+  auto reset = iom.add_timer(
+      300, [begin]() { InfoL << "reset timer fired after " << fleet::get_elapsed_ms() - begin << "ms"; });
+  iom.add_timer(200, [refreshed, reset]() {
+    refreshed->refresh();      // 从现在开始再等300ms
+    reset->reset(600, false);  // 从创建时开始600ms
+  });
+  iom.stop();
+}
+
+// 单线程插入再取消，对比两种实现
+void bench_insert_cancel(fleet::TimerBackend backend) {
+  const int N = 100000;
+  fleet::IOManager iom(1, "bench", backend);
+  std::vector<fleet::Timer::Ptr> timers;
+  timers.reserve(N);
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < N; i++) {
+    timers.push_back(iom.add_timer(30000 + i % 1000, []() {}));
+  }
+  for (auto &timer : timers) {
+    timer->cancel();
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+  WarnL << (backend == fleet::TimerBackend::WHEEL ? "wheel" : "set") << " insert+cancel: " << ns / N << " ns/op";
+  iom.stop();
+}
+
+int main() {
+  LOG_DEFAULT;
+
+  test_accuracy(fleet::TimerBackend::SET);
+  test_accuracy(fleet::TimerBackend::WHEEL);
+  test_reset(fleet::TimerBackend::WHEEL);
+
+  bench_insert_cancel(fleet::TimerBackend::SET);
+  bench_insert_cancel(fleet::TimerBackend::WHEEL);
+  return 0;
+}
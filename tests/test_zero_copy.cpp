@@ -0,0 +1,144 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "address.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "socket.h"
+
+// 回环TCP上测试sendfile发送文件、splice代理转发和MSG_ZEROCOPY发送，检查收到的数据
+static const size_t DATA_SIZE = 4 * 1024 * 1024;
+static const size_t CHUNK_SIZE = 64 * 1024;
+
+// 建立一对互相连接的TCP socket
+static void make_pair(fleet::Socket::Ptr &client, fleet::Socket::Ptr &server) {
+  auto listener = fleet::Socket::create_TCP_Socket4();
+  bool ok = listener->bind(fleet::Address::lookup_any_IPAddress("127.0.0.1:0"));
+  ASSERT(ok);
+  ok = listener->listen();
+  ASSERT(ok);
+  client = fleet::Socket::create_TCP_Socket4();
+  ok = client->connect(listener->get_local_Address());
+  ASSERT(ok);
+  server = listener->accept();
+  ASSERT(server);
+}
+
+// 从sock读到对端关闭，检查内容和data一致
+static void recv_all(fleet::Socket::Ptr sock, const std::string &data) {
+  std::string got;
+  std::vector<char> buf(CHUNK_SIZE);
+  while (true) {
+    int n = sock->recv(buf.data(), buf.size());
+    ASSERT(n >= 0);
+    if (n == 0) {
+      break;
+    }
+    got.append(buf.data(), n);
+  }
+  ASSERT(got == data);
+}
+
+static void send_all(fleet::Socket::Ptr sock, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    int n = sock->send(data.data() + sent, std::min(CHUNK_SIZE, data.size() - sent));
+    ASSERT(n > 0);
+    sent += n;
+  }
+}
+
+static std::string make_data() {
+  std::string data(DATA_SIZE, '\0');
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<char>(rand());
+  }
+  return data;
+}
+
+static void test_send_file(fleet::IOManager &iom, const std::string &data, int fd) {
+  fleet::Socket::Ptr client, server;
+  make_pair(client, server);
+  iom.schedule([client, &data]() { recv_all(client, data); });
+  ssize_t n = server->send_file(fd, 0, data.size());
+  ASSERT(n == static_cast<ssize_t>(data.size()));
+  server->close();
+  WarnL << "send_file: " << n << " bytes";
+}
+
+static void test_splice(fleet::IOManager &iom, const std::string &data) {
+  // c1 -> s1 -(splice)-> c2 -> s2
+  fleet::Socket::Ptr c1, s1, c2, s2;
+  make_pair(c1, s1);
+  make_pair(c2, s2);
+  iom.schedule([s2, &data]() { recv_all(s2, data); });
+  iom.schedule([c1, &data]() {
+    send_all(c1, data);
+    c1->close();
+  });
+  ssize_t n = s1->splice_to(*c2);
+  ASSERT(n == static_cast<ssize_t>(data.size()));
+  c2->close();
+  WarnL << "splice_to: " << n << " bytes";
+}
+
+static void test_zerocopy(fleet::IOManager &iom, const std::string &data) {
+  fleet::Socket::Ptr client, server;
+  make_pair(client, server);
+  if (!server->set_zerocopy(true)) {
+    WarnL << "SO_ZEROCOPY not supported";
+    return;
+  }
+  // server上留着未读的数据，READ一直就绪，等待完成通知不能依赖READ事件
+  int n = client->send("x", 1);
+  ASSERT(n == 1);
+  iom.schedule([client, &data]() { recv_all(client, data); });
+  for (size_t i = 0; i < data.size(); i += CHUNK_SIZE) {
+    size_t sent = 0;
+    while (sent < CHUNK_SIZE) {
+      int n = server->send_zerocopy(data.data() + i + sent, CHUNK_SIZE - sent);
+      ASSERT(n > 0);
+      sent += n;
+    }
+  }
+  bool ok = server->wait_zerocopy();
+  ASSERT(ok);
+  ASSERT(server->get_zerocopy_pending() == 0);
+  // 回环上内核总是拷贝
+  WarnL << "send_zerocopy: " << data.size() << " bytes, copied sends " << server->get_zerocopy_copied();
+  // 关闭时还有未读的数据会发送RST
+  char c;
+  n = server->recv(&c, 1);
+  ASSERT(n == 1);
+  server->close();
+}
+
+int main() {
+  LOG_DEFAULT;
+  fleet::Logger::Instance().set_level(fleet::LogLevel::Warn);
+
+  std::string data = make_data();
+  // 在hook之外写文件，hook的write只处理有FdCtx的fd
+  char path[] = "/tmp/fleet_send_file_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT(fd >= 0);
+  unlink(path);
+  ssize_t n = write(fd, data.data(), data.size());
+  ASSERT(n == static_cast<ssize_t>(data.size()));
+  {
+    fleet::IOManager iom(2, "zero_copy");
+    iom.schedule([&iom, &data, fd]() {
+      test_send_file(iom, data, fd);
+      test_splice(iom, data);
+      test_zerocopy(iom, data);
+    });
+  }
+  close(fd);
+  return 0;
+}
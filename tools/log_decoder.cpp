@@ -0,0 +1,18 @@
+#include <cstdio>
+#include <iostream>
+
+#include "log.h"
+
+// 把BinaryFileChannel写的二进制日志文件解码成文本，输出到标准输出
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <binary log file>\n", argv[0]);
+    return 1;
+  }
+  int64_t count = fleet::BinaryFileChannel::decode(argv[1], std::cout);
+  if (count < 0) {
+    fprintf(stderr, "%s: not a valid binary log file\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}